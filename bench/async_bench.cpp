@@ -0,0 +1,176 @@
+// ** asynchronous engine benchmark ** //
+
+// Fans out GETs to a loopback server (loopback.hpp) that takes a fixed
+// latency per response, once one after the other with the blocking get() and
+// then through the curl_multi engine, with futures and with callbacks. One
+// JSON line per case with the requests, failures, milliseconds taken, the
+// speedup over blocking and the threads the callbacks ran on:
+//
+//   blocking   get() in a loop
+//   futures    get_async() futures for all of them, then get() on each
+//   callbacks  get_async() with a completion callback
+//   capped     callbacks again under set_max_inflight(8), which has to take
+//              about requests / 8 latencies
+//   head       c_async("HEAD") futures, headers and no body, each back
+//              within a second of its latency
+//
+// Every result must come back as a 200 with the body asked for and its
+// Content-Length header. Exits non-zero on a wrong answer, when the engine is
+// not at least ten times faster than blocking, when callbacks run on more
+// than one thread, or when capped is faster than its cap allows.
+//
+//   make -C bench && ./bench/async_bench [--requests N] [--latency-ms N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+
+struct outcome
+{
+    long n = 0, failures = 0;
+    double ms = 0;
+    size_t threads = 0;
+};
+
+static bool right(http_string_response& r)
+{
+    auto& h = r.get_headers();
+    auto it = h.find("Content-Length");
+    return r.no_error() && r.get_code() == 200 && r.get_body().size() == 200 && it != h.end() && it->second == "200";
+}
+
+static void print(const char* name, const outcome& o, double base_ms)
+{
+    printf("{\"bench\":\"async\",\"case\":\"%s\",\"requests\":%ld,\"failures\":%ld,\"ms\":%.1f,\"speedup\":%.1f,\"callback_threads\":%zu}\n",
+           name, o.n, o.failures, o.ms, base_ms / o.ms, o.threads);
+    fflush(stdout);
+}
+
+static double since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// every request with a callback, returns once all have completed
+static outcome callbacks(http_client& c, const std::string& url, long n)
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::set<std::thread::id> threads;
+    outcome o;
+    o.n = n;
+    long left = n;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++)
+        c.get_async(url, [&](http_string_response&& r) {
+            std::lock_guard<std::mutex> lk(mtx);
+            threads.insert(std::this_thread::get_id());
+            if (!right(r))
+                o.failures++;
+            if (--left == 0)
+                cv.notify_one();
+        });
+    std::unique_lock<std::mutex> lk(mtx);
+    cv.wait(lk, [&] { return left == 0; });
+    o.ms = since(t0);
+    o.threads = threads.size();
+    return o;
+}
+
+int main(int argc, char** argv)
+{
+    long n = 200, latency_ms = 20;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--requests")
+            n = atol(argv[i + 1]);
+        else if (a == "--latency-ms")
+            latency_ms = atol(argv[i + 1]);
+    }
+
+    loopback_server srv;
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    srv.set_latency(latency_ms * 1000);
+    const std::string url = srv.url("/bytes/200");
+    bool ok = true;
+
+    outcome blocking;
+    {
+        http_client c;
+        blocking.n = n;
+        auto t0 = std::chrono::steady_clock::now();
+        for (long i = 0; i < n; i++)
+        {
+            std::string body;
+            if (c.get(url, &body) != CURLE_OK || c.last_status() != 200 || body.size() != 200)
+                blocking.failures++;
+        }
+        blocking.ms = since(t0);
+        print("blocking", blocking, blocking.ms);
+        ok = ok && blocking.failures == 0;
+    }
+    {
+        http_client c;
+        outcome o;
+        o.n = n;
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::future<http_string_response>> futs;
+        for (long i = 0; i < n; i++)
+            futs.push_back(c.get_async(url));
+        for (auto& f : futs)
+        {
+            http_string_response r = f.get();
+            if (!right(r))
+                o.failures++;
+        }
+        o.ms = since(t0);
+        print("futures", o, blocking.ms);
+        ok = ok && o.failures == 0 && o.ms * 10 < blocking.ms;
+    }
+    {
+        http_client c;
+        outcome o = callbacks(c, url, n);
+        print("callbacks", o, blocking.ms);
+        ok = ok && o.failures == 0 && o.ms * 10 < blocking.ms && o.threads == 1;
+    }
+    {
+        const long cap = 8;
+        http_client c;
+        c.set_max_inflight(cap);
+        outcome o = callbacks(c, url, n);
+        print("capped", o, blocking.ms);
+        ok = ok && o.failures == 0 && o.threads == 1 && o.ms >= (n / cap) * latency_ms * 0.9;
+    }
+    {
+        http_client c;
+        outcome o;
+        o.n = n;
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::future<http_string_response>> futs;
+        for (long i = 0; i < n; i++)
+            futs.push_back(c.c_async("HEAD", url));
+        for (auto& f : futs)
+        {
+            if (f.wait_until(t0 + std::chrono::milliseconds(latency_ms + 1000)) != std::future_status::ready)
+            {
+                o.failures++;
+                continue;
+            }
+            http_string_response r = f.get();
+            if (!r.no_error() || r.get_code() != 200 || !r.get_body().empty() || r.get_header("Content-Length") != "200")
+                o.failures++;
+        }
+        o.ms = since(t0);
+        print("head", o, blocking.ms);
+        ok = ok && o.failures == 0;
+    }
+    return ok ? 0 : 1;
+}
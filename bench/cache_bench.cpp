@@ -0,0 +1,89 @@
+// ** response cache benchmark ** //
+
+// Repeated GETs of one URL against the loopback server (loopback.hpp), which
+// marks /cached/S fresh for S seconds and answers If-None-Match with 304.
+// Prints one JSON line per case with requests per second, the requests that
+// reached the server and the cache counters: "none" without a cache, "fresh"
+// served from memory, "revalidate" with max-age=0 so every call is a 304 and
+// "disk" from a second cache opened on the first one's directory, as after a
+// restart. Exits non-zero when a case does not behave as RFC 9111 says.
+//
+//   make -C bench && ./bench/cache_bench [--iterations N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static bool run(const char* name, http_client& c, loopback_server& srv, const std::string& url, long n, long want_requests,
+                const std::shared_ptr<http_cache>& cache)
+{
+    std::string resp, first;
+    long before = srv.requests();
+    int failures = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++)
+    {
+        resp.clear();
+        if (c.get(url, &resp) != CURLE_OK || c.last_status() != 200)
+            failures++;
+        if (i == 0)
+            first = resp;
+        else if (resp != first)
+            failures++;
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    long reached = srv.requests() - before;
+    cache_stats st = cache ? cache->stats() : cache_stats();
+    printf("{\"bench\":\"cache\",\"case\":\"%s\",\"iterations\":%ld,\"failures\":%d,\"rps\":%.1f,\"server_requests\":%ld,"
+           "\"hits\":%llu,\"misses\":%llu,\"revalidated\":%llu}\n",
+           name, n, failures, n / wall, reached, (unsigned long long)st.hits, (unsigned long long)st.misses,
+           (unsigned long long)st.revalidated);
+    fflush(stdout);
+    return failures == 0 && first.size() == 1024 && reached == want_requests;
+}
+
+int main(int argc, char** argv)
+{
+    long n = 20000;
+    for (int i = 1; i + 1 < argc; i += 2)
+        if (std::string(argv[i]) == "--iterations")
+            n = atol(argv[i + 1]);
+
+    loopback_server srv;
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    char tmpl[] = "/tmp/cache_bench.XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    bool ok = true;
+
+    {
+        http_client c;
+        ok = run("none", c, srv, srv.url("/cached/3600"), n, n, nullptr) && ok;
+    }
+    {
+        http_client c;
+        auto cache = std::make_shared<http_cache>(16 << 20, dir);
+        c.set_cache(cache);
+        ok = run("fresh", c, srv, srv.url("/cached/3600"), n, 1, cache) && ok;
+    }
+    {
+        http_client c;
+        auto cache = std::make_shared<http_cache>();
+        c.set_cache(cache);
+        ok = run("revalidate", c, srv, srv.url("/cached/0"), n, n, cache) && ok;
+    }
+    {
+        http_client c;
+        auto cache = std::make_shared<http_cache>(16 << 20, dir);
+        c.set_cache(cache);
+        ok = run("disk", c, srv, srv.url("/cached/3600"), n, 0, cache) && ok;
+        cache->clear();
+    }
+    rmdir(dir.c_str());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+// ** content-encoding benchmark ** //
+
+// Two parts, one JSON line per case. "codec" deflates a text-like and a
+// random payload at levels 1, 6 and 9 through deflate_reader and reports the
+// compression ratio and MB/s on the calling thread. "wire" runs put and get
+// against the loopback server (loopback.hpp) with and without compression
+// and reports requests per second and the body bytes that actually crossed
+// the socket; decoded responses are checked against the original. Puts go
+// out with both payloads, and a text one small enough to be deflated whole
+// up front; the random payload has to go out as is, the text ones
+// compressed.
+//
+//   make -C bench && ./bench/compress_bench [--size N] [--iterations N]
+
+// request compression is opt-in, and takes -lz
+#define HTTP_COMPRESSION 1
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// log lines of an API service, what most of our cross-datacenter traffic looks like
+static std::string text_payload(size_t size)
+{
+    static const char* const verbs[] = {"GET", "PUT", "POST", "DELETE"};
+    std::mt19937 rng(42);
+    std::string s;
+    s.reserve(size + 256);
+    while (s.size() < size)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "{\"ts\":%u,\"method\":\"%s\",\"path\":\"/v1/items/%u\",\"status\":%d,\"bytes\":%u,\"user\":\"u%05u\"}\n",
+                 1700000000u + (unsigned)(s.size() / 97), verbs[rng() % 4], (unsigned)(rng() % 100000), rng() % 10 ? 200 : 404,
+                 (unsigned)(rng() % 65536), (unsigned)(rng() % 5000));
+        s += line;
+    }
+    s.resize(size);
+    return s;
+}
+
+static std::string random_payload(size_t size)
+{
+    std::mt19937 rng(7);
+    std::string s(size, 0);
+    for (auto& c : s)
+        c = (char)rng();
+    return s;
+}
+
+static double since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = 1 << 20;
+    long iterations = 200;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--size")
+            size = strtoull(argv[i + 1], nullptr, 10);
+        else if (a == "--iterations")
+            iterations = atol(argv[i + 1]);
+    }
+
+    const std::pair<const char*, std::string> payloads[] = {{"text", text_payload(size)}, {"random", random_payload(size)}};
+
+    for (const auto& p : payloads)
+    {
+        for (int level : {1, 6, 9})
+        {
+            std::string out;
+            long reps = std::max(1L, iterations / 10);
+            auto t0 = std::chrono::steady_clock::now();
+            for (long i = 0; i < reps; i++)
+                compress_body(p.second, out, level, true);
+            double wall = since(t0);
+            printf("{\"bench\":\"codec\",\"payload\":\"%s\",\"size\":%zu,\"level\":%d,\"ratio\":%.2f,\"mb_per_s\":%.1f}\n",
+                   p.first, size, level, (double)size / std::max<size_t>(out.size(), 1), reps * size / wall / 1e6);
+            fflush(stdout);
+        }
+    }
+
+    loopback_server srv(size);
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    const std::string& text = payloads[0].second;
+    std::string packed;
+    compress_body(text, packed, 6, true);
+    srv.set_encoded(packed, "gzip");
+
+    // level 0 is the uncompressed baseline; /count answers with the body bytes received
+    int failures = 0;
+    const std::string small = text.substr(0, std::min<size_t>(size, 16 << 10));
+    const std::pair<const char*, const std::string*> bodies[] = {{"text", &text}, {"random", &payloads[1].second}, {"small", &small}};
+    for (const auto& b : bodies)
+    {
+        const std::string& body = *b.second;
+        bool packs = b.second != &payloads[1].second;
+        for (int level : {0, 1, 6})
+        {
+            http_client c;
+            if (level)
+            {
+                compression_options o;
+                o.min_body = 1024;
+                o.level = level;
+                c.set_compression(o);
+            }
+            std::string resp;
+            curl_off_t wire = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for (long i = 0; i < iterations; i++)
+            {
+                resp.clear();
+                if (c.put(srv.url("/count"), body, &resp) != CURLE_OK)
+                    failures++;
+                size_t got = strtoull(resp.c_str(), nullptr, 10);
+                if (level && packs ? got >= body.size() : got != body.size())
+                    failures++;
+                wire += c.last_timing().bytes_sent;
+            }
+            double wall = since(t0);
+            printf("{\"bench\":\"wire\",\"op\":\"put\",\"payload\":\"%s\",\"size\":%zu,\"level\":%d,\"rps\":%.1f,\"wire_bytes\":%lld,\"ratio\":%.2f,\"failures\":%d}\n",
+                   b.first, body.size(), level, iterations / wall, (long long)(wire / iterations),
+                   (double)body.size() * iterations / std::max<curl_off_t>(wire, 1), failures);
+            fflush(stdout);
+        }
+    }
+
+    for (bool decode : {false, true})
+    {
+        http_client c;
+        if (decode)
+            c.set_compression(compression_options());
+        // without decoding the plain body comes from /bytes/N instead
+        std::string url = decode ? srv.url("/encoded") : srv.url("/bytes/" + std::to_string(size));
+        std::string resp;
+        curl_off_t wire = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++)
+        {
+            resp.clear();
+            if (c.get(url, &resp) != CURLE_OK || resp.size() != size || (decode && resp != text))
+                failures++;
+            wire += c.last_timing().bytes_received;
+        }
+        double wall = since(t0);
+        printf("{\"bench\":\"wire\",\"op\":\"get\",\"size\":%zu,\"encoding\":\"%s\",\"rps\":%.1f,\"wire_bytes\":%lld,\"failures\":%d}\n",
+               size, decode ? "gzip" : "identity", iterations / wall, (long long)(wire / iterations), failures);
+        fflush(stdout);
+    }
+    return failures ? 1 : 0;
+}
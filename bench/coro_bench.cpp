@@ -0,0 +1,195 @@
+// ** coroutine request benchmark ** //
+
+// Runs many http_task coroutines against the loopback server (loopback.hpp),
+// all of them co_awaiting http_client calls on the client's one engine
+// thread. One JSON line per case with the coroutines run, requests per
+// second, failures and the number of distinct threads the coroutines were
+// resumed on:
+//
+//   fanout     every coroutine does one GET, all of them in flight at once
+//   chain      GET, PUT and a multipart POST one after the other in each
+//              coroutine, the POST in a task of its own that is awaited
+//   executor   fanout again, resumed on a second engine's thread
+//   timeout    a slow server and a timeout well below its latency, queued
+//              requests included
+//   cancel     a slow server, one http_cancel stops everything in flight
+//
+// Exits non-zero on a wrong answer, when coroutines resume on more than one
+// thread, or when timed out or cancelled requests take as long as the server.
+//
+//   make -C bench && ./bench/coro_bench [--coroutines N] [--latency-ms N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+
+struct outcome
+{
+    long n = 0, failures = 0;
+    double rps = 0, ms = 0;
+    size_t threads = 0;
+};
+
+struct tally
+{
+    std::mutex mtx;
+    std::set<std::thread::id> threads;
+    long failures = 0;
+    void resumed(bool ok)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        threads.insert(std::this_thread::get_id());
+        if (!ok)
+            failures++;
+    }
+};
+
+// starts every task, returns once all are done
+template <class F>
+static outcome run(const char* name, long n, tally& t, F make)
+{
+    std::vector<http_task<>> tasks;
+    tasks.reserve(n);
+    for (long i = 0; i < n; i++)
+        tasks.push_back(make(i));
+    std::mutex mtx;
+    std::condition_variable cv;
+    long left = n;
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto& task : tasks)
+        task.start([&] {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (--left == 0)
+                cv.notify_one();
+        });
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [&] { return left == 0; });
+    }
+    outcome o;
+    o.n = n;
+    o.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    o.rps = n / (o.ms / 1000);
+    o.failures = t.failures;
+    o.threads = t.threads.size();
+    printf("{\"bench\":\"coro\",\"case\":\"%s\",\"coroutines\":%ld,\"failures\":%ld,\"rps\":%.1f,\"ms\":%.1f,\"resume_threads\":%zu}\n",
+           name, o.n, o.failures, o.rps, o.ms, o.threads);
+    fflush(stdout);
+    return o;
+}
+
+static http_task<> fetch(http_client& c, std::string url, tally& t, coro_executor on = nullptr)
+{
+    http_string_response r = co_await c.co_get(url).resume_on(on);
+    t.resumed(r.get_result() == CURLE_OK && r.get_code() == 200 && r.get_body().size() == 256);
+}
+
+static http_task<long> upload(http_client& c, std::string url, const mime_form& form)
+{
+    http_string_response r = co_await c.co_formpost(url, form);
+    co_return r.no_error() ? atol(r.get_body().c_str()) : -1;
+}
+
+static http_task<> chain(http_client& c, loopback_server& srv, const mime_form& form, long form_bytes, tally& t)
+{
+    http_string_response a = co_await c.co_get(srv.url("/bytes/256"));
+    bool ok = a.no_error() && a.get_body().size() == 256;
+    http_string_response b = co_await c.co_put(srv.url("/count"), a.take_body());
+    ok = ok && b.no_error() && b.get_body() == "256";
+    long sent = co_await upload(c, srv.url("/count"), form);
+    t.resumed(ok && sent == form_bytes);
+}
+
+static http_task<> expect(http_client& c, std::string url, CURLcode want, tally& t, long timeout_ms, const http_cancel* cancel)
+{
+    http_call call = c.co_get(url);
+    if (timeout_ms)
+        call.timeout(timeout_ms);
+    if (cancel)
+        call.cancel_with(*cancel);
+    http_string_response r = co_await call;
+    t.resumed(r.get_result() == want);
+}
+
+int main(int argc, char** argv)
+{
+    long n = 20000, latency_ms = 200;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--coroutines")
+            n = atol(argv[i + 1]);
+        else if (a == "--latency-ms")
+            latency_ms = atol(argv[i + 1]);
+    }
+
+    loopback_server srv;
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    const std::string url = srv.url("/bytes/256");
+    http_client c;
+    bool ok = true;
+
+    {
+        tally t;
+        outcome o = run("fanout", n, t, [&](long) { return fetch(c, url, t); });
+        ok = ok && o.failures == 0 && o.threads == 1;
+    }
+    {
+        // the same form for every coroutine, its parts are only read
+        std::string blob(4096, '\0');
+        mime_form form;
+        form.add<mime_buffer_part>("blob", std::string_view(blob), "blob.bin");
+        form.add<mime_string_part>("note", "coroutines");
+        // what one POST of it amounts to on the wire
+        std::string size;
+        c.formpost(srv.url("/count"), form, &size);
+        long form_bytes = atol(size.c_str());
+
+        tally t;
+        outcome o = run("chain", n / 4, t, [&](long) { return chain(c, srv, form, form_bytes, t); });
+        ok = ok && o.failures == 0 && o.threads == 1 && form_bytes > 4096;
+    }
+    {
+        http_multi other;
+        other.start();
+        std::promise<std::thread::id> home;
+        other.post([&] { home.set_value(std::this_thread::get_id()); });
+        std::thread::id expected = home.get_future().get();
+
+        tally t;
+        coro_executor on = engine_executor(other);
+        outcome o = run("executor", n, t, [&](long) { return fetch(c, url, t, on); });
+        ok = ok && o.failures == 0 && o.threads == 1 && *t.threads.begin() == expected;
+    }
+
+    srv.set_latency(latency_ms * 1000);
+    {
+        // more than the engine runs at once, the rest time out in its queue
+        tally t;
+        outcome o = run("timeout", 1000, t, [&](long) { return expect(c, url, CURLE_OPERATION_TIMEDOUT, t, latency_ms / 10, nullptr); });
+        ok = ok && o.failures == 0 && o.ms < latency_ms / 2;
+    }
+    {
+        http_cancel stop;
+        tally t;
+        std::thread canceller([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(latency_ms / 10));
+            stop.cancel();
+        });
+        outcome o = run("cancel", 1000, t, [&](long) { return expect(c, url, CURLE_ABORTED_BY_CALLBACK, t, 0, &stop); });
+        canceller.join();
+        // awaited after the fact, it never goes out
+        tally late;
+        http_task<> after = expect(c, url, CURLE_ABORTED_BY_CALLBACK, late, 0, &stop);
+        after.wait();
+        ok = ok && o.failures == 0 && o.ms < latency_ms / 2 && late.failures == 0;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+// ** external event loop benchmark ** //
+
+// Drives an http_client from the calling thread: its engine is an
+// http_multi(requests) attached to an epoll_loop (http_epoll.hpp), and every
+// GET is put in flight at once with get_async() before the loop runs until
+// the last callback. The loopback server (loopback.hpp) holds each response
+// back by the given latency, so every request has to be open at the same time
+// for the run to take about one latency. One JSON line with the requests,
+// failures, milliseconds taken, the most responses the server was holding at
+// once, the threads the callbacks ran on, and the epoll wakeups and socket
+// events they took.
+//
+// Exits non-zero on a failed request, when a callback runs on another thread
+// than the loop's, or when fewer than nine in ten requests were in flight
+// together. The server runs in a child process: 10k connections are 20k
+// sockets on one machine, more than one process may open under the usual
+// limit of 20000.
+//
+//   make -C bench && ./bench/epoll_bench [--requests N] [--latency-ms N]
+
+#include "../src/http_client.hpp"
+#include "../src/http_epoll.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// as many files as the hard limit allows, false when that is fewer than want
+static bool raise_fds(rlim_t want)
+{
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+        return false;
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    return rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur >= want;
+}
+
+// the child: serves until the parent closes ctl, then reports the peak on res
+static int serve(long latency_ms, int ctl, int res)
+{
+    loopback_server srv;
+    int port = srv.valid() ? srv.port() : 0;
+    srv.set_latency(latency_ms * 1000);
+    if (write(res, &port, sizeof(port)) != sizeof(port) || !port)
+        return 1;
+    char c;
+    while (read(ctl, &c, 1) > 0)
+        ;
+    long peak = (long)srv.peak();
+    return write(res, &peak, sizeof(peak)) == sizeof(peak) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    long n = 10000, latency_ms = 2000;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--requests")
+            n = atol(argv[i + 1]);
+        else if (a == "--latency-ms")
+            latency_ms = atol(argv[i + 1]);
+    }
+    if (!raise_fds(n + 64))
+    {
+        fprintf(stderr, "%ld requests need more open files than allowed\n", n);
+        return 1;
+    }
+
+    int ctl[2], res[2];
+    if (pipe(ctl) != 0 || pipe(res) != 0)
+        return 1;
+    pid_t child = fork();
+    if (child < 0)
+        return 1;
+    if (child == 0)
+    {
+        close(ctl[1]);
+        close(res[0]);
+        _exit(serve(latency_ms, ctl[0], res[1]));
+    }
+    close(ctl[0]);
+    close(res[1]);
+    int port = 0;
+    if (read(res[0], &port, sizeof(port)) != sizeof(port) || !port)
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    const std::string url = "http://127.0.0.1:" + std::to_string(port) + "/bytes/64";
+
+    long failures = 0, left = n, wakeups = 0, events = 0;
+    std::thread::id loop_thread = std::this_thread::get_id();
+    bool elsewhere = false;
+    double ms;
+    {
+        auto engine = std::make_shared<http_multi>(n);
+        epoll_loop loop(*engine);
+        http_client c;
+        c.set_engine(engine);
+
+        auto t0 = std::chrono::steady_clock::now();
+        for (long i = 0; i < n; i++)
+            c.get_async(url, [&](http_string_response&& r) {
+                elsewhere = elsewhere || std::this_thread::get_id() != loop_thread;
+                if (!r.no_error() || r.get_code() != 200 || r.get_body().size() != 64)
+                    failures++;
+                left--;
+            });
+        while (left)
+        {
+            int ev = loop.run_once(100);
+            wakeups++;
+            events += ev;
+        }
+        ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    close(ctl[1]);
+    long peak = 0;
+    if (read(res[0], &peak, sizeof(peak)) != sizeof(peak))
+        peak = 0;
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    printf("{\"bench\":\"epoll\",\"requests\":%ld,\"failures\":%ld,\"ms\":%.1f,\"peak_in_flight\":%ld,\"callback_threads\":%d,\"wakeups\":%ld,\"events\":%ld}\n",
+           n, failures, ms, peak, elsewhere ? 2 : 1, wakeups, events);
+    fflush(stdout);
+    return failures == 0 && !elsewhere && peak * 10 >= n * 9 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// ** executor scaling benchmark ** //
+
+// Pushes GETs through an http_executor with 1, 2, 4 ... N engine threads
+// against the in-process loopback server (loopback.hpp), keeping a fixed
+// number of requests in flight per engine, and prints one JSON line per
+// thread count with requests per second and the speedup over one thread.
+// Half the requests go to 127.0.0.1 and half to localhost, so both host
+// routing and stealing get exercised. The loopback server shares the
+// machine, so the curve flattens once client and server compete for cores.
+//
+//   make -C bench && ./bench/executor_bench [threads] [requests_per_thread]
+
+#include "../src/http_executor.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char** argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)std::max(1u, std::thread::hardware_concurrency());
+    long per_thread = argc > 2 ? atol(argv[2]) : 20000;
+    const size_t window = 16;
+
+    loopback_server srv;
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    const std::string urls[2] = {srv.url("/bytes/64"), "http://localhost:" + std::to_string(srv.port()) + "/bytes/64"};
+
+    double single = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        http_executor ex(threads, window);
+        long n = per_thread * threads;
+        std::mutex mtx;
+        std::condition_variable cv;
+        long sent = 0, done = 0, failures = 0;
+
+        // every completion sends the next request, so each engine keeps window transfers busy
+        std::function<void()> next;
+        http_transfer::callback cb = [&](http_string_response&& r) {
+            bool more;
+            {
+                std::lock_guard<std::mutex> lk(mtx);
+                done++;
+                if (!r.no_error() || r.get_code() != 200)
+                    failures++;
+                more = sent < n;
+                if (more)
+                    sent++;
+                if (done == n)
+                    cv.notify_one();
+            }
+            if (more)
+                next();
+        };
+        std::atomic<long> k{0};
+        next = [&] { ex.get_async(urls[k++ & 1], cb); };
+
+        auto t0 = std::chrono::steady_clock::now();
+        long first = std::min(n, (long)(window * threads));
+        sent = first;
+        for (long i = 0; i < first; i++)
+            next();
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            cv.wait(lk, [&] { return done == n; });
+        }
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        double rps = n / wall;
+        if (threads == 1)
+            single = rps;
+
+        printf("{\"bench\":\"executor\",\"threads\":%d,\"requests\":%ld,\"failures\":%ld,\"rps\":%.1f,\"speedup\":%.2f}\n",
+               threads, n, failures, rps, rps / single);
+        fflush(stdout);
+        if (failures)
+            return 1;
+    }
+    return 0;
+}
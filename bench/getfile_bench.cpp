@@ -0,0 +1,142 @@
+// ** getfile disk path benchmark ** //
+
+// Downloads /bytes/N from the loopback server (loopback.hpp) with the old
+// std::ofstream writer and with file_sink in its io_uring, writer thread and
+// O_DIRECT modes. One JSON line per case with the bytes, the runs, the
+// failures and the MB/s of the best run:
+//
+//   ofstream                the write path getfile() used before file_sink
+//   file_sink/uring         io_uring, or the writer threads where it is refused
+//   file_sink/threads       writer threads
+//   file_sink/uring+direct  io_uring with O_DIRECT, where the filesystem allows
+//
+// Every run must leave a file of exactly the bytes served, all of them the
+// server's payload. Exits non-zero when a run fails or leaves anything else.
+//
+//   make -C bench && ./bench/getfile_bench [--bytes N] [--runs N] [--fsync 1] [--out PATH]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// the write path getfile() used before file_sink
+class ofstream_sink : public response_sink
+{
+    std::ofstream out;
+public:
+    ofstream_sink(const std::string& path) : out(path) {}
+    bool write(const char* data, size_t len) override
+    {
+        out.write(data, len);
+        return (bool)out;
+    }
+};
+
+// the file holds exactly n bytes of the loopback payload
+static bool intact(const std::string& path, size_t n)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+        return false;
+    std::vector<char> buf(1 << 16);
+    size_t total = 0, got;
+    bool ok = true;
+    while (ok && (got = fread(buf.data(), 1, buf.size(), f)) > 0)
+    {
+        for (size_t i = 0; i < got && ok; i++)
+            ok = buf[i] == 'x';
+        total += got;
+    }
+    fclose(f);
+    return ok && total == n;
+}
+
+// one download, the seconds it took or a negative number when it failed
+static double run(http_client& c, const std::string& url, const std::string& path, int mode, bool sync, size_t n)
+{
+    file_sink_options o;
+    o.sync = sync;
+    o.uring = (mode == 1 || mode == 3);
+    o.direct = (mode == 3);
+
+    remove(path.c_str());
+    auto t0 = std::chrono::steady_clock::now();
+    int rc;
+    if (mode == 0)
+    {
+        ofstream_sink s(path);
+        rc = c.get(url, s);
+        if (sync)
+        {
+            FILE* f = fopen(path.c_str(), "r+");
+            if (f)
+            {
+                fsync(fileno(f));
+                fclose(f);
+            }
+        }
+    }
+    else
+    {
+        c.set_file_options(o);
+        rc = c.getfile(url, path);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    if (rc != CURLE_OK || c.last_status() != 200 || !intact(path, n))
+        return -1;
+    return secs;
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = 64 << 20;
+    int runs = 5;
+    bool sync = false;
+    std::string path = "/tmp/getfile_bench." + std::to_string(getpid());
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--bytes")
+            n = strtoull(argv[i + 1], nullptr, 10);
+        else if (a == "--runs")
+            runs = atoi(argv[i + 1]);
+        else if (a == "--fsync")
+            sync = atoi(argv[i + 1]) != 0;
+        else if (a == "--out")
+            path = argv[i + 1];
+    }
+
+    loopback_server srv(n);
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    const std::string url = srv.url("/bytes/" + std::to_string(n));
+    const char* names[] = {"ofstream", "file_sink/uring", "file_sink/threads", "file_sink/uring+direct"};
+    bool ok = true;
+
+    http_client c;
+    for (int mode = 0; mode < 4; mode++)
+    {
+        double best = 0;
+        long failures = 0;
+        for (int i = 0; i < runs; i++)
+        {
+            double secs = run(c, url, path, mode, sync, n);
+            if (secs < 0)
+                failures++;
+            else if (best == 0 || secs < best)
+                best = secs;
+        }
+        printf("{\"bench\":\"getfile\",\"case\":\"%s\",\"bytes\":%zu,\"runs\":%d,\"failures\":%ld,\"fsync\":%s,\"mb_per_s\":%.1f}\n",
+               names[mode], n, runs, failures, sync ? "true" : "false", best > 0 ? n / best / 1e6 : 0.0);
+        fflush(stdout);
+        ok = ok && failures == 0;
+    }
+    remove(path.c_str());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+// ** hedged request benchmark ** //
+
+// Sequential GETs against the loopback server (loopback.hpp), which answers
+// in about a millisecond except for every Nth response that is held back for
+// a latency spike. One JSON line per case with the call latency percentiles,
+// the requests the servers saw per call and the policy's counters:
+//
+//   plain      no hedging, the spikes show up in p99
+//   hedged     a duplicate after the p95 latency, the spikes disappear
+//   endpoint   the duplicates go to a second server instead
+//   budget     a budget of 1% lets only that many duplicates out
+//   retry      every 5th response is a 503, retries with backoff hide it
+//   deadline   long spikes, no hedges or retries, the deadline cuts calls short
+//   limited    every response a 503 and a rate limiter that turns the retries
+//              away, the calls report the 503 and the budget is given back
+//
+// Exits non-zero when hedging does not cut p99, the budget is overspent, a
+// retried call still fails, a call outlives its deadline or a turned away
+// retry hides the answer before it.
+//
+//   make -C bench && ./bench/hedge_bench [--iterations N] [--spike-ms N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct outcome
+{
+    long failures = 0, timeouts = 0;
+    double p50 = 0, p99 = 0, p999 = 0, max = 0;     // ms
+    double load = 0;                                // server requests per call
+};
+
+static outcome run(const char* name, loopback_server& srv, loopback_server* alt, long n, const std::shared_ptr<hedge_policy>& policy)
+{
+    http_client c;
+    c.set_hedging(policy);
+    const std::string url = srv.url("/bytes/1024");
+    std::vector<double> lat;
+    outcome o;
+    std::string resp;
+    long before = srv.requests() + (alt ? alt->requests() : 0);
+    for (long i = 0; i < n; i++)
+    {
+        resp.clear();
+        auto t0 = std::chrono::steady_clock::now();
+        int rc = c.get(url, &resp);
+        lat.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        if (rc == CURLE_OPERATION_TIMEDOUT)
+            o.timeouts++;
+        else if (rc != CURLE_OK || c.last_status() != 200 || resp.size() != 1024)
+            o.failures++;
+    }
+    std::sort(lat.begin(), lat.end());
+    o.p50 = lat[lat.size() / 2];
+    o.p99 = lat[std::min(lat.size() - 1, lat.size() * 99 / 100)];
+    o.p999 = lat[std::min(lat.size() - 1, lat.size() * 999 / 1000)];
+    o.max = lat.back();
+    o.load = (double)(srv.requests() + (alt ? alt->requests() : 0) - before) / n;
+    printf("{\"bench\":\"hedge\",\"case\":\"%s\",\"calls\":%ld,\"failures\":%ld,\"timeouts\":%ld,\"p50_ms\":%.2f,\"p99_ms\":%.2f,\"p999_ms\":%.2f,"
+           "\"max_ms\":%.2f,\"load\":%.3f,\"hedges\":%llu,\"hedge_wins\":%llu,\"retries\":%llu,\"denied\":%llu}\n",
+           name, n, o.failures, o.timeouts, o.p50, o.p99, o.p999, o.max, o.load,
+           (unsigned long long)(policy ? policy->hedge_count() : 0), (unsigned long long)(policy ? policy->hedge_win_count() : 0),
+           (unsigned long long)(policy ? policy->retry_count() : 0), (unsigned long long)(policy ? policy->denied_count() : 0));
+    fflush(stdout);
+    return o;
+}
+
+int main(int argc, char** argv)
+{
+    long n = 2000, spike_ms = 50;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--iterations")
+            n = atol(argv[i + 1]);
+        else if (a == "--spike-ms")
+            spike_ms = atol(argv[i + 1]);
+    }
+
+    loopback_server srv, alt;
+    if (!srv.valid() || !alt.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    srv.set_latency(1000);
+    alt.set_latency(1000);
+    srv.set_spikes(40, spike_ms * 1000);
+    bool ok = true;
+
+    outcome plain = run("plain", srv, nullptr, n, nullptr);
+    ok = ok && plain.failures == 0;
+
+    {
+        auto p = std::make_shared<hedge_policy>();
+        outcome o = run("hedged", srv, nullptr, n, p);
+        ok = ok && o.failures == 0 && o.p99 < plain.p99 / 4 && p->hedge_count() <= n * p->options().budget_ratio + p->options().budget_reserve;
+    }
+    {
+        hedge_options ho;
+        ho.endpoints.push_back(alt.url(""));
+        auto p = std::make_shared<hedge_policy>(ho);
+        long before = alt.requests();
+        outcome o = run("endpoint", srv, &alt, n, p);
+        ok = ok && o.failures == 0 && o.p99 < plain.p99 / 4 && alt.requests() - before == (long)p->hedge_count();
+    }
+    {
+        hedge_options ho;
+        ho.budget_ratio = 0.01;
+        ho.budget_reserve = 1;
+        auto p = std::make_shared<hedge_policy>(ho);
+        outcome o = run("budget", srv, nullptr, n, p);
+        ok = ok && o.failures == 0 && p->hedge_count() <= n * ho.budget_ratio + ho.budget_reserve && p->denied_count() > 0;
+    }
+
+    srv.set_spikes(0, 0);
+    srv.set_failures(5);
+    {
+        hedge_options ho;
+        ho.max_hedges = 0;
+        ho.budget_ratio = 0.5;
+        ho.backoff_ms = 2;
+        auto p = std::make_shared<hedge_policy>(ho);
+        outcome o = run("retry", srv, nullptr, n, p);
+        ok = ok && o.failures == 0 && o.timeouts == 0 && p->retry_count() > 0;
+    }
+
+    srv.set_failures(1);
+    {
+        hedge_options ho;
+        ho.max_hedges = 0;
+        ho.backoff_ms = 1;
+        auto p = std::make_shared<hedge_policy>(ho);
+        limit_options lo;
+        lo.rate = 1;
+        lo.burst = 1;
+        lo.max_queue = 0;
+        http_client c;
+        c.set_hedging(p);
+        c.set_limiter(std::make_shared<http_limiter>(lo));
+        std::string resp;
+        int rc = c.get(srv.url("/bytes/1024"), &resp);
+        long status = c.last_status();
+        // the next calls are turned away before they start, nothing to report but that
+        int rest = c.get(srv.url("/bytes/1024"), &resp);
+        printf("{\"bench\":\"hedge\",\"case\":\"limited\",\"rc\":%d,\"status\":%ld,\"next_rc\":%d,\"retries\":%llu,\"denied\":%llu}\n",
+               rc, status, rest, (unsigned long long)p->retry_count(), (unsigned long long)p->denied_count());
+        fflush(stdout);
+        ok = ok && rc == CURLE_OK && status == 503 && rest == CURL_LIMITED && p->retry_count() == 0;
+    }
+
+    srv.set_failures(0);
+    srv.set_spikes(2, spike_ms * 4000);
+    {
+        hedge_options ho;
+        ho.max_hedges = 0;
+        ho.max_retries = 0;
+        ho.deadline_ms = 20;
+        auto p = std::make_shared<hedge_policy>(ho);
+        outcome o = run("deadline", srv, nullptr, std::min(n, 100L), p);
+        // spiked calls give up at the deadline, give or take scheduling
+        ok = ok && o.failures == 0 && o.timeouts > 0 && o.max < ho.deadline_ms + 30;
+    }
+    return ok ? 0 : 1;
+}
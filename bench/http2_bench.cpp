@@ -0,0 +1,145 @@
+// ** HTTP/2 multiplexing benchmark ** //
+
+// Sends batches of concurrent GETs through an http_client with enable_http2()
+// to the loopback server (loopback.hpp), which answers prior knowledge
+// (h2c) with "ok" on every stream, or with a 400 when it is to speak HTTP/1.1
+// only, and HTTP/1.1 requests with the bytes /bytes/N asked for, so the body
+// tells which protocol carried a request. One JSON
+// line per case with the requests, failures, requests per second and the
+// connections the server accepted:
+//
+//   h2c        an h2c server; every batch multiplexed over one connection,
+//              after the first request on one of its own
+//   fallback   an HTTP/1.1 server; the first request finds out and every
+//              request succeeds over HTTP/1.1
+//   post       an HTTP/1.1 server that is first sent a POST; it fails rather
+//              than going out twice, the GETs after it succeed
+//   transient  an h2c server that drops the first connection; the GET that
+//              hit it fails or is sent again over h2c by libcurl, the batch
+//              after it is h2c
+//
+// libcurl before 8.0 gets no prior knowledge but an Upgrade: h2c offer, which
+// the loopback server ignores: there every case expects HTTP/1.1 bodies, the
+// POST to succeed and no bound on connections, and the lines say
+// "prior_knowledge":false. Exits non-zero when a request fails that should
+// not, when a body comes back over the wrong protocol, or when h2c takes more
+// connections than that. Point CURL at another libcurl's prefix to build
+// against it:
+//
+//   make -C bench && ./bench/http2_bench [--requests N] [--batches N]
+//   make -C bench http2_bench CXXFLAGS="-std=c++17 -O2 -I$CURL/include" LDLIBS="-L$CURL/lib -Wl,-rpath,$CURL/lib -lcurl -lpthread"
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct outcome
+{
+    long n = 0, failures = 0;
+    double rps = 0;
+};
+
+// n GETs in flight at once, counted as failures unless they come back with body
+static outcome batch(http_client& c, const std::string& url, long n, const std::string& body)
+{
+    std::vector<std::future<http_string_response>> futs;
+    futs.reserve(n);
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++)
+        futs.push_back(c.get_async(url));
+    outcome o;
+    o.n = n;
+    for (auto& f : futs)
+    {
+        http_string_response r = f.get();
+        if (!r.no_error() || r.get_code() != 200 || r.get_body() != body)
+            o.failures++;
+    }
+    o.rps = n / std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return o;
+}
+
+static bool prior = true;
+
+static void print(const char* name, const outcome& o, long connections)
+{
+    printf("{\"bench\":\"http2\",\"case\":\"%s\",\"prior_knowledge\":%s,\"requests\":%ld,\"failures\":%ld,\"rps\":%.1f,\"connections\":%ld}\n",
+           name, prior ? "true" : "false", o.n, o.failures, o.rps, connections);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    long n = 50, batches = 20;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--requests")
+            n = atol(argv[i + 1]);
+        else if (a == "--batches")
+            batches = atol(argv[i + 1]);
+    }
+    prior = curl_version_info(CURLVERSION_NOW)->version_num >= 0x080000;
+    const std::string h1_body(256, 'x');
+    const std::string h2_body = prior ? "ok" : h1_body;
+    bool ok = true;
+
+    {
+        loopback_server srv;
+        if (!srv.valid())
+        {
+            fprintf(stderr, "cannot start loopback server\n");
+            return 1;
+        }
+        srv.set_h2c(true);
+        http_client c;
+        c.enable_http2();
+        outcome o;
+        for (long b = 0; b < batches; b++)
+        {
+            outcome one = batch(c, srv.url("/bytes/256"), n, h2_body);
+            o.n += one.n;
+            o.failures += one.failures;
+            o.rps += one.rps / batches;
+        }
+        print("h2c", o, srv.connections());
+        ok = ok && o.failures == 0 && (!prior || srv.connections() == 2);
+    }
+    {
+        loopback_server srv;
+        http_client c;
+        c.enable_http2();
+        outcome o = batch(c, srv.url("/bytes/256"), n, h1_body);
+        print("fallback", o, srv.connections());
+        ok = ok && o.failures == 0;
+    }
+    {
+        loopback_server srv;
+        http_client c;
+        c.enable_http2();
+        http_string_response r = c.simplepost_async(srv.url("/count"), std::string(64, 'p')).get();
+        outcome o = batch(c, srv.url("/bytes/256"), n, h1_body);
+        o.n++;
+        if (prior ? r.no_error() : !r.no_error() || r.get_code() != 200)
+            o.failures++;
+        print("post", o, srv.connections());
+        ok = ok && o.failures == 0;
+    }
+    {
+        loopback_server srv;
+        srv.set_h2c(true);
+        srv.set_drops(1);
+        http_client c;
+        c.enable_http2();
+        http_string_response r = c.get_async(srv.url("/bytes/256")).get();
+        outcome o = batch(c, srv.url("/bytes/256"), n, h2_body);
+        o.n++;
+        if (r.no_error() && r.get_body() != h2_body)
+            o.failures++;
+        print("transient", o, srv.connections());
+        ok = ok && o.failures == 0 && (!prior || srv.connections() == 3);
+    }
+    return ok ? 0 : 1;
+}
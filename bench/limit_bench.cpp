@@ -0,0 +1,216 @@
+// ** adaptive concurrency limit benchmark ** //
+
+// Many threads, each with its own http_client, hammer the loopback server
+// (loopback.hpp) which answers after a fixed latency with only a few requests
+// worked on at once, so that extra concurrency just queues inside the server.
+// One JSON line per case with goodput, the call latency the threads saw, the
+// server side latency (time to first byte) and the limiter's view of the host,
+// its limit averaged over each half of the run and at the end:
+//
+//   unlimited   no limiter, the server queue absorbs everything
+//   gradient    LIMIT_GRADIENT, the limit settles near the server's capacity
+//   aimd        LIMIT_AIMD, the same with additive increase
+//   degrade     gradient again, the server gets four times slower halfway
+//               through and the limit has to come down
+//   reject      no queue in front of a small limit, excess calls fail fast
+//   rate        a token bucket caps the request rate
+//
+// Exits non-zero when a limiter does not keep the server side latency below
+// the unlimited case, does not react to the slowdown, or lets more through
+// than the rate cap allows.
+//
+//   make -C bench && ./bench/limit_bench [--threads N] [--seconds S] [--latency-ms N] [--capacity N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct outcome
+{
+    long ok = 0, limited = 0, failed = 0;
+    double rps = 0;
+    double call_p50 = 0, call_p99 = 0;      // ms, including the wait for admission
+    double server_p50 = 0, server_p99 = 0;  // ms, time to first byte
+    double limit_first = 0, limit_second = 0;   // mean over the first and second half of the run
+    double limit_end = 0;
+    size_t max_queued = 0;
+};
+
+static double pct(std::vector<double>& v, double p)
+{
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static outcome hammer(loopback_server& srv, const std::shared_ptr<http_limiter>& limiter, size_t threads, double seconds,
+                      std::function<void()> halfway = nullptr)
+{
+    const std::string url = srv.url("/bytes/256");
+    std::atomic<bool> stop{false};
+    std::mutex mtx;
+    outcome o;
+    std::vector<double> calls, server;
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < threads; i++)
+        pool.emplace_back([&] {
+            http_client c;
+            c.set_limiter(limiter);
+            std::vector<double> mc, ms;
+            long ok = 0, limited = 0, failed = 0;
+            std::string resp;
+            while (!stop)
+            {
+                resp.clear();
+                auto t0 = std::chrono::steady_clock::now();
+                int rc = c.get(url, &resp);
+                double ms_call = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                if (rc == CURL_LIMITED)
+                    limited++;
+                else if (rc != CURLE_OK || c.last_status() != 200 || resp.size() != 256)
+                    failed++;
+                else
+                {
+                    ok++;
+                    mc.push_back(ms_call);
+                    ms.push_back(c.last_timing().starttransfer / 1000.0);
+                }
+                // a turned away caller backs off a little instead of spinning
+                if (rc == CURL_LIMITED)
+                    usleep(1000);
+            }
+            std::lock_guard<std::mutex> lk(mtx);
+            o.ok += ok;
+            o.limited += limited;
+            o.failed += failed;
+            calls.insert(calls.end(), mc.begin(), mc.end());
+            server.insert(server.end(), ms.begin(), ms.end());
+        });
+
+    auto t0 = std::chrono::steady_clock::now();
+    auto end = t0 + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    auto mid = t0 + (end - t0) / 2;
+    bool passed_mid = false;
+    // the limit swings from sample to sample, each half is judged by its mean
+    double sum[2] = {0, 0};
+    long samples[2] = {0, 0};
+    while (std::chrono::steady_clock::now() < end)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if (limiter)
+        {
+            limit_stats st = limiter->stats(url);
+            o.max_queued = std::max(o.max_queued, st.queued);
+            o.limit_end = st.limit;
+            sum[passed_mid] += st.limit;
+            samples[passed_mid]++;
+        }
+        if (!passed_mid && std::chrono::steady_clock::now() >= mid)
+        {
+            passed_mid = true;
+            if (halfway)
+                halfway();
+        }
+    }
+    o.limit_first = samples[0] ? sum[0] / samples[0] : 0;
+    o.limit_second = samples[1] ? sum[1] / samples[1] : 0;
+    stop = true;
+    for (auto& t : pool)
+        t.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    o.rps = o.ok / wall;
+    o.call_p50 = pct(calls, 0.5);
+    o.call_p99 = pct(calls, 0.99);
+    o.server_p50 = pct(server, 0.5);
+    o.server_p99 = pct(server, 0.99);
+    return o;
+}
+
+static void print(const char* name, const outcome& o)
+{
+    printf("{\"bench\":\"limit\",\"case\":\"%s\",\"ok\":%ld,\"limited\":%ld,\"failed\":%ld,\"rps\":%.1f,\"call_p50_ms\":%.2f,\"call_p99_ms\":%.2f,"
+           "\"server_p50_ms\":%.2f,\"server_p99_ms\":%.2f,\"limit_first\":%.1f,\"limit_second\":%.1f,\"limit_end\":%.1f,\"max_queued\":%zu}\n",
+           name, o.ok, o.limited, o.failed, o.rps, o.call_p50, o.call_p99, o.server_p50, o.server_p99, o.limit_first, o.limit_second, o.limit_end, o.max_queued);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    size_t threads = 32, capacity = 4;
+    double seconds = 2;
+    long latency_ms = 5;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--threads")
+            threads = strtoull(argv[i + 1], nullptr, 10);
+        else if (a == "--seconds")
+            seconds = atof(argv[i + 1]);
+        else if (a == "--latency-ms")
+            latency_ms = atol(argv[i + 1]);
+        else if (a == "--capacity")
+            capacity = strtoull(argv[i + 1], nullptr, 10);
+    }
+
+    loopback_server srv;
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    srv.set_latency(latency_ms * 1000);
+    srv.set_capacity(capacity);
+    bool ok = true;
+
+    outcome base = hammer(srv, nullptr, threads, seconds);
+    print("unlimited", base);
+    ok = ok && base.failed == 0;
+
+    for (limit_algorithm algo : {LIMIT_GRADIENT, LIMIT_AIMD})
+    {
+        limit_options lo;
+        lo.algorithm = algo;
+        lo.max_queue = threads;
+        auto limiter = std::make_shared<http_limiter>(lo);
+        outcome o = hammer(srv, limiter, threads, seconds);
+        print(algo == LIMIT_GRADIENT ? "gradient" : "aimd", o);
+        // the server no longer queues what it cannot work on
+        ok = ok && o.failed == 0 && o.ok > 0 && o.server_p50 < base.server_p50 && o.limit_end < threads;
+    }
+
+    {
+        limit_options lo;
+        lo.max_queue = threads;
+        auto limiter = std::make_shared<http_limiter>(lo);
+        outcome o = hammer(srv, limiter, threads, seconds, [&] { srv.set_latency(latency_ms * 4000); });
+        srv.set_latency(latency_ms * 1000);
+        print("degrade", o);
+        // the mean limit over the slow half has to be clearly below the one before
+        ok = ok && o.failed == 0 && o.ok > 0 && o.limit_second < o.limit_first * 0.8;
+    }
+
+    {
+        limit_options lo;
+        lo.initial = lo.max_limit = (double)capacity;
+        lo.max_queue = 0;
+        auto limiter = std::make_shared<http_limiter>(lo);
+        outcome o = hammer(srv, limiter, threads, seconds);
+        print("reject", o);
+        ok = ok && o.failed == 0 && o.ok > 0 && o.limited > 0 && o.max_queued == 0;
+    }
+
+    {
+        limit_options lo;
+        lo.rate = 200;
+        lo.burst = 10;
+        lo.max_queue = threads;
+        auto limiter = std::make_shared<http_limiter>(lo);
+        outcome o = hammer(srv, limiter, threads, seconds);
+        print("rate", o);
+        ok = ok && o.failed == 0 && o.ok > 0 && o.ok <= (long)(lo.rate * seconds * 1.1 + lo.burst);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+// ** structured log cost ** //
+
+// Times http_log::call() as a finished request issues it, from 1 up to N
+// threads logging at once while another thread keeps draining the rings,
+// and prints one JSON line per thread count with the worst thread's CPU time
+// per call. Every record must end up either drained or counted as dropped.
+// Exits non-zero when a single thread spends more than the budget (100ns by
+// default).
+//
+//   make -C bench && ./bench/log_bench [threads] [budget_ns]
+
+#include "../src/http_log.hpp"
+#include <time.h>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char** argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)std::max(1u, std::thread::hardware_concurrency());
+    double budget = argc > 2 ? atof(argv[2]) : 100;
+    const long n = 2000000;
+    const std::string url = "http://127.0.0.1:8080/items/42";
+
+    double single = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        http_log log;
+        std::atomic<bool> done{false};
+        uint64_t drained = 0;
+        std::thread drainer([&] {
+            while (!done)
+            {
+                log.drain([&drained](const log_record&) { drained++; });
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+
+        std::vector<std::thread> ts;
+        std::vector<double> ns(threads);
+        for (int k = 0; k < threads; k++)
+        {
+            ts.emplace_back([&, k] {
+                // the first call() of a thread registers its ring, keep it out of the timing
+                log.call("get", "GET", url, 0, 200, 1234);
+                timespec c0, c1;
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+                for (long i = 0; i < n; i++)
+                    log.call("get", "GET", url, (i & 255) ? 0 : 28, 200, 1234 + (i & 1023));
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+                ns[k] = ((c1.tv_sec - c0.tv_sec) * 1e9 + (c1.tv_nsec - c0.tv_nsec)) / n;
+            });
+        }
+        for (auto& th : ts)
+            th.join();
+        done = true;
+        drainer.join();
+        std::string last = log.text();
+        drained += std::count(last.begin(), last.end(), '\n');
+
+        double worst = 0;
+        for (double v : ns)
+            worst = std::max(worst, v);
+        if (threads == 1)
+            single = worst;
+
+        bool ok = drained + log.dropped() == (uint64_t)(n + 1) * threads;
+        printf("{\"bench\":\"log_call\",\"threads\":%d,\"ns_per_call\":%.1f,\"drained\":%llu,\"dropped\":%llu,\"consistent\":%s}\n",
+               threads, worst, (unsigned long long)drained, (unsigned long long)log.dropped(), ok ? "true" : "false");
+        if (!ok)
+            return 1;
+    }
+    return single <= budget ? 0 : 2;
+}
@@ -0,0 +1,436 @@
+#ifndef __BENCH_LOOPBACK_HPP__
+#define __BENCH_LOOPBACK_HPP__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// ** in-process HTTP/1.1 server for benchmarks ** //
+
+// Listens on an ephemeral 127.0.0.1 port with a thread per connection and
+// keep-alive. "GET /bytes/N" answers with N bytes, or the part of them a
+// "Range: bytes=a-b" asks for (206, unless an If-Range does not match the
+// ETag), and so does HEAD without the body; "GET /encoded" with the
+// body given to set_encoded() under its Content-Encoding, "GET /cached/S"
+// with N bytes that are fresh for S seconds and carry an ETag, answering 304
+// to a matching If-None-Match. Any other request has its body (Content-Length
+// or chunked, after an optional 100-continue) read and discarded and gets
+// "ok" back, or for "/count" the number of body bytes it had.
+//
+// set_latency() delays every response, as a slow upstream would, and
+// set_capacity() lets only so many of those delays run at once, so that more
+// concurrency queues up and shows as latency. set_spikes() makes every Nth
+// response much slower and set_failures() answers every Nth with 503, and
+// set_etag_change() gives /bytes/N another ETag from the Nth on, and
+// set_range_skew() serves ranges that start later than asked; peak()
+// tells how many delayed responses were in the works at once. Just
+// enough HTTP for libcurl, nothing more.
+//
+// A connection that opens with the HTTP/2 preface (prior knowledge) gets a
+// 400 and is closed, as from a server that only speaks HTTP/1.1, unless
+// set_h2c() was called: then it is served as HTTP/2, every stream answered
+// with 200 and "ok" whatever it asked for. set_drops() closes the next
+// connections as soon as they are accepted.
+
+class loopback_server
+{
+    int lfd = -1;
+    int prt = 0;
+    std::atomic<bool> stopping{false};
+    std::thread acceptor;
+    std::mutex mtx;
+    std::vector<std::thread> conns;
+    std::vector<int> fds;
+    std::string payload;
+    std::string encoded, encoding;      // set before the first request
+    std::atomic<long> served{0}, accepted{0};
+    std::atomic<long> drops{0};
+    std::atomic<bool> h2c{false};
+    std::atomic<long> delay_us{0};
+    std::atomic<long> spike_every{0}, spike_us{0}, fail_every{0}, etag_from{0}, range_skew{0};
+    std::mutex cap_mtx;
+    std::condition_variable cap_cv;
+    size_t capacity = 0, busy = 0;      // 0: no limit
+    size_t most = 0;
+
+    static bool send_all(int fd, const char* p, size_t n)
+    {
+        while (n)
+        {
+            ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+            if (w <= 0)
+                return false;
+            p += w;
+            n -= w;
+        }
+        return true;
+    }
+
+    // buffered reader over the connection
+    struct reader
+    {
+        int fd;
+        std::string buf;
+        size_t pos = 0;
+
+        bool fill()
+        {
+            if (pos > 0 && pos == buf.size())
+            {
+                buf.clear();
+                pos = 0;
+            }
+            char tmp[65536];
+            ssize_t r = recv(fd, tmp, sizeof(tmp), 0);
+            if (r <= 0)
+                return false;
+            buf.append(tmp, r);
+            return true;
+        }
+        bool line(std::string& out)
+        {
+            for (;;)
+            {
+                size_t eol = buf.find("\r\n", pos);
+                if (eol != std::string::npos)
+                {
+                    out.assign(buf, pos, eol - pos);
+                    pos = eol + 2;
+                    return true;
+                }
+                if (!fill())
+                    return false;
+            }
+        }
+        bool take(size_t n, std::string& out)
+        {
+            while (buf.size() - pos < n)
+                if (!fill())
+                    return false;
+            out.assign(buf, pos, n);
+            pos += n;
+            return true;
+        }
+        bool skip(size_t n)
+        {
+            while (n)
+            {
+                if (pos == buf.size() && !fill())
+                    return false;
+                size_t k = std::min(n, buf.size() - pos);
+                pos += k;
+                n -= k;
+            }
+            return true;
+        }
+    };
+
+    bool frame(int fd, uint8_t type, uint8_t flags, uint32_t stream, const char* p, size_t n)
+    {
+        char h[9] = {(char)(n >> 16), (char)(n >> 8), (char)n, (char)type, (char)flags,
+                     (char)((stream >> 24) & 0x7f), (char)(stream >> 16), (char)(stream >> 8), (char)stream};
+        return send_all(fd, h, 9) && send_all(fd, p, n);
+    }
+    // the client preface is read, frames from here on
+    void serve_h2(reader& rd)
+    {
+        int fd = rd.fd;
+        std::string h, body;
+        bool ok = frame(fd, 4, 0, 0, nullptr, 0);       // our SETTINGS, all defaults
+        while (ok && rd.take(9, h))
+        {
+            size_t len = (uint8_t)h[0] << 16 | (uint8_t)h[1] << 8 | (uint8_t)h[2];
+            uint8_t type = h[3], flags = h[4];
+            uint32_t stream = ((uint8_t)h[5] & 0x7f) << 24 | (uint8_t)h[6] << 16 | (uint8_t)h[7] << 8 | (uint8_t)h[8];
+            if (!rd.take(len, body) || type == 7)       // GOAWAY
+                break;
+            if (type == 4 && !(flags & 1))              // SETTINGS, acknowledged
+                ok = frame(fd, 4, 1, 0, nullptr, 0);
+            else if (type == 6 && !(flags & 1))         // PING
+                ok = frame(fd, 6, 1, 0, body.data(), body.size());
+            if (ok && type == 0 && len)                 // DATA, its window given back
+            {
+                char inc[4] = {(char)(len >> 24), (char)(len >> 16), (char)(len >> 8), (char)len};
+                ok = frame(fd, 8, 0, 0, inc, 4) && frame(fd, 8, 0, stream, inc, 4);
+            }
+            if (ok && (type == 0 || type == 1) && (flags & 1))
+            {
+                // the request is complete: :status 200 from the static table, then the body
+                served++;
+                const char status = (char)0x88;
+                ok = frame(fd, 1, 4, stream, &status, 1) && frame(fd, 0, 1, stream, "ok", 2);
+            }
+        }
+        close_conn(fd);
+    }
+
+    void serve(int fd)
+    {
+        reader rd{fd, std::string(), 0};
+        std::string line;
+        while (rd.line(line))
+        {
+            if (line == "PRI * HTTP/2.0")
+            {
+                // the rest of the preface: a blank line, "SM" and another blank line
+                if (h2c && rd.line(line) && rd.line(line) && rd.line(line))
+                    return serve_h2(rd);
+                const char bad[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                send_all(fd, bad, sizeof(bad) - 1);
+                break;
+            }
+            std::string target = line.substr(line.find(' ') + 1);
+            target = target.substr(0, target.find(' '));
+            bool is_get = line.compare(0, 4, "GET ") == 0;
+            bool is_head = line.compare(0, 5, "HEAD ") == 0;
+            size_t length = 0;
+            bool chunked = false, expect = false, matched = false;
+            long long from = -1, to = -1;
+            std::string if_range;
+            while (rd.line(line) && !line.empty())
+            {
+                if (strncasecmp(line.c_str(), "content-length:", 15) == 0)
+                    length = strtoull(line.c_str() + 15, nullptr, 10);
+                else if (strncasecmp(line.c_str(), "transfer-encoding:", 18) == 0)
+                    chunked = line.find("chunked") != std::string::npos;
+                else if (strncasecmp(line.c_str(), "expect:", 7) == 0)
+                    expect = true;
+                else if (strncasecmp(line.c_str(), "if-none-match:", 14) == 0)
+                    matched = line.find("\"v1\"") != std::string::npos;
+                else if (strncasecmp(line.c_str(), "range:", 6) == 0 && line.find("bytes=") != std::string::npos)
+                {
+                    const char* r = line.c_str() + line.find("bytes=") + 6;
+                    char* dash;
+                    from = strtoll(r, &dash, 10);
+                    if (*dash == '-' && dash[1])
+                        to = strtoll(dash + 1, nullptr, 10);
+                }
+                else if (strncasecmp(line.c_str(), "if-range:", 9) == 0)
+                    if_range = line.substr(line.find_first_not_of(' ', 9));
+            }
+            if (expect && !send_all(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25))
+                break;
+            if (chunked)
+            {
+                for (;;)
+                {
+                    if (!rd.line(line))
+                        return close_conn(fd);
+                    size_t n = strtoull(line.c_str(), nullptr, 16);
+                    if (!rd.skip(n + 2))
+                        return close_conn(fd);
+                    length += n;
+                    if (n == 0)
+                        break;
+                }
+            }
+            else if (!rd.skip(length))
+                break;
+
+            size_t n = 2;
+            const char* body = "ok";
+            std::string count;
+            if (target == "/count")
+            {
+                count = std::to_string(length);
+                n = count.size();
+                body = count.data();
+            }
+            bool bytes = (is_get || is_head) && target.compare(0, 7, "/bytes/") == 0;
+            if (bytes)
+            {
+                n = std::min<size_t>(strtoull(target.c_str() + 7, nullptr, 10), payload.size());
+                body = payload.data();
+            }
+            const char* ce = "";
+            if (is_get && target == "/encoded")
+            {
+                n = encoded.size();
+                body = encoded.data();
+                ce = encoding.c_str();
+            }
+            long nth = ++served;
+            long d = delay_us.load();
+            long every = spike_every.load();
+            if (every && nth % every == 0)
+                d += spike_us.load();
+            every = fail_every.load();
+            bool fail = every && nth % every == 0;
+            if (d)
+            {
+                std::unique_lock<std::mutex> lk(cap_mtx);
+                cap_cv.wait(lk, [this] { return capacity == 0 || busy < capacity; });
+                most = std::max(most, ++busy);
+                lk.unlock();
+                usleep(d);
+                lk.lock();
+                busy--;
+                cap_cv.notify_one();
+            }
+            char head[512];
+            int hn;
+            if (fail)
+            {
+                n = 0;
+                hn = snprintf(head, sizeof(head), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            }
+            else if (is_get && target.compare(0, 8, "/cached/") == 0)
+            {
+                n = matched ? 0 : std::min<size_t>(1024, payload.size());
+                body = payload.data();
+                hn = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Length: %zu\r\nCache-Control: max-age=%ld\r\nETag: \"v1\"\r\n\r\n",
+                              matched ? "304 Not Modified" : "200 OK", n, strtol(target.c_str() + 8, nullptr, 10));
+            }
+            else if (bytes)
+            {
+                long since = etag_from.load();
+                const char* tag = since && nth >= since ? "\"b2\"" : "\"b1\"";
+                size_t total = n;
+                bool part = from >= 0 && (size_t)from < total && (if_range.empty() || if_range == tag);
+                char range[96] = "";
+                if (part && from + range_skew < (long long)total)
+                    from += range_skew;
+                if (part)
+                {
+                    size_t last = to < 0 || (size_t)to >= total ? total - 1 : (size_t)to;
+                    body += from;
+                    n = last - from + 1;
+                    snprintf(range, sizeof(range), "Content-Range: bytes %lld-%zu/%zu\r\n", from, last, total);
+                }
+                hn = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Length: %zu\r\n%sAccept-Ranges: bytes\r\nETag: %s\r\nContent-Type: application/octet-stream\r\n\r\n",
+                              part ? "206 Partial Content" : "200 OK", n, range, tag);
+                if (is_head)
+                    n = 0;
+            }
+            else
+                hn = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nContent-Type: application/octet-stream\r\n%s%s%s\r\n",
+                              n, *ce ? "Content-Encoding: " : "", ce, *ce ? "\r\n" : "");
+            if (!send_all(fd, head, hn) || !send_all(fd, body, n))
+                break;
+        }
+        close_conn(fd);
+    }
+    void close_conn(int fd)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        for (auto& f : fds)
+            if (f == fd)
+                f = -1;
+        close(fd);
+    }
+
+public:
+    loopback_server(size_t max_body = 16 << 20) : payload(max_body, 'x')
+    {
+        lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in a;
+        memset(&a, 0, sizeof(a));
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(a);
+        if (bind(lfd, (sockaddr*)&a, sizeof(a)) != 0 || listen(lfd, SOMAXCONN) != 0 || getsockname(lfd, (sockaddr*)&a, &len) != 0)
+        {
+            close(lfd);
+            lfd = -1;
+            return;
+        }
+        prt = ntohs(a.sin_port);
+        acceptor = std::thread([this] {
+            for (;;)
+            {
+                int fd = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd < 0)
+                {
+                    if (stopping)
+                        return;
+                    continue;
+                }
+                accepted++;
+                if (drops > 0)
+                {
+                    drops--;
+                    close(fd);
+                    continue;
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                std::lock_guard<std::mutex> lk(mtx);
+                fds.push_back(fd);
+                conns.emplace_back(&loopback_server::serve, this, fd);
+            }
+        });
+    }
+    loopback_server(const loopback_server&) = delete;
+    loopback_server& operator=(const loopback_server&) = delete;
+    ~loopback_server()
+    {
+        stopping = true;
+        if (lfd >= 0)
+        {
+            shutdown(lfd, SHUT_RDWR);
+            acceptor.join();
+            close(lfd);
+        }
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (int fd : fds)
+                if (fd >= 0)
+                    shutdown(fd, SHUT_RDWR);
+        }
+        for (auto& t : conns)
+            t.join();
+    }
+
+    inline void set_encoded(std::string body, std::string enc) { encoded = std::move(body); encoding = std::move(enc); }
+    // added before every response from now on, may change while serving
+    inline void set_latency(long us) { delay_us = us; }
+    // every nth response takes us longer, 0 for none
+    inline void set_spikes(long nth, long us) { spike_every = nth; spike_us = us; }
+    // every nth response is a 503, 0 for none
+    inline void set_failures(long nth) { fail_every = nth; }
+    // /bytes/N is replaced from the nth response on, as far as its ETag goes; 0 for never
+    inline void set_etag_change(long nth) { etag_from = nth; }
+    // ranges are answered from this many bytes past the start asked for, Content-Range says so; 0 for none
+    inline void set_range_skew(long bytes) { range_skew = bytes; }
+    // delayed responses worked on at once, the rest wait their turn; 0 for no limit
+    inline void set_capacity(size_t n)
+    {
+        std::lock_guard<std::mutex> lk(cap_mtx);
+        capacity = n;
+        cap_cv.notify_all();
+    }
+    // answer HTTP/2 prior knowledge from now on
+    inline void set_h2c(bool on) { h2c = on; }
+    // the next n connections are closed unanswered
+    inline void set_drops(long n) { drops = n; }
+    inline bool valid() const { return lfd >= 0; }
+    // requests answered so far
+    inline long requests() const { return served; }
+    // connections accepted so far, dropped ones included
+    inline long connections() const { return accepted; }
+    // most delayed responses that were being worked on at once
+    inline size_t peak()
+    {
+        std::lock_guard<std::mutex> lk(cap_mtx);
+        return most;
+    }
+    inline int port() const { return prt; }
+    inline std::string url(const std::string& path) const { return "http://127.0.0.1:" + std::to_string(prt) + path; }
+};
+
+#endif
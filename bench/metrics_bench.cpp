@@ -0,0 +1,69 @@
+// ** metrics recording cost ** //
+
+// Times http_metrics::record() on the path a request takes after it has
+// completed, from 1 up to N threads all recording to the same host/method,
+// and prints one JSON line per thread count with the worst thread's CPU time
+// per call. Exits non-zero when a single thread spends more than the budget
+// (50ns by default).
+//
+//   make -C bench && ./bench/metrics_bench [threads] [budget_ns]
+
+#include "../src/http_metrics.hpp"
+#include <time.h>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char** argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)std::max(1u, std::thread::hardware_concurrency());
+    double budget = argc > 2 ? atof(argv[2]) : 50;
+    const long n = 2000000;
+    const std::string url = "http://127.0.0.1:8080/items/42";
+
+    http_timing t;
+    t.total = 1234;
+    t.bytes_received = 512;
+    t.header_bytes_received = 120;
+    t.header_bytes_sent = 80;
+    t.reused = true;
+
+    double single = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        http_metrics m;
+        // the first record() of a thread registers its shard, keep it out of the timing
+        std::vector<std::thread> ts;
+        std::vector<double> ns(threads);
+        for (int k = 0; k < threads; k++)
+        {
+            ts.emplace_back([&, k] {
+                m.record("GET", url, 0, t);
+                timespec c0, c1;
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+                for (long i = 0; i < n; i++)
+                {
+                    http_timing ti = t;
+                    ti.total += i & 1023;
+                    m.record("GET", url, (i & 255) ? 0 : 28, ti);
+                }
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+                ns[k] = ((c1.tv_sec - c0.tv_sec) * 1e9 + (c1.tv_nsec - c0.tv_nsec)) / n;
+            });
+        }
+        for (auto& th : ts)
+            th.join();
+        double worst = 0;
+        for (double v : ns)
+            worst = std::max(worst, v);
+        if (threads == 1)
+            single = worst;
+
+        auto snap = m.snapshot();
+        bool ok = snap.size() == 1 && snap[0].requests == (uint64_t)(n + 1) * threads;
+        printf("{\"bench\":\"metrics_record\",\"threads\":%d,\"ns_per_call\":%.1f,\"consistent\":%s}\n", threads, worst, ok ? "true" : "false");
+        if (!ok)
+            return 1;
+    }
+    return single <= budget ? 0 : 2;
+}
@@ -0,0 +1,248 @@
+// ** multipart form upload benchmark ** //
+
+// Posts a form of binary blobs (NULs included) to the loopback server
+// (loopback.hpp), which answers "/count" with the body bytes it received.
+// One JSON line per case with requests per second, the bytes the calling
+// thread allocated per call (operator new and libcurl's allocator) and the
+// body size the server saw:
+//
+//   copy        plain libcurl with curl_mime_data, the blobs copied per request
+//   string      mime_string_part, read in place
+//   buffer      mime_buffer_part views of the caller's blobs
+//   generator   mime_generator_part producing the blobs with a known size
+//   chunked     the same with the size left open
+//   nested      the buffers inside one multipart/mixed part
+//   shrunk      a mime_file_part and a putfile() of a 64MB file, both sent
+//               from its mapping, with the file cut to 4KB as soon as the
+//               server accepts the connection; rc of each
+//
+// Every case posts the same mime_form again and again. Exits non-zero when a
+// case sends a different body than copy does (nested: any body smaller than
+// the blobs), when a zero-copy case allocates anywhere near a blob's size, or
+// when a shrunk upload does not end in CURLE_ABORTED_BY_CALLBACK (a SIGBUS
+// from the mapping ends the process).
+//
+//   make -C bench && ./bench/mime_bench [--parts N] [--size N] [--iterations N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <malloc.h>
+
+// the replacements below pair malloc with free on purpose
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static thread_local bool counting = false;
+static thread_local size_t nbytes = 0;
+
+void* operator new(size_t n)
+{
+    if (counting)
+        nbytes += n;
+    void* p = malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+static void* cm_malloc(size_t n) { if (counting) nbytes += n; return malloc(n); }
+static void cm_free(void* p) { free(p); }
+static void* cm_realloc(void* p, size_t n) { if (counting) nbytes += n; return realloc(p, n); }
+static char* cm_strdup(const char* s) { if (counting) nbytes += strlen(s) + 1; return strdup(s); }
+static void* cm_calloc(size_t n, size_t m) { if (counting) nbytes += n * m; return calloc(n, m); }
+
+struct outcome
+{
+    double rps = 0;
+    double bytes_per_call = 0;
+    long received = -1;                 // body bytes the server saw, -1 when calls disagree
+    int failures = 0;
+};
+
+static outcome measure(long iterations, const std::function<int(std::string*)>& call)
+{
+    outcome o;
+    std::string resp;
+    size_t total = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+    {
+        resp.clear();
+        resp.reserve(32);
+        nbytes = 0;
+        counting = true;
+        int rc = call(&resp);
+        counting = false;
+        total += nbytes;
+        long got = atol(resp.c_str());
+        if (rc != CURLE_OK)
+            o.failures++;
+        else if (i == 0)
+            o.received = got;
+        else if (got != o.received)
+            o.received = -1;
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    o.rps = iterations / wall;
+    o.bytes_per_call = (double)total / iterations;
+    return o;
+}
+
+static void print(const char* name, size_t parts, size_t size, const outcome& o)
+{
+    printf("{\"bench\":\"mime\",\"case\":\"%s\",\"parts\":%zu,\"size\":%zu,\"failures\":%d,\"rps\":%.1f,\"alloc_bytes_per_call\":%.0f,\"server_bytes\":%ld}\n",
+           name, parts, size, o.failures, o.rps, o.bytes_per_call, o.received);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    size_t nparts = 4, size = 4 << 20;
+    long iterations = 50;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--parts")
+            nparts = strtoull(argv[i + 1], nullptr, 10);
+        else if (a == "--size")
+            size = strtoull(argv[i + 1], nullptr, 10);
+        else if (a == "--iterations")
+            iterations = atol(argv[i + 1]);
+    }
+    curl_global_init_mem(CURL_GLOBAL_ALL, cm_malloc, cm_free, cm_realloc, cm_strdup, cm_calloc);
+
+    loopback_server srv;
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    const std::string url = srv.url("/count");
+
+    // random bytes, plenty of NULs among them
+    std::vector<std::string> blobs(nparts);
+    std::mt19937 rng(11);
+    for (auto& b : blobs)
+    {
+        b.resize(size);
+        for (auto& c : b)
+            c = (char)(rng() & 0x1ff ? rng() : 0);
+    }
+    auto field = [](size_t i) { return "blob" + std::to_string(i); };
+    bool ok = true;
+
+    // what formpost used to do: libcurl keeps its own copy of every part
+    outcome copy;
+    {
+        CURL* hdl = curl_easy_init();
+        copy = measure(iterations, [&](std::string* resp) {
+            curl_easy_reset(hdl);
+            curl_mime* m = curl_mime_init(hdl);
+            for (size_t i = 0; i < nparts; i++)
+            {
+                curl_mimepart* p = curl_mime_addpart(m);
+                curl_mime_name(p, field(i).c_str());
+                curl_mime_data(p, blobs[i].data(), blobs[i].size());
+            }
+            curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(hdl, CURLOPT_MIMEPOST, m);
+            curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, +[](char* d, size_t s, size_t n, void* u) { ((std::string*)u)->append(d, s * n); return s * n; });
+            curl_easy_setopt(hdl, CURLOPT_WRITEDATA, resp);
+            int rc = curl_easy_perform(hdl);
+            curl_mime_free(m);
+            return rc;
+        });
+        curl_easy_cleanup(hdl);
+        print("copy", nparts, size, copy);
+        ok = ok && copy.failures == 0 && copy.received > (long)(nparts * size);
+    }
+
+    http_client c;
+    auto check = [&](const char* name, const mime_form& form, bool same_body) {
+        outcome o = measure(iterations, [&](std::string* resp) { return c.formpost(url, form, resp); });
+        print(name, nparts, size, o);
+        bool body = same_body ? o.received == copy.received : o.received > (long)(nparts * size);
+        ok = ok && o.failures == 0 && body && o.bytes_per_call < size / 4;
+    };
+
+    {
+        mime_form form;
+        for (size_t i = 0; i < nparts; i++)
+            form.add<mime_string_part>(field(i), blobs[i]);
+        // the parts hold their own copy, made once here and not per call
+        check("string", form, true);
+    }
+    {
+        mime_form form;
+        for (size_t i = 0; i < nparts; i++)
+            form.add<mime_buffer_part>(field(i), std::string_view(blobs[i]));
+        check("buffer", form, true);
+    }
+    for (bool known : {true, false})
+    {
+        mime_form form;
+        for (size_t i = 0; i < nparts; i++)
+        {
+            const std::string& b = blobs[i];
+            form.add<mime_generator_part>(field(i), known ? (curl_off_t)b.size() : -1, [&b](char* buf, size_t len, curl_off_t off) {
+                size_t n = std::min(len, b.size() - (size_t)off);
+                memcpy(buf, b.data() + off, n);
+                return n;
+            });
+        }
+        check(known ? "generator" : "chunked", form, true);
+    }
+    {
+        mime_form form;
+        auto& nested = form.add<mime_multipart_part>("blobs");
+        for (size_t i = 0; i < nparts; i++)
+            nested.add<mime_buffer_part>(field(i), std::string_view(blobs[i]), field(i) + ".bin").set_type("application/octet-stream");
+        check("nested", form, false);
+    }
+    {
+        const std::string path = "/tmp/mime_bench." + std::to_string(getpid()) + ".bin";
+        int rcs[2] = {0, 0};
+        for (int i = 0; i < 2; i++)
+        {
+            FILE* f = fopen(path.c_str(), "w");
+            std::string chunk(1 << 20, 'x');
+            for (int j = 0; f && j < 64; j++)
+                fwrite(chunk.data(), 1, chunk.size(), f);
+            if (f)
+                fclose(f);
+            long before = srv.connections();
+            std::thread cut([&] {
+                while (srv.connections() == before)
+                    std::this_thread::yield();
+                if (truncate(path.c_str(), 4096) != 0)
+                    perror("truncate");
+            });
+            http_client fresh;
+            if (i == 0)
+            {
+                mime_form form;
+                form.add<mime_file_part>("file", path, "shrunk.bin");
+                rcs[i] = fresh.formpost(url, form);
+            }
+            else
+                rcs[i] = fresh.putfile(url, path);
+            cut.join();
+        }
+        remove(path.c_str());
+        printf("{\"bench\":\"mime\",\"case\":\"shrunk\",\"formpost_rc\":%d,\"putfile_rc\":%d}\n", rcs[0], rcs[1]);
+        fflush(stdout);
+        ok = ok && rcs[0] == CURLE_ABORTED_BY_CALLBACK && rcs[1] == CURLE_ABORTED_BY_CALLBACK;
+    }
+    return ok ? 0 : 1;
+}
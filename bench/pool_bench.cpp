@@ -0,0 +1,130 @@
+// ** connection reuse benchmark ** //
+
+// Sends blocking requests to the loopback server (loopback.hpp) and counts
+// the connections it accepted. One JSON line per case with the requests,
+// failures, requests per second and connections:
+//
+//   fresh       a new http_client per request, nothing to reuse
+//   reuse       one client, get, put, simplepost, binarypost and formpost in
+//               turn; every request on the one keep-alive connection
+//   idle        set_idle_timeout(1) and a pause longer than that between two
+//               requests; the second one reconnects
+//   max_age     set_max_age(1) and requests for a little over two seconds;
+//               the connection is replaced once it is a second old
+//
+// Exits non-zero on a failed request, or when reuse takes more than one
+// connection, idle anything but two, or max_age fewer than two or more than
+// three.
+//
+//   make -C bench && ./bench/pool_bench [--requests N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct outcome
+{
+    long n = 0, failures = 0, connections = 0;
+    double rps = 0;
+};
+
+static void print(const char* name, const outcome& o)
+{
+    printf("{\"bench\":\"pool\",\"case\":\"%s\",\"requests\":%ld,\"failures\":%ld,\"rps\":%.1f,\"connections\":%ld}\n",
+           name, o.n, o.failures, o.rps, o.connections);
+    fflush(stdout);
+}
+
+// n calls of fn against a fresh server, fn(i) returns the CURLcode
+template <class F>
+static outcome measure(long n, F fn)
+{
+    loopback_server srv;
+    outcome o;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++)
+        if (fn(srv, i) != CURLE_OK)
+            o.failures++;
+    o.n = n;
+    o.rps = n / std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    o.connections = srv.connections();
+    return o;
+}
+
+int main(int argc, char** argv)
+{
+    long n = 5000;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--requests")
+            n = atol(argv[i + 1]);
+    }
+    const std::string body(512, 'x');
+    bool ok = true;
+
+    outcome fresh = measure(n / 10, [&](loopback_server& srv, long) {
+        http_client c;
+        std::string resp;
+        return c.get(srv.url("/bytes/64"), &resp);
+    });
+    print("fresh", fresh);
+    ok = ok && fresh.failures == 0 && fresh.connections == fresh.n;
+
+    {
+        http_client c;
+        mime_form form;
+        form.add<mime_string_part>("field", body);
+        std::string resp;
+        outcome o = measure(n, [&](loopback_server& srv, long i) {
+            resp.clear();
+            switch (i % 5)
+            {
+                case 0: return c.get(srv.url("/bytes/64"), &resp);
+                case 1: return c.put(srv.url("/count"), body, &resp);
+                case 2: return c.simplepost(srv.url("/count"), body, &resp);
+                case 3: return c.binarypost(srv.url("/count"), (void*)body.data(), (long)body.size(), &resp);
+                default: return c.formpost(srv.url("/count"), form, &resp);
+            }
+        });
+        print("reuse", o);
+        ok = ok && o.failures == 0 && o.connections == 1;
+    }
+    {
+        http_client c;
+        c.set_idle_timeout(1);
+        std::string resp;
+        outcome o = measure(2, [&](loopback_server& srv, long i) {
+            if (i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+            return c.get(srv.url("/bytes/64"), &resp);
+        });
+        print("idle", o);
+        ok = ok && o.failures == 0 && o.connections == 2;
+    }
+    {
+        http_client c;
+        c.set_max_age(1);
+        std::string resp;
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(2200);
+        long sent = 0;
+        outcome o = measure(1, [&](loopback_server& srv, long) {
+            while (std::chrono::steady_clock::now() < until)
+            {
+                resp.clear();
+                if (c.get(srv.url("/bytes/64"), &resp) != CURLE_OK)
+                    return CURLE_RECV_ERROR;
+                sent++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return CURLE_OK;
+        });
+        o.rps *= sent;
+        o.n = sent;
+        print("max_age", o);
+        ok = ok && o.failures == 0 && o.connections >= 2 && o.connections <= 3;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+// ** segmented download benchmark ** //
+
+// Downloads /bytes/N from the loopback server (loopback.hpp), which serves
+// byte ranges, with getfile_parallel() and segmented_download. One JSON line
+// per case with the result, MB/s and the requests the server answered (the
+// HEAD probe included):
+//
+//   single     getfile(), one stream, for comparison
+//   parallel   getfile_parallel() over 4 ranges
+//   retry      every third response a 503, the segments hit retry
+//   resume     a checkpoint with two segments done and one half done; only
+//              the rest is fetched
+//   truncated  the same checkpoint, but the file was cut short since
+//   deleted    the same checkpoint, but the file is gone
+//   changed    the file changes on the server after the probe; If-Range gets
+//              the whole body back, which segmented_download reports as
+//              CURL_NO_RANGES and getfile_parallel() turns into one stream
+//   skewed     every range is answered from one byte later than asked, with
+//              a Content-Range that says so; refused before anything is
+//              written, the same CURL_NO_RANGES and fallback
+//   stalled    one segment response held back for 3s under a 500ms client
+//              timeout; the segment is retried and the download finishes
+//              within 2s, with last_status() the 206 of a segment
+//
+// Every download has to end up as N bytes of 'x', any other byte (a zero
+// from a hole in a preallocated file) fails the case. Exits non-zero when a
+// case fails.
+//
+//   make -C bench && ./bench/range_bench [--size N] [--dir PATH]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+// the file is size bytes of 'x'
+static bool intact(const std::string& path, size_t size)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string got((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return got.size() == size && got.find_first_not_of('x') == std::string::npos;
+}
+
+// what an interrupted run leaves behind: segment 0 and 3 done, 1 half done, 2 not started,
+// and zeros in the file where nothing was written yet
+static void interrupted(const std::string& path, size_t size)
+{
+    size_t chunk = (size + 3) / 4;
+    curl_off_t done[4] = {(curl_off_t)chunk, (curl_off_t)chunk / 2, 0, (curl_off_t)(size - 3 * chunk)};
+    {
+        std::ofstream st(path + ".segs", std::ios::trunc);
+        st << size << " 4\n\"b1\"\n";
+        for (auto d : done)
+            st << d << "\n";
+    }
+    std::string zeros(size - chunk - chunk / 2 - (size - 3 * chunk), '\0');
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd >= 0)
+    {
+        ssize_t w = pwrite(fd, zeros.data(), zeros.size(), chunk + chunk / 2);
+        (void)w;
+        close(fd);
+    }
+}
+
+static void print(const char* name, int rc, double secs, size_t size, long requests, bool ok)
+{
+    printf("{\"bench\":\"range\",\"case\":\"%s\",\"rc\":%d,\"mb_per_s\":%.1f,\"requests\":%ld,\"ok\":%s}\n",
+           name, rc, size / secs / 1e6, requests, ok ? "true" : "false");
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = 8 << 20;
+    std::string dir = "/tmp";
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--size")
+            size = strtoull(argv[i + 1], nullptr, 10);
+        else if (a == "--dir")
+            dir = argv[i + 1];
+    }
+
+    loopback_server srv(size);
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    const std::string url = srv.url("/bytes/" + std::to_string(size));
+    const std::string path = dir + "/range_bench." + std::to_string(getpid()) + ".bin";
+    http_client c;
+    bool all = true;
+
+    // runs fn, checks the file, the requests it took (-1: any) and the time (0: any)
+    auto check = [&](const char* name, long want_requests, int want_rc, const std::function<int()>& fn, double max_secs = 0) {
+        long before = srv.requests();
+        auto t0 = std::chrono::steady_clock::now();
+        int rc = fn();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        long requests = srv.requests() - before;
+        bool ok = rc == want_rc && (want_rc != CURLE_OK || intact(path, size)) &&
+                  (want_requests < 0 || requests == want_requests) && (max_secs == 0 || secs < max_secs);
+        print(name, rc, secs, size, requests, ok);
+        all = all && ok;
+    };
+
+    check("single", 1, CURLE_OK, [&] { return c.getfile(url, path); });
+    remove(path.c_str());
+    check("parallel", 5, CURLE_OK, [&] { return c.getfile_parallel(url, path, 4); });
+
+    srv.set_failures(3);
+    remove(path.c_str());
+    check("retry", -1, CURLE_OK, [&] { return c.getfile_parallel(url, path, 4); });
+    srv.set_failures(0);
+
+    // HEAD, then the rest of segment 1 and all of segment 2
+    interrupted(path, size);
+    check("resume", 3, CURLE_OK, [&] { return c.getfile_parallel(url, path, 4); });
+
+    interrupted(path, size);
+    if (truncate(path.c_str(), size / 2) != 0)
+        all = false;
+    check("truncated", 5, CURLE_OK, [&] { return c.getfile_parallel(url, path, 4); });
+
+    interrupted(path, size);
+    remove(path.c_str());
+    check("deleted", 5, CURLE_OK, [&] { return c.getfile_parallel(url, path, 4); });
+
+    // the probe sees "b1", every range request after it "b2"
+    srv.set_etag_change(srv.requests() + 2);
+    remove(path.c_str());
+    check("changed", -1, CURL_NO_RANGES, [&] {
+        segmented_download dl(url, path, header_map(), 4);
+        return dl.run();
+    });
+    check("changed", -1, CURLE_OK, [&] { return c.getfile_parallel(url, path, 4); });
+
+    srv.set_range_skew(1);
+    remove(path.c_str());
+    check("skewed", -1, CURL_NO_RANGES, [&] {
+        segmented_download dl(url, path, header_map(), 4);
+        return dl.run();
+    });
+    check("skewed", -1, CURLE_OK, [&] { return c.getfile_parallel(url, path, 4); });
+    srv.set_range_skew(0);
+
+    // the third response from here is the first segment's or another's, it does not matter which
+    srv.set_spikes(srv.requests() + 3, 3000000);
+    remove(path.c_str());
+    check("stalled", -1, CURLE_OK, [&] {
+        http_client t;
+        t.set_timeouts(0, 500);
+        int rc = t.getfile_parallel(url, path, 4);
+        return rc == CURLE_OK && t.last_status() != 206 ? -1 : rc;
+    }, 2.0);
+    srv.set_spikes(0, 0);
+
+    remove(path.c_str());
+    remove((path + ".segs").c_str());
+    return all ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// ** shared cache stress test ** //
+
+// Threads that keep creating an http_client, send blocking GETs and a batch
+// of get_async() through it, and destroy it again, all against the loopback
+// server (loopback.hpp) under the name localhost, so the DNS cache has
+// something to hold. One JSON line per case with the clients created, the
+// requests, failures, requests per second and the connections the server
+// accepted:
+//
+//   private    every client with caches of its own
+//   shared     every client, and every client's engine, attached to one
+//              http_share; connections outlive the client that opened them
+//
+// Every response must be a 200 with the body asked for. Exits non-zero on a
+// failure in either case, or when the shared caches do not at least halve
+// the connections.
+//
+//   make -C bench && ./bench/share_bench [--threads N] [--rounds N] [--requests N]
+
+#include "../src/http_client.hpp"
+#include "../src/http_share.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct outcome
+{
+    long clients = 0, n = 0, failures = 0, connections = 0;
+    double rps = 0;
+};
+
+static void print(const char* name, const outcome& o)
+{
+    printf("{\"bench\":\"share\",\"case\":\"%s\",\"clients\":%ld,\"requests\":%ld,\"failures\":%ld,\"rps\":%.1f,\"connections\":%ld}\n",
+           name, o.clients, o.n, o.failures, o.rps, o.connections);
+    fflush(stdout);
+}
+
+// threads x rounds clients, each sending n blocking and n asynchronous GETs
+static outcome hammer(std::shared_ptr<http_share> share, long threads, long rounds, long n)
+{
+    loopback_server srv;
+    const std::string url = "http://localhost:" + std::to_string(srv.port()) + "/bytes/256";
+    std::atomic<long> failures{0};
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (long t = 0; t < threads; t++)
+        workers.emplace_back([&] {
+            for (long r = 0; r < rounds; r++)
+            {
+                http_client c;
+                if (share)
+                    c.set_share(share);
+                std::vector<std::future<http_string_response>> futs;
+                for (long i = 0; i < n; i++)
+                    futs.push_back(c.get_async(url));
+                for (long i = 0; i < n; i++)
+                {
+                    std::string body;
+                    if (c.get(url, &body) != CURLE_OK || c.last_status() != 200 || body.size() != 256)
+                        failures++;
+                }
+                for (auto& f : futs)
+                {
+                    http_string_response res = f.get();
+                    if (!res.no_error() || res.get_code() != 200 || res.get_body().size() != 256)
+                        failures++;
+                }
+            }
+        });
+    for (auto& w : workers)
+        w.join();
+    outcome o;
+    o.clients = threads * rounds;
+    o.n = o.clients * n * 2;
+    o.failures = failures;
+    o.rps = o.n / std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    o.connections = srv.connections();
+    return o;
+}
+
+int main(int argc, char** argv)
+{
+    long threads = 16, rounds = 50, n = 10;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--threads")
+            threads = atol(argv[i + 1]);
+        else if (a == "--rounds")
+            rounds = atol(argv[i + 1]);
+        else if (a == "--requests")
+            n = atol(argv[i + 1]);
+    }
+
+    outcome mine = hammer(nullptr, threads, rounds, n);
+    print("private", mine);
+    // declared first, it has to outlive every client attached to it
+    auto share = std::make_shared<http_share>();
+    outcome shared = hammer(share, threads, rounds, n);
+    print("shared", shared);
+    return mine.failures == 0 && shared.failures == 0 && shared.connections * 2 <= mine.connections ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// ** request coalescing benchmark ** //
+
+// Bursts of identical GETs from many threads, each with its own http_client,
+// against the loopback server (loopback.hpp) made slow enough that a burst
+// overlaps. Prints one JSON line per case with the requests that reached the
+// server per burst and the wall time: "none" without coalescing, "coalesced"
+// with one http_singleflight shared by every client, where each burst must
+// reach the server exactly once and every thread must see the very same body
+// buffer. "cancel" drops all but one asynchronous waiter of a flight, which
+// must still complete once, and then every waiter, which must abort it.
+// Exits non-zero when any of that does not hold.
+//
+//   make -C bench && ./bench/singleflight_bench [--threads N] [--bursts N] [--latency-ms N]
+
+#include "../src/http_client.hpp"
+#include "loopback.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+
+// releases all threads of a burst at once
+class start_gate
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t parties, waiting = 0;
+    uint64_t generation = 0;
+public:
+    start_gate(size_t n) : parties(n) {}
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        uint64_t gen = generation;
+        if (++waiting == parties)
+        {
+            waiting = 0;
+            generation++;
+            cv.notify_all();
+            return;
+        }
+        cv.wait(lk, [&] { return generation != gen; });
+    }
+};
+
+static bool burst_case(const char* name, loopback_server& srv, const std::shared_ptr<http_singleflight>& flight, size_t threads, long bursts)
+{
+    const std::string url = srv.url("/bytes/4096");
+    start_gate gate(threads + 1);
+    std::vector<std::shared_ptr<const std::string>> bodies(threads);
+    std::atomic<int> failures{0};
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < threads; i++)
+        pool.emplace_back([&, i] {
+            http_client c;
+            c.set_singleflight(flight);
+            for (long b = 0; b < bursts; b++)
+            {
+                gate.wait();
+                auto r = c.get_shared(url);
+                if (r->result != CURLE_OK || r->status != 200 || r->body->size() != 4096)
+                    failures++;
+                bodies[i] = r->body;
+                gate.wait();
+            }
+        });
+
+    long worst = 0, total = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long b = 0; b < bursts; b++)
+    {
+        long before = srv.requests();
+        gate.wait();
+        gate.wait();
+        long reached = srv.requests() - before;
+        worst = std::max(worst, reached);
+        total += reached;
+        // coalesced waiters hold the one buffer the flight produced
+        for (size_t i = 1; flight && i < threads; i++)
+            if (bodies[i] != bodies[0])
+                failures++;
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    for (auto& t : pool)
+        t.join();
+
+    printf("{\"bench\":\"singleflight\",\"case\":\"%s\",\"threads\":%zu,\"bursts\":%ld,\"failures\":%d,\"server_requests\":%ld,"
+           "\"max_per_burst\":%ld,\"ms_per_burst\":%.2f,\"started\":%llu,\"coalesced\":%llu}\n",
+           name, threads, bursts, failures.load(), total, worst, wall * 1000 / bursts,
+           (unsigned long long)(flight ? flight->started() : 0), (unsigned long long)(flight ? flight->coalesced() : 0));
+    fflush(stdout);
+    long want = flight ? bursts : bursts * (long)threads;
+    return failures == 0 && total == want && (!flight || worst == 1);
+}
+
+static bool cancel_case(loopback_server& srv, size_t waiters)
+{
+    http_multi engine;
+    engine.start();
+    http_singleflight flight;
+    const std::string url = srv.url("/bytes/4096");
+    bool ok = true;
+
+    // every waiter but the last walks away, the flight still delivers to that one
+    std::atomic<int> delivered{0};
+    std::promise<http_singleflight::result_ptr> last;
+    long before = srv.requests();
+    std::vector<flight_ticket> tickets;
+    for (size_t i = 0; i + 1 < waiters; i++)
+        tickets.push_back(flight.run_async(engine, "GET", url, header_map(), [&](http_singleflight::result_ptr) { delivered++; }));
+    tickets.push_back(flight.run_async(engine, "GET", url, header_map(), [&](http_singleflight::result_ptr r) { last.set_value(r); }));
+    for (size_t i = 0; i + 1 < waiters; i++)
+        ok = tickets[i].cancel() && ok;
+    http_singleflight::result_ptr r = last.get_future().get();
+    long partial = srv.requests() - before;
+    ok = ok && delivered == 0 && r->result == CURLE_OK && r->body->size() == 4096 && partial == 1;
+
+    // the last one leaving takes the request down with it
+    tickets.clear();
+    for (size_t i = 0; i < waiters; i++)
+        tickets.push_back(flight.run_async(engine, "GET", url, header_map(), [&](http_singleflight::result_ptr) { delivered++; }));
+    for (auto& t : tickets)
+        ok = t.cancel() && ok;
+    ok = ok && flight.in_flight() == 0;
+    // a fresh caller starts over instead of joining the aborted flight
+    http_singleflight::result_ptr again = flight.run(engine, "GET", url, header_map());
+    ok = ok && delivered == 0 && again->result == CURLE_OK && again->body->size() == 4096;
+    engine.stop();
+
+    printf("{\"bench\":\"singleflight\",\"case\":\"cancel\",\"waiters\":%zu,\"server_requests_partial\":%ld,\"started\":%llu,"
+           "\"coalesced\":%llu,\"cancellations\":%llu,\"ok\":%s}\n",
+           waiters, partial, (unsigned long long)flight.started(), (unsigned long long)flight.coalesced(),
+           (unsigned long long)flight.cancellations(), ok ? "true" : "false");
+    fflush(stdout);
+    return ok && flight.started() == 3 && flight.cancellations() == 2 * waiters - 1;
+}
+
+int main(int argc, char** argv)
+{
+    size_t threads = 16;
+    long bursts = 20, latency_ms = 50;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string a = argv[i];
+        if (a == "--threads")
+            threads = strtoull(argv[i + 1], nullptr, 10);
+        else if (a == "--bursts")
+            bursts = atol(argv[i + 1]);
+        else if (a == "--latency-ms")
+            latency_ms = atol(argv[i + 1]);
+    }
+
+    loopback_server srv;
+    if (!srv.valid())
+    {
+        fprintf(stderr, "cannot start loopback server\n");
+        return 1;
+    }
+    srv.set_latency(latency_ms * 1000);
+
+    bool ok = burst_case("none", srv, nullptr, threads, bursts);
+    ok = burst_case("coalesced", srv, std::make_shared<http_singleflight>(), threads, bursts) && ok;
+    ok = cancel_case(srv, threads) && ok;
+    return ok ? 0 : 1;
+}
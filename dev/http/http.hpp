@@ -3,15 +3,21 @@
 
 #include <curl/curl.h>
 #include <vector>
+#include <algorithm>
 #include <unordered_map>
 #include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
 #include <fstream>
 #include <sstream>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifndef header_map
 #define header_map std::unordered_map<std::string, std::string>
+#endif
 
 // ** form part helper class and specialization for multi part formposts **//
 
@@ -24,7 +30,7 @@ class formpart
     bool type;
 
 public:
-    formpart(int t, header_map headers) : type(t), hds(headers) {}
+    formpart(int t, header_map headers) : hds(headers), type(t) {}
     inline bool dtype() { return type; }
     inline const header_map &get_headers() { return hds; }
 };
@@ -71,35 +77,337 @@ class http_request
     std::string target;
 };
 
+// ** flat response header storage ** //
+
+// Header lines are kept as received in one buffer, the index of name/value
+// offsets is built on the first lookup and lives inline for up to
+// HEADER_INLINE fields, so a typical response costs a single allocation.
+// Common names are interned to a header_id while indexing, looking one of
+// them up is a byte compare. Lookups fill the index lazily, a block shared
+// between threads must be looked at once before it is shared.
+
+#define HEADER_INLINE 24
+
+enum header_id : unsigned char
+{
+    HDR_OTHER = 0,
+    HDR_ACCEPT_RANGES,
+    HDR_AGE,
+    HDR_CACHE_CONTROL,
+    HDR_CONNECTION,
+    HDR_CONTENT_ENCODING,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_RANGE,
+    HDR_CONTENT_TYPE,
+    HDR_DATE,
+    HDR_ETAG,
+    HDR_EXPIRES,
+    HDR_LAST_MODIFIED,
+    HDR_LOCATION,
+    HDR_RETRY_AFTER,
+    HDR_SERVER,
+    HDR_SET_COOKIE,
+    HDR_TRANSFER_ENCODING,
+    HDR_VARY,
+    HDR_COUNT
+};
+
+class header_block
+{
+    struct entry
+    {
+        uint32_t name;
+        uint32_t value;
+        uint32_t value_len;
+        uint16_t name_len;
+        header_id id;
+    };
+
+    std::string buf;
+    mutable entry inl[HEADER_INLINE];
+    mutable std::vector<entry> more;
+    mutable size_t count = 0;
+    mutable bool indexed = true;
+    mutable header_map joined;
+    mutable bool joined_ok = false;
+
+    // ASCII lower case of 8 bytes at once, only A-Z change
+    static inline uint64_t lower8(uint64_t x)
+    {
+        uint64_t low = x & 0x7F7F7F7F7F7F7F7FULL;
+        uint64_t ge_a = low + 0x3F3F3F3F3F3F3F3FULL;   // bit 7 set from 'A' up
+        uint64_t gt_z = low + 0x2525252525252525ULL;   // bit 7 set past 'Z'
+        uint64_t upper = ~x & (ge_a ^ gt_z) & 0x8080808080808080ULL;
+        return x | (upper >> 2);
+    }
+    static inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? c + 32 : c; }
+
+    void index() const
+    {
+        indexed = true;
+        count = 0;
+        more.clear();
+        size_t pos = 0;
+        while (pos < buf.size())
+        {
+            size_t eol = buf.find('\n', pos);
+            size_t end = (eol == std::string::npos) ? buf.size() : eol;
+            size_t colon = buf.find(':', pos);
+            if (colon != std::string::npos && colon < end && colon > pos)
+            {
+                size_t vb = colon + 1;
+                while (vb < end && (buf[vb] == ' ' || buf[vb] == '\t'))
+                    vb++;
+                size_t ve = end;
+                while (ve > vb && (buf[ve - 1] == ' ' || buf[ve - 1] == '\t' || buf[ve - 1] == '\r'))
+                    ve--;
+                entry e;
+                e.name = (uint32_t)pos;
+                e.name_len = (uint16_t)std::min<size_t>(colon - pos, UINT16_MAX);
+                e.value = (uint32_t)vb;
+                e.value_len = (uint32_t)(ve - vb);
+                e.id = intern(std::string_view(buf.data() + pos, e.name_len));
+                if (count < HEADER_INLINE)
+                    inl[count] = e;
+                else
+                    more.push_back(e);
+                count++;
+            }
+            pos = end + 1;
+        }
+    }
+    inline const entry& at(size_t i) const { return i < HEADER_INLINE ? inl[i] : more[i - HEADER_INLINE]; }
+
+public:
+    // case insensitive compare of header names
+    static bool iequals(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+            return false;
+        size_t i = 0;
+        for (; i + 8 <= a.size(); i += 8)
+        {
+            uint64_t x, y;
+            memcpy(&x, a.data() + i, 8);
+            memcpy(&y, b.data() + i, 8);
+            if (x != y && lower8(x) != lower8(y))
+                return false;
+        }
+        for (; i < a.size(); i++)
+            if (lower(a[i]) != lower(b[i]))
+                return false;
+        return true;
+    }
+    static header_id intern(std::string_view name)
+    {
+        static const std::string_view names[HDR_COUNT] = {
+            "", "accept-ranges", "age", "cache-control", "connection", "content-encoding",
+            "content-length", "content-range", "content-type", "date", "etag", "expires",
+            "last-modified", "location", "retry-after", "server", "set-cookie",
+            "transfer-encoding", "vary"
+        };
+        for (int i = 1; i < HDR_COUNT; i++)
+            if (names[i].size() == name.size() && iequals(names[i], name))
+                return (header_id)i;
+        return HDR_OTHER;
+    }
+
+    header_block() {}
+    header_block(const header_map& hds)
+    {
+        for (const auto& h : hds)
+        {
+            std::string line = h.first + ": " + h.second + "\r\n";
+            add(line.data(), line.size());
+        }
+    }
+
+    // one raw line as handed to CURLOPT_HEADERFUNCTION, a status line starts a new block
+    // (redirects, 100-continue)
+    void add(const char* line, size_t n)
+    {
+        if (n >= 5 && memcmp(line, "HTTP/", 5) == 0)
+        {
+            clear();
+            return;
+        }
+        if (n == 0 || line[0] == '\r' || line[0] == '\n')
+            return;
+        if (buf.capacity() == 0)
+            buf.reserve(512);
+        buf.append(line, n);
+        if (line[n - 1] != '\n')
+            buf += '\n';
+        indexed = false;
+        joined_ok = false;
+    }
+    void clear()
+    {
+        buf.clear();
+        more.clear();
+        count = 0;
+        indexed = true;
+        joined.clear();
+        joined_ok = false;
+    }
+
+    inline size_t size() const { if (!indexed) index(); return count; }
+    inline bool empty() const { return size() == 0; }
+    inline std::string_view name(size_t i) const { if (!indexed) index(); return std::string_view(buf.data() + at(i).name, at(i).name_len); }
+    inline std::string_view value(size_t i) const { if (!indexed) index(); return std::string_view(buf.data() + at(i).value, at(i).value_len); }
+    // the header lines as received, "name: value" separated by newlines
+    inline std::string_view raw() const { return buf; }
+
+    // first value of the field, empty when absent
+    std::string_view get(header_id id) const
+    {
+        if (!indexed)
+            index();
+        for (size_t i = 0; i < count; i++)
+            if (at(i).id == id)
+                return value(i);
+        return std::string_view();
+    }
+    std::string_view get(std::string_view name) const
+    {
+        header_id id = intern(name);
+        if (id != HDR_OTHER)
+            return get(id);
+        if (!indexed)
+            index();
+        for (size_t i = 0; i < count; i++)
+        {
+            const entry& e = at(i);
+            if (e.id == HDR_OTHER && e.name_len == name.size() && iequals(std::string_view(buf.data() + e.name, e.name_len), name))
+                return value(i);
+        }
+        return std::string_view();
+    }
+    inline bool has(std::string_view name) const { return get(name).data() != nullptr; }
+
+    // Content-Length, -1 when absent or malformed
+    long long content_length() const
+    {
+        std::string_view v = get(HDR_CONTENT_LENGTH);
+        if (v.empty())
+            return -1;
+        long long n = 0;
+        for (char c : v)
+        {
+            if (c < '0' || c > '9')
+                return -1;
+            n = n * 10 + (c - '0');
+        }
+        return n;
+    }
+
+    // map view with repeated fields joined by ", ", built on first use
+    const header_map& map() const
+    {
+        if (!joined_ok)
+        {
+            joined.clear();
+            for (size_t i = 0; i < size(); i++)
+            {
+                std::string& slot = joined[std::string(name(i))];
+                if (!slot.empty())
+                    slot += ", ";
+                slot.append(value(i));
+            }
+            joined_ok = true;
+        }
+        return joined;
+    }
+};
+
+// ** per-request timing breakdown ** //
+
+// Copied out of the easy handle when a transfer completes, a handful of
+// curl_easy_getinfo() reads of values libcurl already keeps. Times are in
+// microseconds from the start of the request, as CURLINFO_*_TIME_T reports.
+
+struct http_timing
+{
+    curl_off_t namelookup = 0;
+    curl_off_t connect = 0;
+    curl_off_t appconnect = 0;      // TLS handshake done, 0 for plain http
+    curl_off_t pretransfer = 0;
+    curl_off_t starttransfer = 0;   // first response byte
+    curl_off_t total = 0;
+    curl_off_t redirect = 0;
+    curl_off_t bytes_sent = 0;      // request body
+    curl_off_t bytes_received = 0;  // response body
+    long header_bytes_sent = 0;
+    long header_bytes_received = 0;
+    bool reused = false;            // an open connection was used, no new one
+
+    // res is the transfer's result: one that failed before connecting (DNS, refused) opened
+    // nothing either, it only counts as reused when it got as far as a peer address
+    void fill(CURL* hdl, CURLcode res)
+    {
+        curl_easy_getinfo(hdl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+        curl_easy_getinfo(hdl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(hdl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+        curl_easy_getinfo(hdl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+        curl_easy_getinfo(hdl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+        curl_easy_getinfo(hdl, CURLINFO_TOTAL_TIME_T, &total);
+        curl_easy_getinfo(hdl, CURLINFO_REDIRECT_TIME_T, &redirect);
+        curl_easy_getinfo(hdl, CURLINFO_SIZE_UPLOAD_T, &bytes_sent);
+        curl_easy_getinfo(hdl, CURLINFO_SIZE_DOWNLOAD_T, &bytes_received);
+        curl_easy_getinfo(hdl, CURLINFO_REQUEST_SIZE, &header_bytes_sent);
+        curl_easy_getinfo(hdl, CURLINFO_HEADER_SIZE, &header_bytes_received);
+        long conns = 0;
+        curl_easy_getinfo(hdl, CURLINFO_NUM_CONNECTS, &conns);
+        char* ip = nullptr;
+        curl_easy_getinfo(hdl, CURLINFO_PRIMARY_IP, &ip);
+        reused = conns == 0 && (res == CURLE_OK || (ip && *ip));
+    }
+
+    // the phases on their own
+    inline curl_off_t dns() const { return namelookup; }
+    inline curl_off_t tcp() const { return connect > namelookup ? connect - namelookup : 0; }
+    inline curl_off_t tls() const { return appconnect > connect ? appconnect - connect : 0; }
+    inline curl_off_t server() const { return starttransfer > pretransfer ? starttransfer - pretransfer : 0; }
+    inline curl_off_t transfer() const { return total > starttransfer ? total - starttransfer : 0; }
+};
+
 // ** http response class and specializations ** //
 
 class http_response
 {
+    friend class http_transfer;
 protected:
-    bool noError;
+    bool noError = false;
     std::string error;
-    long code;
-    header_map headers;
+    CURLcode result = CURLE_OK;
+    long code = 0;
+    header_block headers;
+    http_timing timing;
+    http_response () {}
     http_response (bool noErr, const std::string& err, long rescode, const header_map& hds)
     : noError(noErr), error(err), code(rescode), headers(hds) {}
 public:
     inline bool no_error() {return noError;}
     inline std::string get_error() { return error; }
+    inline CURLcode get_result() const { return result; }
     inline long get_code() { return code; }
-    inline const std::string& get_header(std::string val)
-    {
-        if (headers.find(val) != headers.end())
-            return headers[val];
-        return "";
-    }
-    inline const header_map& get_headers() { return headers; }
+    // first value of the header, empty when absent; valid as long as the response
+    inline std::string_view get_header(std::string_view name) const { return headers.get(name); }
+    inline std::string_view get_header(header_id id) const { return headers.get(id); }
+    inline const header_block& header_fields() const { return headers; }
+    inline const header_map& get_headers() const { return headers.map(); }
+    inline const http_timing& get_timing() const { return timing; }
 };
 
 class http_string_response : public http_response
 {
+    friend class http_transfer;
     std::string body;
 public:
+    http_string_response () {}
     inline const std::string& get_body() { return body; }
+    // moves the body out, the response is left without one
+    inline std::string take_body() { return std::move(body); }
 };
 
 class http_file_response : public http_response
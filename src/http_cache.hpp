@@ -0,0 +1,489 @@
+#ifndef __HTTP_CACHE_HPP__
+#define __HTTP_CACHE_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../dev/http/http.hpp"
+#include "http_file.hpp"
+
+// ** private HTTP response cache (RFC 9111) ** //
+
+// Sits in front of http_client::get()/c_get("GET"). Responses are stored
+// according to Cache-Control (no-store, no-cache, max-age, private/public),
+// Expires and Vary, with the usual Last-Modified heuristic when neither gives
+// a lifetime. A fresh entry is served without touching the network, a stale
+// one with an ETag or Last-Modified is revalidated with If-None-Match /
+// If-Modified-Since and a 304 is answered from the cache. One variant is kept
+// per URL; a request whose Vary headers differ from the stored ones misses.
+//
+// Entries live in an LRU bounded by bytes. With a directory set, every stored
+// entry is also written to one file there (written aside and renamed into
+// place), and a memory miss maps that file and serves the body straight out
+// of the mapping, so the cache survives restarts. Everything is guarded by one
+// mutex, a cache may be shared by clients on different threads.
+
+struct cache_entry
+{
+    std::string key;
+    long status = 0;
+    std::string headers;            // response header lines as received
+    std::string etag;
+    std::string last_modified;
+    std::vector<std::pair<std::string, std::string>> vary;  // request header (lower case), value it had
+    time_t response_time = 0;       // when the response arrived or was last revalidated
+    long age = 0;                   // corrected Age at response_time, seconds
+    long lifetime = 0;              // freshness lifetime, seconds
+    bool no_cache = false;          // revalidate before every use
+
+    // the body lives in owned or in map, shared so copies of the entry keep it
+    std::shared_ptr<const std::string> owned;
+    std::shared_ptr<const mapped_file> map;
+    std::string_view body;
+
+    inline bool fresh(time_t now) const { return !no_cache && age + (now - response_time) < lifetime; }
+    inline bool validatable() const { return !etag.empty() || !last_modified.empty(); }
+    inline size_t bytes() const { return body.size() + headers.size() + key.size() + 128; }
+};
+
+struct cache_stats
+{
+    uint64_t hits = 0;              // served fresh from the cache
+    uint64_t misses = 0;            // went to the network without a usable entry
+    uint64_t revalidated = 0;       // 304, served from the cache
+    uint64_t stores = 0;
+    uint64_t evictions = 0;         // dropped from memory to stay under the byte limit
+    size_t bytes = 0;
+    size_t entries = 0;
+};
+
+enum cache_event { CACHE_HIT, CACHE_MISS, CACHE_REVALIDATED };
+
+class http_cache
+{
+public:
+    typedef std::shared_ptr<const cache_entry> entry_ptr;
+
+private:
+    typedef std::list<entry_ptr> lru_list;  // most recently used first
+
+    std::mutex mtx;
+    lru_list lru;
+    std::unordered_map<std::string, lru_list::iterator> index;
+    size_t max_bytes;
+    size_t max_entry;
+    size_t used = 0;
+    std::string dir;
+    std::atomic<uint64_t> hits{0}, misses{0}, revalidations{0}, stores{0}, evictions{0};
+
+    struct directives
+    {
+        bool no_store = false, no_cache = false, is_public = false;
+        long max_age = -1;
+    };
+    static directives parse_cache_control(std::string_view v)
+    {
+        directives d;
+        while (!v.empty())
+        {
+            size_t comma = v.find(',');
+            std::string_view item = v.substr(0, comma);
+            v = comma == std::string_view::npos ? std::string_view() : v.substr(comma + 1);
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+                item.remove_prefix(1);
+            size_t eq = item.find('=');
+            std::string_view name = item.substr(0, eq);
+            while (!name.empty() && (name.back() == ' ' || name.back() == '\t'))
+                name.remove_suffix(1);
+            if (header_block::iequals(name, "no-store"))
+                d.no_store = true;
+            else if (header_block::iequals(name, "no-cache"))
+                d.no_cache = true;
+            else if (header_block::iequals(name, "public"))
+                d.is_public = true;
+            else if (header_block::iequals(name, "max-age") && eq != std::string_view::npos)
+            {
+                std::string_view val = item.substr(eq + 1);
+                if (!val.empty() && val.front() == '"')
+                    val.remove_prefix(1);
+                d.max_age = strtol(std::string(val).c_str(), nullptr, 10);
+                if (d.max_age < 0)
+                    d.max_age = 0;
+            }
+        }
+        return d;
+    }
+    static time_t http_date(std::string_view v)
+    {
+        return v.empty() ? -1 : curl_getdate(std::string(v).c_str(), nullptr);
+    }
+    // value of a request header, matched case insensitively
+    static std::string_view request_header(const header_map& req, std::string_view name)
+    {
+        for (const auto& h : req)
+            if (header_block::iequals(h.first, name))
+                return h.second;
+        return std::string_view();
+    }
+    // statuses that may be stored without an explicit lifetime
+    static bool heuristic_status(long s)
+    {
+        return s == 200 || s == 203 || s == 204 || s == 300 || s == 301 || s == 308 ||
+               s == 404 || s == 405 || s == 410 || s == 414 || s == 501;
+    }
+
+    std::string path_of(const std::string& key) const
+    {
+        uint64_t h = 1469598103934665603ULL;
+        for (char c : key)
+            h = (h ^ (unsigned char)c) * 1099511628211ULL;
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.cache", (unsigned long long)h);
+        return dir + name;
+    }
+    static void put_field(std::string& out, std::string_view v)
+    {
+        out += std::to_string(v.size());
+        out += ':';
+        out.append(v.data(), v.size());
+    }
+    static bool get_field(std::string_view& in, std::string_view& v)
+    {
+        size_t colon = in.find(':');
+        if (colon == std::string_view::npos || colon == 0 || colon > 20)
+            return false;
+        size_t n = strtoull(std::string(in.substr(0, colon)).c_str(), nullptr, 10);
+        if (n > in.size() - colon - 1)
+            return false;
+        v = in.substr(colon + 1, n);
+        in.remove_prefix(colon + 1 + n);
+        return true;
+    }
+    static long get_long(std::string_view& in, bool& ok)
+    {
+        std::string_view v;
+        ok = ok && get_field(in, v);
+        return ok ? strtol(std::string(v).c_str(), nullptr, 10) : 0;
+    }
+
+    void write_disk(const cache_entry& e);
+    entry_ptr read_disk(const std::string& key);
+    void remove_disk(const std::string& key) { if (!dir.empty()) unlink(path_of(key).c_str()); }
+
+    // caller holds mtx
+    void insert(entry_ptr e);
+    void erase(const std::string& key)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+            return;
+        used -= (*it->second)->bytes();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+public:
+    // max_entry caps a single body, larger responses pass through uncached
+    http_cache(size_t max_bytes = 64 << 20, std::string directory = std::string(), size_t max_entry = 0)
+    : max_bytes(max_bytes), max_entry(max_entry ? max_entry : max_bytes / 8), dir(std::move(directory))
+    {
+        if (!dir.empty())
+            mkdir(dir.c_str(), 0700);
+    }
+    http_cache(const http_cache&) = delete;
+    http_cache& operator=(const http_cache&) = delete;
+
+    // usable entry for a request, null on a miss; fresh or not is up to the caller
+    entry_ptr lookup(const std::string& key, const header_map& request);
+    // the entry a response makes, stored when its headers allow it; null when not cacheable
+    entry_ptr store(const std::string& key, const header_map& request, long status, const header_block& headers, std::shared_ptr<const std::string> body);
+    // a 304 for e: freshness and validators from its headers, body kept
+    entry_ptr refresh(const entry_ptr& e, const header_block& headers);
+    // after an unsafe request to the url (RFC 9111 4.4)
+    void invalidate(const std::string& key)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            erase(key);
+        }
+        remove_disk(key);
+    }
+    void clear()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        for (auto& e : lru)
+            remove_disk(e->key);
+        lru.clear();
+        index.clear();
+        used = 0;
+    }
+
+    inline size_t entry_limit() const { return max_entry; }
+    inline void count(cache_event ev)
+    {
+        std::atomic<uint64_t>& c = ev == CACHE_HIT ? hits : ev == CACHE_MISS ? misses : revalidations;
+        c.fetch_add(1, std::memory_order_relaxed);
+    }
+    cache_stats stats()
+    {
+        cache_stats s;
+        s.hits = hits.load(std::memory_order_relaxed);
+        s.misses = misses.load(std::memory_order_relaxed);
+        s.revalidated = revalidations.load(std::memory_order_relaxed);
+        s.stores = stores.load(std::memory_order_relaxed);
+        s.evictions = evictions.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(mtx);
+        s.bytes = used;
+        s.entries = index.size();
+        return s;
+    }
+
+    // request side Cache-Control / Pragma: no-store skips the cache, no-cache forces revalidation
+    static void request_directives(const header_map& request, bool& no_store, bool& no_cache)
+    {
+        directives d = parse_cache_control(request_header(request, "cache-control"));
+        no_store = d.no_store;
+        no_cache = d.no_cache || request_header(request, "pragma").find("no-cache") != std::string_view::npos;
+    }
+};
+
+inline void http_cache::insert(entry_ptr e)
+{
+    erase(e->key);
+    used += e->bytes();
+    lru.push_front(e);
+    index[e->key] = lru.begin();
+    while (used > max_bytes && lru.size() > 1)
+    {
+        // dropped from memory only, the disk copy stays
+        used -= lru.back()->bytes();
+        index.erase(lru.back()->key);
+        lru.pop_back();
+        evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+inline http_cache::entry_ptr http_cache::lookup(const std::string& key, const header_map& request)
+{
+    entry_ptr e;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            e = *it->second;
+        }
+    }
+    if (!e && !dir.empty() && (e = read_disk(key)))
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (e->bytes() <= max_bytes)
+            insert(e);
+    }
+    if (!e)
+        return nullptr;
+    for (const auto& v : e->vary)
+        if (request_header(request, v.first) != v.second)
+            return nullptr;
+    return e;
+}
+
+inline http_cache::entry_ptr http_cache::store(const std::string& key, const header_map& request, long status, const header_block& headers, std::shared_ptr<const std::string> body)
+{
+    directives cc = parse_cache_control(headers.get(HDR_CACHE_CONTROL));
+    std::string_view vary = headers.get(HDR_VARY);
+    if (cc.no_store || vary.find('*') != std::string_view::npos || status == 206 || status == 304 || body->size() > max_entry ||
+        (!cc.is_public && !request_header(request, "authorization").empty()))
+    {
+        invalidate(key);
+        return nullptr;
+    }
+
+    auto e = std::make_shared<cache_entry>();
+    e->key = key;
+    e->status = status;
+    e->headers = std::string(headers.raw());
+    e->etag = std::string(headers.get(HDR_ETAG));
+    e->last_modified = std::string(headers.get(HDR_LAST_MODIFIED));
+    e->no_cache = cc.no_cache;
+    e->response_time = time(nullptr);
+
+    time_t date = http_date(headers.get(HDR_DATE));
+    if (date < 0)
+        date = e->response_time;
+    long age = strtol(std::string(headers.get(HDR_AGE)).c_str(), nullptr, 10);
+    e->age = std::max<long>(std::max<long>(0, e->response_time - date), std::max<long>(0, age));
+
+    bool explicit_life = true;
+    if (cc.max_age >= 0)
+        e->lifetime = cc.max_age;
+    else if (headers.has("expires"))
+    {
+        // an unparsable Expires means already expired
+        time_t exp = http_date(headers.get(HDR_EXPIRES));
+        e->lifetime = exp < 0 ? 0 : std::max<long>(0, exp - date);
+    }
+    else
+    {
+        explicit_life = false;
+        time_t lm = http_date(e->last_modified);
+        if (lm >= 0 && lm < date)
+            e->lifetime = (date - lm) / 10;
+    }
+    if ((!explicit_life && !heuristic_status(status)) || (e->lifetime <= 0 && !e->validatable()))
+    {
+        invalidate(key);
+        return nullptr;
+    }
+
+    for (std::string_view names = vary; !names.empty(); )
+    {
+        size_t comma = names.find(',');
+        std::string_view n = names.substr(0, comma);
+        names = comma == std::string_view::npos ? std::string_view() : names.substr(comma + 1);
+        while (!n.empty() && (n.front() == ' ' || n.front() == '\t'))
+            n.remove_prefix(1);
+        while (!n.empty() && (n.back() == ' ' || n.back() == '\t'))
+            n.remove_suffix(1);
+        if (n.empty())
+            continue;
+        std::string lower(n);
+        for (auto& c : lower)
+            c = (c >= 'A' && c <= 'Z') ? c + 32 : c;
+        e->vary.push_back({lower, std::string(request_header(request, lower))});
+    }
+
+    // kept as handed over, a body shared with coalesced waiters is not copied
+    e->body = *body;
+    e->owned = std::move(body);
+
+    stores.fetch_add(1, std::memory_order_relaxed);
+    if (!dir.empty())
+        write_disk(*e);
+    std::lock_guard<std::mutex> lk(mtx);
+    insert(e);
+    return e;
+}
+
+inline http_cache::entry_ptr http_cache::refresh(const entry_ptr& old, const header_block& headers)
+{
+    auto e = std::make_shared<cache_entry>(*old);
+    e->response_time = time(nullptr);
+    e->age = 0;
+    directives cc = parse_cache_control(headers.get(HDR_CACHE_CONTROL));
+    if (headers.has("cache-control"))
+        e->no_cache = cc.no_cache;
+    time_t date = http_date(headers.get(HDR_DATE));
+    if (date < 0)
+        date = e->response_time;
+    if (cc.max_age >= 0)
+        e->lifetime = cc.max_age;
+    else if (headers.has("expires"))
+    {
+        time_t exp = http_date(headers.get(HDR_EXPIRES));
+        e->lifetime = exp < 0 ? 0 : std::max<long>(0, exp - date);
+    }
+    if (headers.has("etag"))
+        e->etag = std::string(headers.get(HDR_ETAG));
+    if (headers.has("last-modified"))
+        e->last_modified = std::string(headers.get(HDR_LAST_MODIFIED));
+
+    if (cc.no_store)
+    {
+        invalidate(e->key);
+        return e;
+    }
+    if (!dir.empty())
+        write_disk(*e);
+    std::lock_guard<std::mutex> lk(mtx);
+    insert(e);
+    return e;
+}
+
+inline void http_cache::write_disk(const cache_entry& e)
+{
+    std::string meta = "EZC1";
+    put_field(meta, e.key);
+    put_field(meta, std::to_string(e.status));
+    put_field(meta, std::to_string((long long)e.response_time));
+    put_field(meta, std::to_string(e.age));
+    put_field(meta, std::to_string(e.lifetime));
+    put_field(meta, e.no_cache ? "1" : "0");
+    put_field(meta, e.etag);
+    put_field(meta, e.last_modified);
+    put_field(meta, std::to_string(e.vary.size()));
+    for (const auto& v : e.vary)
+    {
+        put_field(meta, v.first);
+        put_field(meta, v.second);
+    }
+    put_field(meta, e.headers);
+    meta += std::to_string(e.body.size());
+    meta += ':';
+
+    // written aside and renamed, a reader never maps a half written file
+    std::string path = path_of(e.key);
+    std::string tmp = path + ".tmp" + std::to_string((unsigned long)getpid());
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return;
+    bool ok = fwrite(meta.data(), 1, meta.size(), f) == meta.size() &&
+              fwrite(e.body.data(), 1, e.body.size(), f) == e.body.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        unlink(tmp.c_str());
+}
+
+inline http_cache::entry_ptr http_cache::read_disk(const std::string& key)
+{
+    auto map = std::make_shared<mapped_file>(path_of(key));
+    if (!map->valid() || map->size() < 4 || map->view().substr(0, 4) != "EZC1")
+        return nullptr;
+    std::string_view in = map->view().substr(4);
+    std::string_view v;
+    auto e = std::make_shared<cache_entry>();
+    bool ok = get_field(in, v);
+    e->key = std::string(v);
+    if (!ok || e->key != key)
+        return nullptr;     // a hash collision, or garbage
+    e->status = get_long(in, ok);
+    e->response_time = (time_t)get_long(in, ok);
+    e->age = get_long(in, ok);
+    e->lifetime = get_long(in, ok);
+    e->no_cache = get_long(in, ok) != 0;
+    ok = ok && get_field(in, v);
+    e->etag = std::string(v);
+    ok = ok && get_field(in, v);
+    e->last_modified = std::string(v);
+    long nvary = get_long(in, ok);
+    for (long i = 0; ok && i < nvary; i++)
+    {
+        std::string_view n, val;
+        ok = get_field(in, n) && get_field(in, val);
+        e->vary.push_back({std::string(n), std::string(val)});
+    }
+    ok = ok && get_field(in, v);
+    e->headers = std::string(v);
+    ok = ok && get_field(in, v);
+    if (!ok)
+        return nullptr;
+    e->body = v;
+    e->map = std::move(map);
+    return e;
+}
+
+#endif
@@ -1,703 +1,1641 @@
+#ifndef __HTTP_CLIENT_HPP__
+#define __HTTP_CLIENT_HPP__
+
 #include <vector>
 #include <map>
 #include <string>
 #include <fstream>
 #include <curl/curl.h>
-#include <sstream>
+#include <string_view>
+#include <cstring>
+#include <algorithm>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <strings.h>
+#include <memory>
+#include <future>
+#include <optional>
+#include "http_pool.hpp"
+#include "http_share.hpp"
+#include "http_sink.hpp"
+#include "http_prepared.hpp"
+#include "http_download.hpp"
+#include "http_file.hpp"
+#include "http_metrics.hpp"
+#include "http_log.hpp"
+#include "http_compress.hpp"
+#include "http_cache.hpp"
+#include "http_flight.hpp"
+#include "http_limit.hpp"
+#include "http_hedge.hpp"
+#include "http_mime.hpp"
 
 #ifndef header_map
 #define header_map std::map<std::string, std::string>
 #endif
 
+#include "http_multi.hpp"
+#include "http_coro.hpp"
+
 #define CURL_BAD_HANDLE -1
 #define CURL_FILE_ERR -2
 
-#define MIME_STRING 0
-#define MIME_FILE 1
-
-class mime_part
-{
-    header_map hds;
-    bool type;
-public:
-    mime_part(int t, header_map headers) : type(t), hds(headers) {}
-    bool dtype() { return type; }
-    const header_map& get_headers() { return hds; }
-};
-
-class mime_string_part : public mime_part
-{
-    std::string f;
-    std::string d;
-public:
-    mime_string_part(std::string field, std::string data, header_map headers = header_map()) : mime_part(MIME_STRING, headers), f(field), d(data) {}
-    const std::string& get_field() const { return f; }
-    const std::string& get_data() const { return d; }
-};
-
-class mime_file_part : public mime_part
-{
-    std::string f;
-    std::string pth;
-    std::string rmt;
-public:
-    mime_file_part (std::string field, std::string path, std::string remotename, header_map headers = header_map()) : mime_part(MIME_FILE, headers), f(field), pth(path), rmt(remotename) {}
-    const std::string& get_field() const { return f; }
-    const std::string& get_path() const { return pth; }
-    const std::string& get_remote() const { return rmt; }
-};
-
 class http_client
 {
 private:
-    std::string err;
     bool log_en = false;
-
-    static size_t write(void *buffer, size_t size, size_t nmemb, std::string* userp)
+    std::shared_ptr<http_log> logs;         // created by enable_logging() or set_log(), see http_log.hpp
+    bool tracing = false;
+    std::shared_ptr<http_share> share;      // declared first, it must outlive the handles below
+    http_pool pool;
+    std::shared_ptr<http_multi> engine;     // started on the first *_async() call
+    size_t max_inflight = 64;
+    file_sink_options file_opts;
+    compression_options zopts;              // see http_compress.hpp
+    std::shared_ptr<http_cache> cache;      // in front of get()/c_get("GET") when set
+    std::shared_ptr<http_singleflight> flight;  // coalesces identical get()/c_get() when set
+    std::shared_ptr<http_limiter> limiter;  // admission control for blocking calls when set
+    std::shared_ptr<hedge_policy> hedging;  // hedges and retries get()/c_get() when set
+    hedge_multi hmulti;                     // where hedged attempts race
+    hedge_report hreport;
+#ifdef HTTP_COROUTINES
+    coro_executor coro_exec;                // where co_*() calls resume, null: the engine thread
+#endif
+    bool zen = false;                       // set_compression() was called
+    bool h2 = false, h2c = true;
+    long status = 0;
+    http_timing timing;
+    http_metrics* metrics = nullptr;
+    long h2_streams = 100, h2_conns = 0;
+
+    static size_t write(void *buffer, size_t size, size_t nmemb, response_sink* userp)
     {
-        userp->append((char*) buffer, size*nmemb);
-        return size*nmemb;
+        return userp->write((char*) buffer, size*nmemb) ? size*nmemb : 0;
     }
-    static size_t writef(void *buffer, size_t size, size_t nmemb, std::ofstream* userp)
+    static size_t header(char *buffer, size_t size, size_t nitems, response_sink* userp)
     {
-        userp->write((char*) buffer, size*nmemb);
-        return size*nmemb;
+        // let the sink size its storage once from Content-Length
+        size_t n = size*nitems;
+        if (n > 15 && strncasecmp(buffer, "content-length:", 15) == 0)
+            userp->expect(strtoll(std::string(buffer + 15, n - 15).c_str(), nullptr, 10));
+        return n;
     }
-    static size_t read(void *buffer, size_t size, size_t nmemb, std::stringstream* userp)
+    // response of a cacheable GET: passed on to the caller's sink, headers and (up to the
+    // cache's entry limit) body kept for http_cache::store()
+    struct cache_capture : public response_sink
     {
-        userp->read((char*) buffer, size*nmemb);
-        return userp->gcount();
+        response_sink& out;
+        size_t limit;
+        std::string body;
+        bool over = false;
+        header_block headers;
+
+        cache_capture(response_sink& s, size_t max) : out(s), limit(max) {}
+        void begin() override { if (out.enabled()) out.begin(); }
+        void expect(curl_off_t size) override { if (out.enabled()) out.expect(size); }
+        bool write(const char* data, size_t len) override
+        {
+            if (!over && body.size() + len <= limit)
+                body.append(data, len);
+            else
+            {
+                over = true;
+                body.clear();
+            }
+            return !out.enabled() || out.write(data, len);
+        }
+    };
+    static size_t cache_header(char *buffer, size_t size, size_t nitems, cache_capture* userp)
+    {
+        userp->headers.add(buffer, size*nitems);
+        return header(buffer, size, nitems, userp);
+    }
+    static size_t read(void *buffer, size_t size, size_t nmemb, std::string_view* userp)
+    {
+        // consumes the caller's buffer in place, nothing is copied before libcurl's own buffer
+        size_t n = std::min(size*nmemb, userp->size());
+        memcpy(buffer, userp->data(), n);
+        userp->remove_prefix(n);
+        return n;
     }
     static size_t readf(void *buffer, size_t size, size_t nmemb, FILE* userp)
     {
         int bytes_read = fread(buffer, size, nmemb, userp);
         return bytes_read;
     }
-    curl_slist* bna_hds(CURL* hdl, header_map headers) // build and attach headers
+    curl_slist* bna_hds(CURL* hdl, const header_map& headers, const char* encoding = nullptr) // build and attach headers
     {
         curl_slist* hds = NULL;
-        if (!headers.empty())
+        for(const auto& h : headers)
+        {
+            std::string header = h.first + ":" + h.second;
+            hds = curl_slist_append(hds, header.c_str());
+        }
+        if (encoding)
+            hds = curl_slist_append(hds, (std::string("Content-Encoding: ") + encoding).c_str());
+        if (hds)
+            curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, hds);
+        return hds;
+    }
+    static bool has_header(const header_map& headers, const char* name)
+    {
+        for (const auto& h : headers)
+            if (strcasecmp(h.first.c_str(), name) == 0)
+                return true;
+        return false;
+    }
+    // request body compressed when it is past the threshold and deflating saves enough (see
+    // http_compress.hpp); returns the Content-Encoding to send, null when the body goes out as is
+    const char* attach_deflated(CURL* hdl, std::string_view data, const header_map& headers, deflated_body& d, bool upload)
+    {
+#ifndef HTTP_COMPRESSION
+        (void)hdl; (void)data; (void)headers; (void)d; (void)upload;
+        return nullptr;
+#else
+        if (!zen || !zopts.compress(data.size()) || has_header(headers, "Content-Encoding"))
+            return nullptr;
+        size_t sample = std::min(data.size(), std::max<size_t>(zopts.probe, 1));
+        if (!compress_bounded(data.substr(0, sample), d.packed, (size_t)(sample * (1 - zopts.min_saving)), zopts.level, zopts.gzip))
+            return nullptr;
+        if (sample == data.size())
+        {
+            // all of it deflated already, it goes out with its length
+            d.rest = d.packed;
+            curl_easy_setopt(hdl, CURLOPT_READFUNCTION, deflated_body::read);
+            curl_easy_setopt(hdl, CURLOPT_READDATA, &d);
+            curl_easy_setopt(hdl, upload ? CURLOPT_INFILESIZE_LARGE : CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)d.packed.size());
+            curl_easy_setopt(hdl, upload ? CURLOPT_UPLOAD : CURLOPT_POST, 1L);
+            return zopts.encoding();
+        }
+        d.z.emplace(data, zopts.level, zopts.gzip);
+        if (!d.z->valid())
+            return nullptr;
+        curl_easy_setopt(hdl, CURLOPT_READFUNCTION, deflate_reader::read);
+        curl_easy_setopt(hdl, CURLOPT_READDATA, &*d.z);
+        curl_easy_setopt(hdl, upload ? CURLOPT_UPLOAD : CURLOPT_POST, 1L);
+        return zopts.encoding();
+#endif
+    }
+    // upload body for putfile: the file's mapping when it can be mapped, else a FILE* read
+    // with fread (pipes and the like, sent chunked when the size is unknown)
+    bool attach_file(CURL* hdl, const std::string& filename, mapped_file& map, mapped_reader& reader, FILE*& file)
+    {
+        if (map.valid())
         {
-            for(auto h : headers)
+            reader.map = &map;
+            curl_easy_setopt(hdl, CURLOPT_READFUNCTION, mapped_reader::read);
+            curl_easy_setopt(hdl, CURLOPT_READDATA, &reader);
+            curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)map.size());
+            return true;
+        }
+        file = fopen(filename.c_str(), "rb");
+        if (!file)
+            return false;
+        struct stat fileinfo;
+        if (fstat(fileno(file), &fileinfo) == 0 && S_ISREG(fileinfo.st_mode))
+            curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)fileinfo.st_size);
+        curl_easy_setopt(hdl, CURLOPT_READFUNCTION, readf);
+        curl_easy_setopt(hdl, CURLOPT_READDATA, file);
+        return true;
+    }
+    static curl_mime* build_mime(CURL* hdl, const std::vector<mime_part*>& parts)
+    {
+        curl_mime* mpf = curl_mime_init(hdl);
+        for (auto p : parts)
+        {
+            curl_mimepart* part = curl_mime_addpart(mpf);
+
+            curl_slist* d_hds = NULL;
+            if (!p->get_headers().empty())
             {
-                std::string header = h.first + ":" + h.second;
-                hds = curl_slist_append(hds, header.c_str());
+                for(const auto& h : p->get_headers())
+                {
+                    std::string header = h.first + ":" + h.second;
+                    d_hds = curl_slist_append(d_hds, header.c_str());
+                }
+                curl_mime_headers(part, d_hds, true);
             }
-            curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, hds);
+
+            switch (p->dtype())
+            {
+                case MIME_STRING:
+                {
+                    // read from the part's own string, NULs included, instead of a copy in libcurl
+                    mime_string_part* cp = (mime_string_part*) p;
+                    curl_mime_name(part, cp->get_field().c_str());
+                    mime_view_source::attach(part, cp->get_data());
+                    break;
+                }
+                case MIME_FILE:
+                {
+                    mime_file_part* cp = (mime_file_part*) p;
+                    curl_mime_name(part, cp->get_field().c_str());
+                    // body read from the file's mapping, filedata (which also sets the
+                    // filename) only for what cannot be mapped
+                    if (!mime_mapped_source::attach(part, cp->get_path()))
+                        curl_mime_filedata(part, cp->get_path().c_str());
+                    const std::string& rmt = cp->get_remote();
+                    const std::string& pth = cp->get_path();
+                    curl_mime_filename(part, rmt.empty() ? pth.substr(pth.find_last_of('/') + 1).c_str() : rmt.c_str());
+                    break;
+                }
+                case MIME_BUFFER:
+                {
+                    mime_buffer_part* cp = (mime_buffer_part*) p;
+                    curl_mime_name(part, cp->get_field().c_str());
+                    mime_view_source::attach(part, cp->get_data());
+                    if (!cp->get_remote().empty())
+                        curl_mime_filename(part, cp->get_remote().c_str());
+                    break;
+                }
+                case MIME_GENERATOR:
+                {
+                    mime_generator_part* cp = (mime_generator_part*) p;
+                    curl_mime_name(part, cp->get_field().c_str());
+                    mime_generator_source::attach(part, cp->get_generator(), cp->get_size());
+                    if (!cp->get_remote().empty())
+                        curl_mime_filename(part, cp->get_remote().c_str());
+                    break;
+                }
+                case MIME_MULTIPART:
+                {
+                    mime_multipart_part* cp = (mime_multipart_part*) p;
+                    if (!cp->get_field().empty())
+                        curl_mime_name(part, cp->get_field().c_str());
+                    // the part owns the nested tree from here on
+                    curl_mime_subparts(part, build_mime(hdl, cp->get_parts()));
+                    curl_mime_type(part, ("multipart/" + cp->get_subtype()).c_str());
+                    break;
+                }
+            }
+            if (!p->get_type().empty())
+                curl_mime_type(part, p->get_type().c_str());
         }
-        return hds;
+        return mpf;
+    }
+    // status and timing of the call that just completed, kept for last_status()/last_timing(),
+    // counted in the metrics registry when one is set and logged when logging is enabled
+    void record(const char* op, CURL* hdl, std::string_view method, std::string_view url, CURLcode res)
+    {
+        // turned away by the limiter, the handle holds the previous transfer's info
+        if ((int)res == CURL_LIMITED)
+        {
+            status = 0;
+            timing = http_timing();
+            note(op, method, url, CURL_LIMITED);
+            return;
+        }
+        status = 0;
+        curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &status);
+        timing.fill(hdl, res);
+        if (metrics)
+            metrics->record(method, url, (int)res, timing);
+        if (log_en)
+            logs->call(op, method, url, (int)res, status, (int64_t)timing.total);
+        // a successful unsafe request invalidates what the cache holds for its url
+        if (cache && res == CURLE_OK && status < 400 && method != "GET" && method != "HEAD")
+            cache->invalidate(std::string(url));
+    }
+    // curl_easy_perform behind the limiter when one is set, CURL_LIMITED when it turns
+    // the request away; the time to first byte and the outcome feed the host's limit
+    CURLcode easy_perform(CURL* hdl, const std::string& url)
+    {
+        if (!limiter)
+            return curl_easy_perform(hdl);
+        limit_permit p = limiter->acquire(url);
+        if (!p)
+            return (CURLcode)CURL_LIMITED;
+        CURLcode res = curl_easy_perform(hdl);
+        long code = 0;
+        curl_off_t ttfb = 0;
+        curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_getinfo(hdl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+        p.done(http_limiter::healthy(res, code), (long)ttfb);
+        return res;
+    }
+    int cached_get(const char* op, const std::string& type, const std::string& url, response_sink& sink, const header_map& headers);
+    int hedged_get(const char* op, const std::string& type, const std::string& url, response_sink& sink, const header_map& headers);
+    // response of an identical request in flight, or of the one this call starts (see
+    // http_flight.hpp); status and timing are kept as for any other call
+    http_singleflight::result_ptr coalesce(const std::string& type, const std::string& url, const header_map& headers)
+    {
+        http_singleflight::result_ptr r = flight->run(async_engine(), type, url, headers, pool.connect_timeout(), pool.timeout());
+        status = r->status;
+        timing = r->timing;
+        return r;
+    }
+    // a body that did not come through libcurl, handed to the sink the same way
+    static CURLcode deliver(response_sink& sink, std::string_view body)
+    {
+        if (!sink.enabled())
+            return CURLE_OK;
+        sink.begin();
+        sink.expect((curl_off_t)body.size());
+        return sink.write(body.data(), body.size()) ? CURLE_OK : CURLE_WRITE_ERROR;
+    }
+    // a call that ended without a transfer to look at
+    void note(const char* op, std::string_view method, std::string_view url, int code)
+    {
+        if (log_en)
+            logs->call(op, method, url, code, 0, 0);
+    }
+    void attach_sink(CURL* hdl, response_sink& sink)
+    {
+        if (!sink.enabled())
+            return;
+        sink.begin();
+        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
+        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, &sink);
+        curl_easy_setopt(hdl, CURLOPT_HEADERFUNCTION, header);
+        curl_easy_setopt(hdl, CURLOPT_HEADERDATA, &sink);
+    }
+    http_multi& async_engine()
+    {
+        if (!engine)
+        {
+            engine = std::make_shared<http_multi>(max_inflight);
+            if (h2)
+                engine->enable_http2(h2c, h2_streams, h2_conns);
+            if (share)
+                engine->set_share(share->handle());
+            engine->set_metrics(metrics);
+            engine->set_log(log_en ? logs.get() : nullptr);
+            if (zen)
+                engine->set_accept_encoding(zopts.responses ? zopts.accept.c_str() : nullptr);
+        }
+        engine->start();
+        return *engine;
+    }
+    http_transfer* make_transfer(std::string type, std::string url, std::string data, http_transfer::callback cb, header_map headers)
+    {
+#ifdef HTTP_COMPRESSION
+        // the transfer owns its body anyway, compressed up front it keeps its Content-Length
+        std::string packed;
+        if (zen && zopts.compress(data.size()) && !has_header(headers, "Content-Encoding") &&
+            compress_bounded(data, packed, (size_t)(data.size() * (1 - zopts.min_saving)), zopts.level, zopts.gzip))
+        {
+            data.swap(packed);
+            headers["Content-Encoding"] = zopts.encoding();
+        }
+#endif
+        return new http_transfer(std::move(type), std::move(url), std::move(headers), std::move(data), std::move(cb));
+    }
+    void submit_async(std::string type, std::string url, std::string data, http_transfer::callback cb, header_map headers)
+    {
+        async_engine().submit(make_transfer(std::move(type), std::move(url), std::move(data), std::move(cb), std::move(headers)));
     }
+    std::future<http_string_response> submit_async(std::string type, std::string url, std::string data, header_map headers)
+    {
+        auto prom = std::make_shared<std::promise<http_string_response>>();
+        std::future<http_string_response> fut = prom->get_future();
+        submit_async(std::move(type), std::move(url), std::move(data), [prom](http_string_response&& r) { prom->set_value(std::move(r)); }, std::move(headers));
+        return fut;
+    }
+#ifdef HTTP_COROUTINES
+    http_call make_call(http_transfer* t)
+    {
+        http_call c(async_engine(), t);
+        if (coro_exec)
+            c.resume_on(coro_exec);
+        return c;
+    }
+#endif
 public:
 
-    int get(std::string url,std::string* response, header_map headers);
-    int getfile(std::string url,std::string filename, header_map headers);
-    int put(std::string url, std::string data, std::string* response, header_map headers);
-    int putfile(std::string url, std::string filename, std::string* response, header_map headers);
-    int simplepost(std::string url, std::string data, std::string * response, header_map headers);
-    int binarypost(std::string url, void* data, long int size, std::string* response, header_map headers);
-    int formpost(std::string url, std::vector<mime_part*> parts, std::string *response, header_map headers);
-
-    int c_get(std::string type, std::string url,std::string* response, header_map headers);
-    int c_getfile(std::string type, std::string url,std::string filename, header_map headers);
-    int c_put(std::string type, std::string url, std::string data, std::string* response, header_map headers);
-    int c_putfile(std::string type, std::string url, std::string filename, std::string* response, header_map headers);
-    int c_simplepost(std::string type, std::string url, std::string data, std::string * response, header_map headers);
-    int c_binarypost(std::string type, std::string url, void* data, long int size, std::string* response, header_map headers);
-    int c_formpost(std::string type, std::string url, std::vector<mime_part*> parts, std::string *response, header_map headers);
-
-    void enable_logging() { log_en = true; }
-    void disable_logging() {log_en = false; }
+    int get(std::string url,std::string* response, const header_map& headers);
+    int getfile(std::string url,std::string filename, const header_map& headers);
+    int getfile_parallel(std::string url, std::string filename, int segments, const header_map& headers);
+    int put(std::string url, std::string_view data, std::string* response, const header_map& headers);
+    int putfile(std::string url, std::string filename, std::string* response, const header_map& headers);
+    int simplepost(std::string url, std::string_view data, std::string * response, const header_map& headers);
+    int binarypost(std::string url, void* data, long int size, std::string* response, const header_map& headers);
+    int formpost(std::string url, const std::vector<mime_part*>& parts, std::string *response, const header_map& headers);
+
+    int c_get(std::string type, std::string url,std::string* response, const header_map& headers);
+    int c_getfile(std::string type, std::string url,std::string filename, const header_map& headers);
+    int c_put(std::string type, std::string url, std::string_view data, std::string* response, const header_map& headers);
+    int c_putfile(std::string type, std::string url, std::string filename, std::string* response, const header_map& headers);
+    int c_simplepost(std::string type, std::string url, std::string_view data, std::string * response, const header_map& headers);
+    int c_binarypost(std::string type, std::string url, void* data, long int size, std::string* response, const header_map& headers);
+    int c_formpost(std::string type, std::string url, const std::vector<mime_part*>& parts, std::string *response, const header_map& headers);
+
+    // same requests writing the body into a response_sink (see http_sink.hpp)
+    int get(std::string url,response_sink& sink, const header_map& headers);
+    int put(std::string url, std::string_view data, response_sink& sink, const header_map& headers);
+    int putfile(std::string url, std::string filename, response_sink& sink, const header_map& headers);
+    int simplepost(std::string url, std::string_view data, response_sink& sink, const header_map& headers);
+    int binarypost(std::string url, void* data, long int size, response_sink& sink, const header_map& headers);
+    int formpost(std::string url, const std::vector<mime_part*>& parts, response_sink& sink, const header_map& headers);
+    int c_get(std::string type, std::string url,response_sink& sink, const header_map& headers);
+    int c_put(std::string type, std::string url, std::string_view data, response_sink& sink, const header_map& headers);
+    int c_putfile(std::string type, std::string url, std::string filename, response_sink& sink, const header_map& headers);
+    int c_simplepost(std::string type, std::string url, std::string_view data, response_sink& sink, const header_map& headers);
+    int c_binarypost(std::string type, std::string url, void* data, long int size, response_sink& sink, const header_map& headers);
+    int c_formpost(std::string type, std::string url, const std::vector<mime_part*>& parts, response_sink& sink, const header_map& headers);
+
+    // a form built once (see http_mime.hpp), posted as often as needed
+    int formpost(std::string url, const mime_form& form, std::string* response = nullptr, const header_map& headers = header_map())
+    {
+        return formpost(url, form.get_parts(), response, headers);
+    }
+    int formpost(std::string url, const mime_form& form, response_sink& sink, const header_map& headers = header_map())
+    {
+        return formpost(url, form.get_parts(), sink, headers);
+    }
+    int c_formpost(std::string type, std::string url, const mime_form& form, std::string* response = nullptr, const header_map& headers = header_map())
+    {
+        return c_formpost(type, url, form.get_parts(), response, headers);
+    }
+    int c_formpost(std::string type, std::string url, const mime_form& form, response_sink& sink, const header_map& headers = header_map())
+    {
+        return c_formpost(type, url, form.get_parts(), sink, headers);
+    }
+
+    // replay a prepared_request (see http_prepared.hpp), body is ignored for GET and HEAD
+    int perform(prepared_request& req, std::string_view body, std::string* response);
+    int perform(prepared_request& req, std::string_view body, response_sink& sink);
+
+    // asynchronous requests, run on a curl_multi engine thread (see http_multi.hpp)
+    // callbacks are invoked on that thread, which also writes their log records
+    std::future<http_string_response> get_async(std::string url, const header_map& headers);
+    void get_async(std::string url, http_transfer::callback cb, const header_map& headers);
+    std::future<http_string_response> put_async(std::string url, std::string data, const header_map& headers);
+    void put_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers);
+    std::future<http_string_response> simplepost_async(std::string url, std::string data, const header_map& headers);
+    void simplepost_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers);
+    std::future<http_string_response> c_async(std::string type, std::string url, std::string data, const header_map& headers);
+    void c_async(std::string type, std::string url, std::string data, http_transfer::callback cb, const header_map& headers);
+
+#ifdef HTTP_COROUTINES
+    // coroutine requests, co_await them for the response (see http_coro.hpp); they run on
+    // the same engine as the *_async() calls
+    http_call co_get(std::string url, const header_map& headers);
+    http_call co_put(std::string url, std::string data, const header_map& headers);
+    http_call co_simplepost(std::string url, std::string data, const header_map& headers);
+    http_call co_formpost(std::string url, std::vector<mime_part*> parts, const header_map& headers);
+    // the form is read when the request starts, it must outlive the co_await; a temporary
+    // would be gone by then
+    http_call co_formpost(std::string url, const mime_form& form, const header_map& headers);
+    http_call co_formpost(std::string url, mime_form&& form, const header_map& headers = header_map()) = delete;
+    http_call c_co(std::string type, std::string url, std::string data, const header_map& headers);
+    // where co_*() calls resume unless they pick their own, null for the engine thread
+    void set_coro_executor(coro_executor e) { coro_exec = std::move(e); }
+#endif
+
+    // streaming: chunks go to h as they arrive, done gets status and headers with an empty body
+    http_stream get_stream(std::string url, stream_handler h, http_transfer::callback done, const header_map& headers);
+    http_stream c_stream(std::string type, std::string url, std::string data, stream_handler h, http_transfer::callback done, const header_map& headers);
+
+    void set_max_inflight(size_t n) { max_inflight = n; if (engine) engine->set_max_inflight(n); }
+    // opt-in HTTP/2: async requests to one origin are multiplexed as streams over a
+    // shared connection (h2c prior knowledge for http:// when prior_knowledge and libcurl
+    // is 8.0 or later, an Upgrade: h2c offer before; falling back to HTTP/1.1 per origin),
+    // blocking calls negotiate h2 over TLS
+    void enable_http2(bool prior_knowledge = true, long streams_per_conn = 100, long conns_per_host = 0)
+    {
+        h2 = true;
+        h2c = prior_knowledge;
+        h2_streams = streams_per_conn;
+        h2_conns = conns_per_host;
+        pool.set_http_version(CURL_HTTP_VERSION_2TLS);
+        if (engine)
+            engine->enable_http2(h2c, h2_streams, h2_conns);
+    }
+    // DNS, TLS session and connection caches shared with other clients, call before the first async request
+    void set_share(std::shared_ptr<http_share> s)
+    {
+        share = s;
+        pool.set_share(s ? s->handle() : nullptr);
+        if (engine)
+            engine->set_share(s ? s->handle() : nullptr);
+    }
+    // share an engine, e.g. one attached to the caller's event loop (see http_epoll.hpp)
+    void set_engine(std::shared_ptr<http_multi> e) { engine = e; }
+    // count every request in a registry, e.g. &http_metrics::global(), null turns it off
+    void set_metrics(http_metrics* m)
+    {
+        metrics = m;
+        if (engine)
+            engine->set_metrics(m);
+    }
+    // compressed responses (decoded before they reach the sink) and, built with
+    // HTTP_COMPRESSION and -lz, request bodies; see http_compress.hpp; call before the
+    // first async request
+    void set_compression(const compression_options& o)
+    {
+        zopts = o;
+        zen = true;
+        pool.set_accept_encoding(zopts.responses ? zopts.accept.c_str() : nullptr);
+        if (engine)
+            engine->set_accept_encoding(zopts.responses ? zopts.accept.c_str() : nullptr);
+    }
+    // answer get()/c_get("GET") from a response cache where HTTP caching rules allow it
+    // (see http_cache.hpp), null turns it off; a cache may be shared between clients
+    void set_cache(std::shared_ptr<http_cache> c) { cache = c; }
+    // identical idempotent get()/c_get() calls in flight at once, from this client or any
+    // other sharing f, go out once and share the response (see http_flight.hpp); the
+    // request runs on this client's async engine, null turns it off
+    void set_singleflight(std::shared_ptr<http_singleflight> f) { flight = f; }
+    // the response body shared as is, with coalescing the very buffer every waiter sees
+    http_singleflight::result_ptr get_shared(std::string url, const header_map& headers = header_map());
+    // per-host adaptive concurrency limit and rate cap for the blocking calls (see
+    // http_limit.hpp), null turns it off; share one limiter between clients so the
+    // limit covers all of them
+    void set_limiter(std::shared_ptr<http_limiter> l) { limiter = l; }
+    // slow get()/c_get() calls with an idempotent method are hedged, failed ones retried,
+    // all within a deadline (see http_hedge.hpp); null turns it off. Calls answered by
+    // the cache or by coalescing are not hedged, and the body reaches the sink only once
+    // the winning attempt is complete
+    void set_hedging(std::shared_ptr<hedge_policy> p) { hedging = p; }
+    // attempts, hedges and retries of the last hedged call
+    inline const hedge_report& last_hedge() const { return hreport; }
+    // how getfile() writes to disk: batch size, queue depth, O_DIRECT, fsync (see http_file.hpp)
+    void set_file_options(const file_sink_options& o) { file_opts = o; }
+
+    // HTTP status and timing breakdown of the last blocking call (see http_timing in http.hpp),
+    // responses of asynchronous calls carry their own
+    long last_status() const { return status; }
+    const http_timing& last_timing() const { return timing; }
+
+    void enable_logging()
+    {
+        if (!logs)
+            logs = std::make_shared<http_log>();
+        log_en = true;
+        if (engine)
+            engine->set_log(logs.get());
+    }
+    void disable_logging()
+    {
+        log_en = false;
+        if (engine)
+            engine->set_log(nullptr);
+    }
     const char* log_status() { return log_en ? "enabled" : "disabled"; }
-    std::string log() { return err; }
-    void free_log() { err.erase(); }
+    // records logged since the last call, formatted one per line; the log is a bounded
+    // ring per thread (see http_log.hpp), records that did not fit are counted, not kept
+    std::string log() { return logs ? logs->text() : std::string(); }
+    void free_log() { if (logs) logs->discard(); }
+    // log into a logger shared with other clients, e.g. http_log::global() behind a
+    // no-op deleter; null gives the client a fresh log of its own
+    void set_log(std::shared_ptr<http_log> l)
+    {
+        logs = l ? l : std::make_shared<http_log>();
+        if (engine)
+            engine->set_log(log_en ? logs.get() : nullptr);
+        if (tracing)
+            enable_tracing(true);
+    }
+    // libcurl's verbose trace into the log as well, through CURLOPT_DEBUGFUNCTION
+    void enable_tracing(bool on = true)
+    {
+        tracing = on;
+        if (on && !logs)
+            logs = std::make_shared<http_log>();
+        pool.set_debug(on ? http_log::debug : nullptr, on ? logs.get() : nullptr);
+    }
+
+    // connection reuse, see http_pool.hpp
+    void set_pool_size(size_t n) { pool.set_size(n); }
+    void set_idle_timeout(long secs) { pool.set_idle_timeout(secs); }
+    void set_max_age(long secs) { pool.set_max_age(secs); }
+    // connect and whole transfer timeouts of the blocking calls in milliseconds, 0 for none
+    void set_timeouts(long connect_ms, long total_ms) { pool.set_timeouts(connect_ms, total_ms); }
 };
 
-int http_client::get(std::string url, std::string* response = nullptr, header_map headers = header_map())
+int http_client::get(std::string url, std::string* response = nullptr, const header_map& headers = header_map())
 {
-    if(log_en) err += "get() :\n";
+    string_sink sink(response);
+    return get(url, sink, headers);
+}
+
+int http_client::get(std::string url, response_sink& sink, const header_map& headers = header_map())
+{
+    if (cache)
+        return cached_get("get", "GET", url, sink, headers);
+    if (flight)
+    {
+        http_singleflight::result_ptr r = coalesce("GET", url, headers);
+        return r->result != CURLE_OK ? (int)r->result : (int)deliver(sink, *r->body);
+    }
+    if (hedging)
+        return hedged_get("get", "GET", url, sink, headers);
+
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("get", "GET", url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
-    }
+    attach_sink(hdl, sink);
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("get", hdl, "GET", url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
 
     return (int)res;
 }
 
-int http_client::c_get(std::string type, std::string url, std::string* response = nullptr, header_map headers = header_map())
+int http_client::c_get(std::string type, std::string url, std::string* response = nullptr, const header_map& headers = header_map())
 {
-    if(log_en) err += "get() :\n";
+    string_sink sink(response);
+    return c_get(type, url, sink, headers);
+}
+
+int http_client::c_get(std::string type, std::string url, response_sink& sink, const header_map& headers = header_map())
+{
+    if (cache && type == "GET")
+        return cached_get("c_get", type, url, sink, headers);
+    if (flight && http_singleflight::idempotent(type))
+    {
+        http_singleflight::result_ptr r = coalesce(type, url, headers);
+        return r->result != CURLE_OK ? (int)r->result : (int)deliver(sink, *r->body);
+    }
+    if (hedging && hedge_policy::idempotent(type))
+        return hedged_get("c_get", type, url, sink, headers);
+
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("c_get", type, url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
-    }
+    attach_sink(hdl, sink);
     curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
+    if (type == "HEAD")
+        curl_easy_setopt(hdl, CURLOPT_NOBODY, 1L);
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("c_get", hdl, type, url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
+
+    return (int)res;
+}
+
+int http_client::cached_get(const char* op, const std::string& type, const std::string& url, response_sink& sink, const header_map& headers)
+{
+    bool no_store, no_cache;
+    http_cache::request_directives(headers, no_store, no_cache);
+    http_cache::entry_ptr hit = no_store ? nullptr : cache->lookup(url, headers);
+    if (hit && !no_cache && hit->fresh(time(nullptr)))
+    {
+        cache->count(CACHE_HIT);
+        status = hit->status;
+        timing = http_timing();
+        return deliver(sink, hit->body);
+    }
+
+    // a stale entry is revalidated, the server answers 304 when it still holds
+    const header_map* req = &headers;
+    header_map conditional;
+    if (hit && hit->validatable())
+    {
+        conditional = headers;
+        if (!hit->etag.empty())
+            conditional["If-None-Match"] = hit->etag;
+        if (!hit->last_modified.empty())
+            conditional["If-Modified-Since"] = hit->last_modified;
+        req = &conditional;
+    }
+
+    // the round trip, shared with identical requests in flight when coalescing
+    CURLcode res;
+    header_block received;
+    std::shared_ptr<const std::string> body;
+    bool over;
+    if (flight)
+    {
+        http_singleflight::result_ptr r = coalesce(type, url, *req);
+        res = r->result;
+        received = r->headers;
+        body = r->body;
+        over = body->size() > cache->entry_limit();
+        if (res == CURLE_OK && status != 304)
+            res = deliver(sink, *body);
+    }
+    else
+    {
+        // handle initialization
+        CURL* hdl = pool.acquire(url);
+        if (!hdl)
+        {
+            note(op, type, url, CURL_BAD_HANDLE);
+            return CURL_BAD_HANDLE;
+        }
+
+        // option setting
+        cache_capture cap(sink, cache->entry_limit());
+        curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
+        if (type != "GET")
+            curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
+        cap.begin();
+        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
+        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, (response_sink*)&cap);
+        curl_easy_setopt(hdl, CURLOPT_HEADERFUNCTION, cache_header);
+        curl_easy_setopt(hdl, CURLOPT_HEADERDATA, &cap);
+        curl_slist* hds = bna_hds(hdl, *req);
+
+        // perform
+        res = easy_perform(hdl, url);
+        record(op, hdl, type, url, res);
+
+        // cleanup
+        curl_slist_free_all(hds);
+        pool.release(hdl, url);
+
+        received = std::move(cap.headers);
+        body = std::make_shared<const std::string>(std::move(cap.body));
+        over = cap.over;
+    }
+
+    if (res != CURLE_OK)
+        return (int)res;
+    if (status == 304 && hit)
+    {
+        cache->count(CACHE_REVALIDATED);
+        http_cache::entry_ptr e = cache->refresh(hit, received);
+        status = e->status;
+        return deliver(sink, e->body);
+    }
+    cache->count(CACHE_MISS);
+    if (over)
+        cache->invalidate(url);
+    else if (!no_store)
+        cache->store(url, headers, status, received, body);
 
     return (int)res;
 }
 
-int http_client::getfile(std::string url, std::string filename, header_map headers = header_map())
+http_singleflight::result_ptr http_client::get_shared(std::string url, const header_map& headers)
+{
+    if (flight && !cache)
+        return coalesce("GET", url, headers);
+    auto r = std::make_shared<flight_result>();
+    std::string body;
+    string_sink sink(&body);
+    r->result = (CURLcode)get(url, sink, headers);
+    r->status = status;
+    r->timing = timing;
+    r->body = std::make_shared<const std::string>(std::move(body));
+    return r;
+}
+
+int http_client::hedged_get(const char* op, const std::string& type, const std::string& url, response_sink& sink, const header_map& headers)
+{
+    typedef std::chrono::steady_clock clock;
+    struct attempt
+    {
+        CURL* hdl = nullptr;
+        std::string url;
+        std::string body;
+        string_sink out;
+        curl_slist* hds = nullptr;
+        limit_permit permit;
+        clock::time_point start;
+        bool hedge = false;
+        CURLcode res = CURLE_OK;
+        long status = 0;
+        attempt() : out(&body) {}
+    };
+    typedef std::unique_ptr<attempt> attempt_ptr;
+
+    const hedge_options& o = hedging->options();
+    CURLM* m = hmulti.get();
+    clock::time_point deadline = o.deadline_ms > 0 ? clock::now() + std::chrono::milliseconds(o.deadline_ms) : clock::time_point::max();
+    std::vector<attempt_ptr> live;
+    attempt_ptr last;                   // the answer, or the latest failure
+    hreport = hedge_report();
+    hedging->begin_call();
+
+    // an attempt's handle goes back to the pool as soon as it is over, cancelled or not
+    auto drop = [this, m](attempt_ptr& a) {
+        curl_multi_remove_handle(m, a->hdl);
+        curl_slist_free_all(a->hds);
+        pool.release(a->hdl, a->url);
+        a.reset();
+    };
+    auto launch = [&](std::string target, bool hedge) -> int {
+        attempt_ptr a(new attempt());
+        // a hedge is extra load, it only goes out when the limiter has room right away
+        if (limiter)
+        {
+            a->permit = hedge ? limiter->try_acquire(target) : limiter->acquire(target);
+            if (!a->permit)
+                return CURL_LIMITED;
+        }
+        a->hdl = pool.acquire(target);
+        if (!a->hdl)
+            return CURL_BAD_HANDLE;
+        a->url = std::move(target);
+        a->hedge = hedge;
+        curl_easy_setopt(a->hdl, CURLOPT_URL, a->url.c_str());
+        if (type != "GET")
+            curl_easy_setopt(a->hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
+        if (type == "HEAD")
+            curl_easy_setopt(a->hdl, CURLOPT_NOBODY, 1L);
+        attach_sink(a->hdl, a->out);
+        a->hds = bna_hds(a->hdl, headers);
+        if (deadline != clock::time_point::max())
+        {
+            long left = (long)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+            if (pool.timeout() <= 0 || left < pool.timeout())
+                curl_easy_setopt(a->hdl, CURLOPT_TIMEOUT_MS, std::max(1L, left));
+        }
+        a->start = clock::now();
+        curl_multi_add_handle(m, a->hdl);
+        live.push_back(std::move(a));
+        hreport.attempts++;
+        return CURLE_OK;
+    };
+
+    for (int round = 0;; round++)
+    {
+        int rc = launch(url, false);
+        if (rc != CURLE_OK && !last)
+        {
+            note(op, type, url, rc);
+            return rc;
+        }
+        // a retry that cannot go out leaves the earlier failure as the answer
+        if (rc != CURLE_OK)
+        {
+            hedging->refund(false);
+            hreport.retries--;
+            break;
+        }
+        clock::time_point hedge_at = o.max_hedges > 0 ? clock::now() + std::chrono::microseconds(hedging->delay_us()) : clock::time_point::max();
+        int hedged = 0;
+        bool won = false;
+        while (!live.empty() && !won)
+        {
+            int running;
+            curl_multi_perform(m, &running);
+            CURLMsg* msg;
+            int queued;
+            while (!won && (msg = curl_multi_info_read(m, &queued)))
+            {
+                if (msg->msg != CURLMSG_DONE)
+                    continue;
+                auto it = std::find_if(live.begin(), live.end(), [msg](const attempt_ptr& a) { return a->hdl == msg->easy_handle; });
+                if (it == live.end())
+                    continue;
+                attempt_ptr a = std::move(*it);
+                live.erase(it);
+                curl_multi_remove_handle(m, a->hdl);
+                a->res = msg->data.result;
+                curl_easy_getinfo(a->hdl, CURLINFO_RESPONSE_CODE, &a->status);
+                if (a->permit)
+                {
+                    curl_off_t ttfb = 0;
+                    curl_easy_getinfo(a->hdl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+                    a->permit.done(http_limiter::healthy(a->res, a->status), (long)ttfb);
+                }
+                won = !hedge_policy::retryable(a->res, a->status);
+                if (won)
+                    hedging->observe((long)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - a->start).count());
+                if (last)
+                    drop(last);
+                last = std::move(a);
+            }
+            if (won)
+                break;
+
+            clock::time_point now = clock::now();
+            if (now >= deadline)
+            {
+                hreport.deadline = true;
+                break;
+            }
+            if (now >= hedge_at && !live.empty())
+            {
+                hedge_at = clock::time_point::max();
+                if (!hedging->spend(true))
+                    hreport.denied = true;
+                else if (launch(hedging->hedge_url(url), true) == CURLE_OK)
+                {
+                    hreport.hedges++;
+                    if (++hedged < o.max_hedges)
+                        hedge_at = now + std::chrono::microseconds(hedging->delay_us());
+                }
+                else
+                    hedging->refund(true);
+            }
+            if (live.empty())
+                break;
+            clock::time_point wake = std::min(hedge_at, deadline);
+            long wait = wake == clock::time_point::max() ? 1000 :
+                        (long)std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+            curl_multi_poll(m, nullptr, 0, (int)std::min(1000L, wait), nullptr);
+        }
+        // the first usable answer wins, whatever is still running is cancelled
+        for (auto& a : live)
+            drop(a);
+        live.clear();
+
+        if (won || hreport.deadline || round >= o.max_retries)
+            break;
+        long pause = hedging->backoff_us(round + 1);
+        if (clock::now() + std::chrono::microseconds(pause) >= deadline)
+            break;
+        if (!hedging->spend(false))
+        {
+            hreport.denied = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(pause));
+        hreport.retries++;
+    }
+
+    if (!last)
+    {
+        // out of time before any attempt had finished
+        note(op, type, url, CURLE_OPERATION_TIMEDOUT);
+        status = 0;
+        timing = http_timing();
+        return CURLE_OPERATION_TIMEDOUT;
+    }
+    CURLcode res = hreport.deadline && hedge_policy::retryable(last->res, last->status) ? CURLE_OPERATION_TIMEDOUT : last->res;
+    record(op, last->hdl, type, last->url, res);
+    hreport.url = last->url;
+    hreport.hedge_won = last->hedge;
+    if (last->hedge)
+        hedging->count_hedge_win();
+    if (res == CURLE_OK)
+        res = deliver(sink, last->body);
+    drop(last);
+    return (int)res;
+}
+
+int http_client::getfile(std::string url, std::string filename, const header_map& headers = header_map())
 {
-    if(log_en) err += "getfile() :\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("getfile", "GET", url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
-    // opening file
-    std::ofstream file;
-    file.open(filename);
-    if ( !file )
+    // opening file, written asynchronously in large batches (see http_file.hpp)
+    file_sink file(filename, file_opts);
+    if ( !file.valid() )
     {
-        if(log_en) err += "Error in opening file\n\n";
+        note("getfile", "GET", url, CURL_FILE_ERR);
+        pool.release(hdl, url);
         return CURL_FILE_ERR;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, writef);
-    curl_easy_setopt(hdl, CURLOPT_WRITEDATA, &file);
+    attach_sink(hdl, file);
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("getfile", hdl, "GET", url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
-    file.close();
+    pool.release(hdl, url);
+    if (file.finish() != 0)
+    {
+        note("getfile", "GET", url, CURL_FILE_ERR);
+        return CURL_FILE_ERR;
+    }
 
     return (int)res;
 }
 
-int http_client::c_getfile(std::string type, std::string url, std::string filename, header_map headers = header_map())
+int http_client::getfile_parallel(std::string url, std::string filename, int segments = 4, const header_map& headers = header_map())
+{
+    // the probe and every segment go through the pool, each transfer is recorded
+    segmented_download dl(url, filename, headers, segments);
+    dl.set_pool(pool);
+    dl.set_observer([&](const char* method, CURL* hdl, CURLcode rc) { record("getfile_parallel", hdl, method, url, rc); });
+    int res = dl.run();
+    if (res == CURL_NO_RANGES)
+    {
+        // no size or no range support, a single stream it is
+        note("getfile_parallel", "GET", url, CURL_NO_RANGES);
+        return getfile(url, filename, headers);
+    }
+    note("getfile_parallel", "GET", url, res);
+
+    return res;
+}
+
+int http_client::c_getfile(std::string type, std::string url, std::string filename, const header_map& headers = header_map())
 {
-    if(log_en) err += "getfile() :\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("c_getfile", type, url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
-    // opening file
-    std::ofstream file;
-    file.open(filename);
-    if ( !file )
+    // opening file, written asynchronously in large batches (see http_file.hpp)
+    file_sink file(filename, file_opts);
+    if ( !file.valid() )
     {
-        if(log_en) err += "Error in opening file\n\n";
+        note("c_getfile", type, url, CURL_FILE_ERR);
+        pool.release(hdl, url);
         return CURL_FILE_ERR;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, writef);
-    curl_easy_setopt(hdl, CURLOPT_WRITEDATA, &file);
+    attach_sink(hdl, file);
     curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("c_getfile", hdl, type, url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
-    file.close();
+    pool.release(hdl, url);
+    if (file.finish() != 0)
+    {
+        note("c_getfile", type, url, CURL_FILE_ERR);
+        return CURL_FILE_ERR;
+    }
 
     return (int)res;
 }
 
-int http_client::put(std::string url, std::string data, std::string* response = nullptr, header_map headers = header_map())
+int http_client::put(std::string url, std::string_view data, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return put(url, data, sink, headers);
+}
+
+int http_client::put(std::string url, std::string_view data, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "put()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("put", "PUT", url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
-    // stringstream for readfunction
-    std::stringstream ss(data);
-
+    // view for readfunction, advanced as libcurl pulls the body
+    std::string_view body = data;
+    deflated_body z;
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
+    attach_sink(hdl, sink);
+    const char* enc = attach_deflated(hdl, data, headers, z, true);
+    if (!enc)
     {
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
+        curl_easy_setopt(hdl, CURLOPT_READFUNCTION, read);
+        curl_easy_setopt(hdl, CURLOPT_READDATA, &body);
+        curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)data.size());
+        curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
     }
-    curl_easy_setopt(hdl, CURLOPT_READFUNCTION, read);
-    curl_easy_setopt(hdl, CURLOPT_READDATA, &ss);
-    curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, data.size());
-    curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
-    curl_slist* hds = bna_hds(hdl, headers);
+    curl_slist* hds = bna_hds(hdl, headers, enc);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("put", hdl, "PUT", url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
 
     return (int)res;
 }
 
-int http_client::c_put(std::string type, std::string url, std::string data, std::string* response = nullptr, header_map headers = header_map())
+int http_client::c_put(std::string type, std::string url, std::string_view data, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return c_put(type, url, data, sink, headers);
+}
+
+int http_client::c_put(std::string type, std::string url, std::string_view data, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "put()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("c_put", type, url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
-    // stringstream for readfunction
-    std::stringstream ss(data);
-
+    // view for readfunction, advanced as libcurl pulls the body
+    std::string_view body = data;
+    deflated_body z;
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
+    attach_sink(hdl, sink);
+    const char* enc = attach_deflated(hdl, data, headers, z, true);
+    if (!enc)
     {
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
+        curl_easy_setopt(hdl, CURLOPT_READFUNCTION, read);
+        curl_easy_setopt(hdl, CURLOPT_READDATA, &body);
+        curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)data.size());
+        curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
     }
-    curl_easy_setopt(hdl, CURLOPT_READFUNCTION, read);
-    curl_easy_setopt(hdl, CURLOPT_READDATA, &ss);
-    curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, data.size());
-    curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
     curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
-    curl_slist* hds = bna_hds(hdl, headers);
+    curl_slist* hds = bna_hds(hdl, headers, enc);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("c_put", hdl, type, url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
 
     return (int)res;
 }
 
-int http_client::putfile(std::string url, std::string filename, std::string* response = nullptr, header_map headers = header_map())
+int http_client::putfile(std::string url, std::string filename, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return putfile(url, filename, sink, headers);
+}
+
+int http_client::putfile(std::string url, std::string filename, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "putfile()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("putfile", "PUT", url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // file handling for file to PUT
-    FILE* file = fopen(filename.c_str(), "rb");
-    struct stat fileinfo;
-    stat(filename.c_str(), &fileinfo);
-    curl_off_t filesz = fileinfo.st_size;
+    mapped_file map(filename);
+    mapped_reader reader{&map};
+    FILE* file = nullptr;
+    if (!attach_file(hdl, filename, map, reader, file))
+    {
+        note("putfile", "PUT", url, CURL_FILE_ERR);
+        pool.release(hdl, url);
+        return CURL_FILE_ERR;
+    }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
-    }
-    curl_easy_setopt(hdl, CURLOPT_READFUNCTION, readf);
-    curl_easy_setopt(hdl, CURLOPT_READDATA, file);
-    curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, filesz);
+    attach_sink(hdl, sink);
     curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("putfile", hdl, "PUT", url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
-    fclose(file);
+    pool.release(hdl, url);
+    if (file)
+        fclose(file);
 
     return (int)res;
 }
 
-int http_client::c_putfile(std::string type, std::string url, std::string filename, std::string* response = nullptr, header_map headers = header_map())
+int http_client::c_putfile(std::string type, std::string url, std::string filename, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return c_putfile(type, url, filename, sink, headers);
+}
+
+int http_client::c_putfile(std::string type, std::string url, std::string filename, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "putfile()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("c_putfile", type, url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // file handling for file to PUT
-    FILE* file = fopen(filename.c_str(), "rb");
-    struct stat fileinfo;
-    stat(filename.c_str(), &fileinfo);
-    curl_off_t filesz = fileinfo.st_size;
+    mapped_file map(filename);
+    mapped_reader reader{&map};
+    FILE* file = nullptr;
+    if (!attach_file(hdl, filename, map, reader, file))
+    {
+        note("c_putfile", type, url, CURL_FILE_ERR);
+        pool.release(hdl, url);
+        return CURL_FILE_ERR;
+    }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
-    }
-    curl_easy_setopt(hdl, CURLOPT_READFUNCTION, readf);
-    curl_easy_setopt(hdl, CURLOPT_READDATA, file);
-    curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, filesz);
+    attach_sink(hdl, sink);
     curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
     curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("c_putfile", hdl, type, url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
-    fclose(file);
+    pool.release(hdl, url);
+    if (file)
+        fclose(file);
 
     return (int)res;
 }
 
-int http_client::simplepost(std::string url, std::string data, std::string * response = nullptr, header_map headers = header_map())
+int http_client::simplepost(std::string url, std::string_view data, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return simplepost(url, data, sink, headers);
+}
+
+int http_client::simplepost(std::string url, std::string_view data, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "simplepost()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("simplepost", "POST", url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
+    attach_sink(hdl, sink);
+    deflated_body z;
+    const char* enc = attach_deflated(hdl, data, headers, z, false);
+    if (!enc)
+    {
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)data.size());
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data.data() ? data.data() : "");
     }
-    curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data.c_str());
 
-    curl_slist* hds = bna_hds(hdl, headers);
+    curl_slist* hds = bna_hds(hdl, headers, enc);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("simplepost", hdl, "POST", url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
 
     return (int)res;
 }
 
-int http_client::c_simplepost(std::string type, std::string url, std::string data, std::string * response = nullptr, header_map headers = header_map())
+int http_client::c_simplepost(std::string type, std::string url, std::string_view data, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return c_simplepost(type, url, data, sink, headers);
+}
+
+int http_client::c_simplepost(std::string type, std::string url, std::string_view data, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "simplepost()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("c_simplepost", type, url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
+    attach_sink(hdl, sink);
+    deflated_body z;
+    const char* enc = attach_deflated(hdl, data, headers, z, false);
+    if (!enc)
+    {
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)data.size());
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data.data() ? data.data() : "");
     }
-    curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data.c_str());
     curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
 
-    curl_slist* hds = bna_hds(hdl, headers);
+    curl_slist* hds = bna_hds(hdl, headers, enc);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("c_simplepost", hdl, type, url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
 
     return (int)res;
 }
 
-int http_client::binarypost(std::string url, void* data, long int size, std::string* response = nullptr, header_map headers = header_map())
+int http_client::binarypost(std::string url, void* data, long int size, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return binarypost(url, data, size, sink, headers);
+}
+
+int http_client::binarypost(std::string url, void* data, long int size, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "binarypost()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("binarypost", "POST", url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
+    attach_sink(hdl, sink);
+    deflated_body z;
+    const char* enc = attach_deflated(hdl, std::string_view((const char*)data, size > 0 ? size : 0), headers, z, false);
+    if (!enc)
+    {
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data);
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE, size);
     }
-    curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data);
-    curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE, size);
 
-    curl_slist* hds = bna_hds(hdl, headers);
+    curl_slist* hds = bna_hds(hdl, headers, enc);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("binarypost", hdl, "POST", url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
 
     return (int)res;    
 }
 
-int http_client::c_binarypost(std::string type, std::string url, void* data, long int size, std::string* response = nullptr, header_map headers = header_map())
+int http_client::c_binarypost(std::string type, std::string url, void* data, long int size, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return c_binarypost(type, url, data, size, sink, headers);
+}
+
+int http_client::c_binarypost(std::string type, std::string url, void* data, long int size, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "binarypost()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("c_binarypost", type, url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
+    attach_sink(hdl, sink);
+    deflated_body z;
+    const char* enc = attach_deflated(hdl, std::string_view((const char*)data, size > 0 ? size : 0), headers, z, false);
+    if (!enc)
+    {
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data);
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE, size);
     }
-    curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data);
-    curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE, size);
     curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
 
-    curl_slist* hds = bna_hds(hdl, headers);
+    curl_slist* hds = bna_hds(hdl, headers, enc);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("c_binarypost", hdl, type, url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
 
     return (int)res;    
 }
 
-int http_client::formpost(std::string url, std::vector<mime_part*> parts, std::string *response = nullptr, header_map headers = header_map())
+int http_client::formpost(std::string url, const std::vector<mime_part*>& parts, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return formpost(url, parts, sink, headers);
+}
+
+int http_client::formpost(std::string url, const std::vector<mime_part*>& parts, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "formpost()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("formpost", "POST", url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
-    }
-
-    curl_mime* mpf = curl_mime_init(hdl);
-    for (auto p : parts)
-    {   
-        curl_mimepart* part = curl_mime_addpart(mpf);
-        
-        curl_slist* d_hds = NULL;
-        if (!p->get_headers().empty())
-        {
-            for(auto h : p->get_headers())
-            {
-                std::string header = h.first + ":" + h.second;
-                d_hds = curl_slist_append(d_hds, header.c_str());
-            }
-            curl_mime_headers(part, d_hds, true);
-        }
-
-        if ( p->dtype() == MIME_STRING )
-        {
-            mime_string_part* cp = (mime_string_part*) p;
-            curl_mime_name(part, cp->get_field().c_str());
-            curl_mime_data(part, cp->get_data().c_str(), CURL_ZERO_TERMINATED);
-        }
-        else
-        {
-            mime_file_part* cp = (mime_file_part*) p;
-            curl_mime_name(part, cp->get_field().c_str());
-            curl_mime_filename(part, cp->get_remote().c_str());
-            curl_mime_filedata(part, cp->get_path().c_str());
-        }
-    }
+    attach_sink(hdl, sink);
 
+    curl_mime* mpf = build_mime(hdl, parts);
     curl_easy_setopt(hdl, CURLOPT_MIMEPOST, mpf);
 
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("formpost", hdl, "POST", url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
     curl_mime_free(mpf);
 
     return (int)res;    
 }
 
-int http_client::c_formpost(std::string type, std::string url, std::vector<mime_part*> parts, std::string *response = nullptr, header_map headers = header_map())
+int http_client::c_formpost(std::string type, std::string url, const std::vector<mime_part*>& parts, std::string* response = nullptr, const header_map& headers = header_map())
+{
+    string_sink sink(response);
+    return c_formpost(type, url, parts, sink, headers);
+}
+
+int http_client::c_formpost(std::string type, std::string url, const std::vector<mime_part*>& parts, response_sink& sink, const header_map& headers = header_map())
 {
-    if(log_en) err += "formpost()\n";
     // handle initialization
-    CURL* hdl = curl_easy_init();
+    CURL* hdl = pool.acquire(url);
     if (!hdl)
     {
-        if(log_en) err += "Error in handle initialization\n\n";
+        note("c_formpost", type, url, CURL_BAD_HANDLE);
         return CURL_BAD_HANDLE;
     }
 
     // option setting
     curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
-    if (response)
-    {    
-        curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write);
-        curl_easy_setopt(hdl, CURLOPT_WRITEDATA, response);
-    }
-
-    curl_mime* mpf = curl_mime_init(hdl);
-    for (auto p : parts)
-    {   
-        curl_mimepart* part = curl_mime_addpart(mpf);
-        
-        curl_slist* d_hds = NULL;
-        if (!p->get_headers().empty())
-        {
-            for(auto h : p->get_headers())
-            {
-                std::string header = h.first + ":" + h.second;
-                d_hds = curl_slist_append(d_hds, header.c_str());
-            }
-            curl_mime_headers(part, d_hds, true);
-        }
-
-        if ( p->dtype() == MIME_STRING )
-        {
-            mime_string_part* cp = (mime_string_part*) p;
-            curl_mime_name(part, cp->get_field().c_str());
-            curl_mime_data(part, cp->get_data().c_str(), CURL_ZERO_TERMINATED);
-        }
-        else
-        {
-            mime_file_part* cp = (mime_file_part*) p;
-            curl_mime_name(part, cp->get_field().c_str());
-            curl_mime_filename(part, cp->get_remote().c_str());
-            curl_mime_filedata(part, cp->get_path().c_str());
-        }
-    }
+    attach_sink(hdl, sink);
 
+    curl_mime* mpf = build_mime(hdl, parts);
     curl_easy_setopt(hdl, CURLOPT_MIMEPOST, mpf);
     curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, type.c_str());
 
     curl_slist* hds = bna_hds(hdl, headers);
 
     // perform
-    CURLcode res = curl_easy_perform(hdl);
-    if(log_en) err += curl_easy_strerror(res);
-    if(log_en) err += "\n\n";
+    CURLcode res = easy_perform(hdl, url);
+    record("c_formpost", hdl, type, url, res);
 
     // cleanup
     curl_slist_free_all(hds);
-    curl_easy_cleanup(hdl);
+    pool.release(hdl, url);
     curl_mime_free(mpf);
 
     return (int)res;    
 }
+
+std::future<http_string_response> http_client::get_async(std::string url, const header_map& headers = header_map())
+{
+    return submit_async("GET", url, std::string(), headers);
+}
+
+void http_client::get_async(std::string url, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    submit_async("GET", url, std::string(), cb, headers);
+}
+
+std::future<http_string_response> http_client::put_async(std::string url, std::string data, const header_map& headers = header_map())
+{
+    return submit_async("PUT", url, std::move(data), headers);
+}
+
+void http_client::put_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    submit_async("PUT", url, std::move(data), cb, headers);
+}
+
+std::future<http_string_response> http_client::simplepost_async(std::string url, std::string data, const header_map& headers = header_map())
+{
+    return submit_async("POST", url, std::move(data), headers);
+}
+
+void http_client::simplepost_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    submit_async("POST", url, std::move(data), cb, headers);
+}
+
+std::future<http_string_response> http_client::c_async(std::string type, std::string url, std::string data = std::string(), const header_map& headers = header_map())
+{
+    return submit_async(type, url, std::move(data), headers);
+}
+
+void http_client::c_async(std::string type, std::string url, std::string data, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    submit_async(type, url, std::move(data), cb, headers);
+}
+
+#ifdef HTTP_COROUTINES
+http_call http_client::co_get(std::string url, const header_map& headers = header_map())
+{
+    return make_call(make_transfer("GET", std::move(url), std::string(), nullptr, headers));
+}
+
+http_call http_client::co_put(std::string url, std::string data, const header_map& headers = header_map())
+{
+    return make_call(make_transfer("PUT", std::move(url), std::move(data), nullptr, headers));
+}
+
+http_call http_client::co_simplepost(std::string url, std::string data, const header_map& headers = header_map())
+{
+    return make_call(make_transfer("POST", std::move(url), std::move(data), nullptr, headers));
+}
+
+http_call http_client::co_formpost(std::string url, std::vector<mime_part*> parts, const header_map& headers = header_map())
+{
+    http_transfer* t = new http_transfer("POST", std::move(url), headers, std::string(), nullptr);
+    t->form = [parts = std::move(parts)](CURL* hdl) { return build_mime(hdl, parts); };
+    return make_call(t);
+}
+
+http_call http_client::co_formpost(std::string url, const mime_form& form, const header_map& headers = header_map())
+{
+    http_transfer* t = new http_transfer("POST", std::move(url), headers, std::string(), nullptr);
+    t->form = [&form](CURL* hdl) { return build_mime(hdl, form.get_parts()); };
+    return make_call(t);
+}
+
+http_call http_client::c_co(std::string type, std::string url, std::string data = std::string(), const header_map& headers = header_map())
+{
+    return make_call(make_transfer(std::move(type), std::move(url), std::move(data), nullptr, headers));
+}
+#endif
+
+int http_client::perform(prepared_request& req, std::string_view body = std::string_view(), std::string* response = nullptr)
+{
+    string_sink sink(response);
+    return perform(req, body, sink);
+}
+
+int http_client::perform(prepared_request& req, std::string_view body, response_sink& sink)
+{
+    if (!req.valid())
+    {
+        note("perform", req.method(), req.url(), CURLE_URL_MALFORMAT);
+        return CURLE_URL_MALFORMAT;
+    }
+
+    // handle initialization
+    CURL* hdl = pool.acquire(req.origin());
+    if (!hdl)
+    {
+        note("perform", req.method(), req.url(), CURL_BAD_HANDLE);
+        return CURL_BAD_HANDLE;
+    }
+
+    // option setting, the header list and url come prebuilt
+    req.apply(hdl);
+    attach_sink(hdl, sink);
+    std::string_view rest = body;
+    if (req.method() == "PUT")
+    {
+        curl_easy_setopt(hdl, CURLOPT_READFUNCTION, read);
+        curl_easy_setopt(hdl, CURLOPT_READDATA, &rest);
+        curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)body.size());
+        curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
+    }
+    else if (req.method() == "POST" || (req.method() != "GET" && req.method() != "HEAD" && !body.empty()))
+    {
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body.size());
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, body.data() ? body.data() : "");
+    }
+
+    // perform
+    CURLcode res = easy_perform(hdl, req.url());
+    record("perform", hdl, req.method(), req.url(), res);
+
+    // cleanup
+    pool.release(hdl, req.origin());
+
+    return (int)res;
+}
+
+http_stream http_client::get_stream(std::string url, stream_handler h, http_transfer::callback done = nullptr, const header_map& headers = header_map())
+{
+    return async_engine().submit(new http_transfer("GET", std::move(url), headers, std::string(), std::move(done)), std::move(h));
+}
+
+http_stream http_client::c_stream(std::string type, std::string url, std::string data, stream_handler h, http_transfer::callback done = nullptr, const header_map& headers = header_map())
+{
+    return async_engine().submit(new http_transfer(std::move(type), std::move(url), headers, std::move(data), std::move(done)), std::move(h));
+}
+
+#endif
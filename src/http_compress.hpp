@@ -0,0 +1,164 @@
+#ifndef __HTTP_COMPRESS_HPP__
+#define __HTTP_COMPRESS_HPP__
+
+#include <curl/curl.h>
+#ifdef HTTP_COMPRESSION
+#include <zlib.h>
+#endif
+#include <string>
+#include <string_view>
+#include <optional>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+// ** content-encoding for responses and request bodies ** //
+
+// Responses: the Accept-Encoding header is sent and libcurl decodes the body
+// as it streams in, so sinks and stream handlers only ever see plain bytes
+// (gzip, deflate, and br / zstd when libcurl was built with them). Request
+// bodies past a size threshold are compressed only when it pays: the first
+// probe bytes are deflated into a buffer capped at what a min_saving gain
+// allows, and a body that does not fit goes out as is, with Content-Length.
+// A body no larger than the probe is sent from that buffer, with its
+// compressed Content-Length; a larger one is deflated on the fly inside the
+// read callback, straight into libcurl's send buffer, and goes out chunked.
+// A body the caller gave a Content-Encoding of its own is left alone.
+//
+// Request compression needs zlib and is opt-in: define HTTP_COMPRESSION
+// before including the client and link with -lz. Without it min_body is
+// ignored and bodies always go out as they are; responses are still
+// negotiated and decoded, that is libcurl's job.
+
+struct compression_options
+{
+    bool responses = true;          // ask for compressed responses
+    std::string accept;             // Accept-Encoding, empty for everything libcurl can decode
+    size_t min_body = 0;            // compress request bodies of at least this many bytes, 0 never
+    int level = -1;                 // 1 (fast) .. 9 (small), -1 zlib's default
+    bool gzip = true;               // gzip framing, else zlib ("deflate")
+    double min_saving = 0.1;        // share of the body deflating has to save to be used
+    size_t probe = 16 << 10;        // bytes deflated up front to judge that
+
+    inline const char* encoding() const { return gzip ? "gzip" : "deflate"; }
+    inline bool compress(size_t body) const { return min_body && body >= min_body; }
+};
+
+#ifdef HTTP_COMPRESSION
+
+// request body compressed as libcurl pulls it, use read() as the CURLOPT_READFUNCTION
+class deflate_reader
+{
+    z_stream zs = {};
+    std::string_view in;
+    bool ok = false;
+    bool done = false;
+
+public:
+    deflate_reader(std::string_view body, int level, bool gzip) : in(body)
+    {
+        ok = deflateInit2(&zs, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    deflate_reader(const deflate_reader&) = delete;             // zlib's state points back at zs
+    deflate_reader& operator=(const deflate_reader&) = delete;
+    ~deflate_reader() { if (ok) deflateEnd(&zs); }
+
+    inline bool valid() const { return ok; }
+
+    static size_t read(char* buffer, size_t size, size_t nmemb, deflate_reader* r)
+    {
+        if (!r->ok)
+            return CURL_READFUNC_ABORT;
+        z_stream& zs = r->zs;
+        size_t room = std::min(size*nmemb, (size_t)UINT_MAX);
+        zs.next_out = (Bytef*)buffer;
+        zs.avail_out = (uInt)room;
+        // deflate may swallow input without output, returning 0 would end the body early
+        while (!r->done && zs.avail_out == room)
+        {
+            uInt feed = (uInt)std::min(r->in.size(), (size_t)UINT_MAX);
+            zs.next_in = (Bytef*)r->in.data();
+            zs.avail_in = feed;
+            int rc = deflate(&zs, feed == r->in.size() ? Z_FINISH : Z_NO_FLUSH);
+            r->in.remove_prefix(feed - zs.avail_in);
+            if (rc == Z_STREAM_END)
+                r->done = true;
+            else if (rc != Z_OK && rc != Z_BUF_ERROR)
+                return CURL_READFUNC_ABORT;
+        }
+        return room - zs.avail_out;
+    }
+};
+
+// deflates in into out, false when that takes more than cap bytes (or zlib fails)
+inline bool compress_bounded(std::string_view in, std::string& out, size_t cap, int level, bool gzip)
+{
+    deflate_reader r(in, level, gzip);
+    if (!r.valid())
+        return false;
+    out.resize(cap);
+    size_t len = 0;
+    for (;;)
+    {
+        // full, which is fine only if nothing is left to come
+        char* to = len < cap ? &out[len] : nullptr;
+        char spill;
+        size_t n = deflate_reader::read(to ? to : &spill, 1, to ? cap - len : 1, &r);
+        if (n == CURL_READFUNC_ABORT || (n && !to))
+            return false;
+        if (n == 0)
+            break;
+        len += n;
+    }
+    out.resize(len);
+    return true;
+}
+
+// a compressed request body on its way out: sent from packed when the whole
+// body was deflated up front, else streamed through z
+struct deflated_body
+{
+    std::string packed;
+    std::string_view rest;          // what is left of packed to send
+    std::optional<deflate_reader> z;
+
+    static size_t read(char* buffer, size_t size, size_t nmemb, deflated_body* b)
+    {
+        size_t n = std::min(size*nmemb, b->rest.size());
+        memcpy(buffer, b->rest.data(), n);
+        b->rest.remove_prefix(n);
+        return n;
+    }
+};
+
+// whole body at once, for requests that own their data anyway (asynchronous ones)
+inline bool compress_body(std::string_view in, std::string& out, int level, bool gzip)
+{
+    deflate_reader r(in, level, gzip);
+    if (!r.valid())
+        return false;
+    out.resize(compressBound((uLong)std::min(in.size(), (size_t)ULONG_MAX)) + 32);
+    size_t len = 0;
+    for (;;)
+    {
+        if (len == out.size())
+            out.resize(out.size() * 2);
+        size_t n = deflate_reader::read(&out[len], 1, out.size() - len, &r);
+        if (n == CURL_READFUNC_ABORT)
+            return false;
+        if (n == 0)
+            break;
+        len += n;
+    }
+    out.resize(len);
+    return true;
+}
+
+#else
+
+// nothing to hold without zlib, call sites keep their shape
+struct deflated_body {};
+
+#endif
+
+#endif
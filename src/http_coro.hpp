@@ -0,0 +1,309 @@
+#ifndef __HTTP_CORO_HPP__
+#define __HTTP_CORO_HPP__
+
+// coroutine requests need a C++20 compiler, everything else builds without them
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define HTTP_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <stdexcept>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include "http_multi.hpp"
+
+// ** coroutine requests ** //
+
+// http_client::co_get() and friends return an http_call, which a coroutine
+// co_awaits for the http_string_response. Awaiting hands the transfer to the
+// client's curl_multi engine (see http_multi.hpp) and suspends, no thread
+// waits on the request; the coroutine is resumed on the engine thread when the
+// transfer completes, or handed to an executor chosen with resume_on(). Code
+// that runs on the engine thread holds up every other transfer, so anything
+// slow or blocking belongs on an executor.
+//
+// timeout() bounds the whole request including its time in the engine queue
+// (one that runs out of time there fails when its turn comes, without going
+// out), cancel_with() ties it to an http_cancel that may stop it from any
+// thread. Either way the call still completes normally, with
+// CURLE_OPERATION_TIMEDOUT or CURLE_ABORTED_BY_CALLBACK in get_result(). The
+// client, and whatever the request refers to (a mime_form and its parts),
+// must outlive the co_await.
+//
+// http_task is the coroutine type to write such code in: it starts when
+// awaited, or from plain code with start() or wait().
+
+// runs the function it is given, on whatever thread it likes
+typedef std::function<void(std::function<void()>)> coro_executor;
+
+// resume on another engine's thread
+inline coro_executor engine_executor(http_multi& e)
+{
+    return [&e](std::function<void()> fn) { e.post(std::move(fn)); };
+}
+
+// cancels every request awaited with it that has not completed yet, and every
+// one awaited with it later; copies share one state
+class http_cancel
+{
+    friend class http_call;
+    struct state
+    {
+        std::mutex mtx;
+        bool cancelled = false;
+        uint64_t next = 0;
+        std::unordered_map<uint64_t, http_stream> live;
+    };
+    std::shared_ptr<state> st;
+public:
+    http_cancel() : st(std::make_shared<state>()) {}
+    void cancel()
+    {
+        std::unordered_map<uint64_t, http_stream> running;
+        {
+            std::lock_guard<std::mutex> lk(st->mtx);
+            st->cancelled = true;
+            running.swap(st->live);
+        }
+        for (auto& r : running)
+            r.second.cancel();
+    }
+    bool cancelled() const { std::lock_guard<std::mutex> lk(st->mtx); return st->cancelled; }
+};
+
+// one request, submitted when awaited; not awaiting it drops the request
+class http_call
+{
+    http_multi* engine;
+    http_transfer* t;                       // ours until submitted
+    coro_executor exec;
+    std::shared_ptr<http_cancel::state> token;
+    uint64_t id = 0;
+    bool inline_done = false;               // completed inside await_suspend, nothing to resume
+    http_string_response res;
+
+public:
+    http_call(http_multi& e, http_transfer* tr) : engine(&e), t(tr) {}
+    http_call(http_call&& o) noexcept
+    : engine(o.engine), t(o.t), exec(std::move(o.exec)), token(std::move(o.token)) { o.t = nullptr; }
+    http_call(const http_call&) = delete;
+    http_call& operator=(const http_call&) = delete;
+    ~http_call() { delete t; }
+
+    // give up after ms, counted from the co_await
+    http_call& timeout(long ms) & { if (t) t->timeout_ms = ms; return *this; }
+    // resume on e instead of the engine thread, null for the engine thread
+    http_call& resume_on(coro_executor e) & { exec = std::move(e); return *this; }
+    http_call& cancel_with(const http_cancel& c) & { token = c.st; return *this; }
+    // chained on a temporary, as in co_await client.co_get(url).timeout(100)
+    http_call&& timeout(long ms) && { return std::move(timeout(ms)); }
+    http_call&& resume_on(coro_executor e) && { return std::move(resume_on(std::move(e))); }
+    http_call&& cancel_with(const http_cancel& c) && { return std::move(cancel_with(c)); }
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h);
+    http_string_response await_resume() { return std::move(res); }
+};
+
+inline bool http_call::await_suspend(std::coroutine_handle<> h)
+{
+    http_transfer* mine = t;
+    t = nullptr;
+    mine->done = [this, h](http_string_response&& r) {
+        res = std::move(r);
+        if (token)
+        {
+            std::lock_guard<std::mutex> lk(token->mtx);
+            token->live.erase(id);
+        }
+        if (inline_done)
+            return;
+        // the coroutine may be gone as soon as it runs, nothing of it is touched after
+        if (exec)
+        {
+            coro_executor e = std::move(exec);
+            e([h]() { h.resume(); });
+        }
+        else
+            h.resume();
+    };
+
+    // from here on the transfer may complete, and the coroutine move on, at any moment
+    http_multi* e = engine;
+    if (!token)
+    {
+        e->submit(mine);
+        return true;
+    }
+    std::shared_ptr<http_cancel::state> tok = token;
+    std::unique_lock<std::mutex> lk(tok->mtx);
+    if (tok->cancelled)
+    {
+        lk.unlock();
+        inline_done = true;
+        mine->finish(CURLE_ABORTED_BY_CALLBACK);
+        delete mine;
+        return false;
+    }
+    // completion waits for the lock, so the entry is in place before it is erased
+    id = ++tok->next;
+    tok->live.emplace(id, e->submit(mine, stream_handler()));
+    return true;
+}
+
+// ** coroutine task ** //
+
+template <class T> class http_task;
+
+struct http_task_promise_base
+{
+    std::coroutine_handle<> next;           // awaiting coroutine, resumed at the end
+    std::function<void()> on_done;          // set by start() instead
+    std::exception_ptr error;
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            auto& p = h.promise();
+            if (p.next)
+                return p.next;
+            if (p.on_done)
+            {
+                // may destroy the task, the frame is not touched after it
+                std::function<void()> fn = std::move(p.on_done);
+                fn();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <class T>
+struct http_task_promise : http_task_promise_base
+{
+    std::optional<T> value;
+    http_task<T> get_return_object();
+    template <class U>
+    void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+    T take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct http_task_promise<void> : http_task_promise_base
+{
+    http_task<void> get_return_object();
+    void return_void() {}
+    void take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+// lazily started coroutine returning T; the task owns the frame, which has to
+// stay alive until it completes
+template <class T = void>
+class http_task
+{
+public:
+    typedef http_task_promise<T> promise_type;
+
+    explicit http_task(std::coroutine_handle<promise_type> c) : h(c) {}
+    http_task(http_task&& o) noexcept : h(o.h) { o.h = nullptr; }
+    http_task& operator=(http_task&& o) noexcept
+    {
+        if (this != &o)
+        {
+            if (h)
+                h.destroy();
+            h = o.h;
+            o.h = nullptr;
+        }
+        return *this;
+    }
+    http_task(const http_task&) = delete;
+    http_task& operator=(const http_task&) = delete;
+    ~http_task() { if (h) h.destroy(); }
+
+    // run from plain code, done is called on whichever thread the task finishes
+    void start(std::function<void()> done = nullptr)
+    {
+        if (!h)
+        {
+            // moved from, nothing to run
+            if (done)
+                done();
+            return;
+        }
+        h.promise().on_done = std::move(done);
+        h.resume();
+    }
+    // run and block the calling thread until the task is done
+    T wait()
+    {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool fin = false;
+        start([&]() {
+            std::lock_guard<std::mutex> lk(mtx);
+            fin = true;
+            cv.notify_one();
+        });
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [&] { return fin; });
+        return take();
+    }
+    inline bool done() const { return !h || h.done(); }
+    // the value once done(), rethrows what escaped the coroutine
+    T result() { return take(); }
+
+    // co_await a task from another coroutine, it runs until its first suspension right away
+    bool await_ready() const noexcept { return !h || h.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        h.promise().next = awaiting;
+        return h;
+    }
+    T await_resume() { return take(); }
+
+private:
+    std::coroutine_handle<promise_type> h;
+
+    T take()
+    {
+        if (!h)
+            throw std::logic_error("http_task: moved from, no result");
+        return h.promise().take();
+    }
+};
+
+template <class T>
+inline http_task<T> http_task_promise<T>::get_return_object()
+{
+    return http_task<T>(std::coroutine_handle<http_task_promise<T>>::from_promise(*this));
+}
+
+inline http_task<void> http_task_promise<void>::get_return_object()
+{
+    return http_task<void>(std::coroutine_handle<http_task_promise<void>>::from_promise(*this));
+}
+
+#endif
+#endif
@@ -0,0 +1,410 @@
+#ifndef __HTTP_DOWNLOAD_HPP__
+#define __HTTP_DOWNLOAD_HPP__
+
+#include <curl/curl.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "http_pool.hpp"
+
+#ifndef header_map
+#define header_map std::map<std::string, std::string>
+#endif
+
+#ifndef CURL_FILE_ERR
+#define CURL_FILE_ERR -2
+#endif
+#define CURL_NO_RANGES -3
+
+// ** segmented download over parallel Range requests ** //
+
+// The size and Accept-Ranges support are probed with a HEAD request, the
+// output file is preallocated and N ranges are fetched concurrently on one
+// curl_multi handle, each segment writing at its own offset with pwrite().
+// Progress is checkpointed to "<file>.segs" so a later run with the same
+// segment count resumes where this one stopped, as long as the server still
+// reports the same size and ETag / Last-Modified and the output file is still
+// there at its full size; otherwise it starts over. Failed segments are
+// retried from the last byte written. Range requests carry If-Range with the
+// validator, so a file that changes on the server mid-download comes back
+// whole instead of mixing versions. run() returns CURL_NO_RANGES when the
+// server cannot serve ranges (or the file changed), the caller then falls
+// back to a single stream.
+//
+// Every handle, the probe's and the segments', comes from an http_pool, so the
+// timeouts, share and other defaults configured there apply to each of them; a
+// segment that stalls past the pool's timeout is retried like any other
+// failure. Without set_pool() a private pool with libcurl's defaults is used.
+// Each 206 must carry a Content-Range for exactly the bytes asked for before
+// anything is written; a server that answers another range is treated like one
+// that ignores ranges. set_observer() sees every finished transfer, with its
+// handle still holding the status and timing.
+
+class segmented_download
+{
+    struct segment
+    {
+        segmented_download* owner;
+        curl_off_t start;
+        curl_off_t end;         // inclusive
+        curl_off_t done = 0;
+        int tries = 0;
+        bool checked = false;
+        bool no_range = false;
+        curl_off_t got_from = -1;   // Content-Range of the response, -1 when there was none
+        curl_off_t got_to = -1;
+        curl_off_t got_total = -1;  // -1 for "*" as well
+        CURL* hdl = nullptr;
+        char range[64];
+
+        inline bool complete() const { return start + done > end; }
+    };
+
+    std::string url;
+    std::string filename;
+    std::string state_file;
+    curl_slist* hds = nullptr;
+    curl_slist* range_hds = nullptr;    // hds and If-Range
+    int nseg;
+    int retries;
+    int fd = -1;
+    curl_off_t size = -1;
+    std::string validator;      // ETag, or Last-Modified when there is none
+    bool ranges = false;
+    std::vector<segment> segs;
+    http_pool own;
+    http_pool* pool = &own;
+    std::function<void(const char*, CURL*, CURLcode)> observer;     // method, handle, result
+
+    static size_t probe_header(char* buffer, size_t size, size_t nitems, segmented_download* d)
+    {
+        size_t n = size*nitems;
+        std::string line(buffer, n);
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+            line.pop_back();
+        if (strncasecmp(line.c_str(), "accept-ranges:", 14) == 0)
+            d->ranges = line.find("bytes", 14) != std::string::npos;
+        else if (strncasecmp(line.c_str(), "etag:", 5) == 0)
+            d->validator = value(line, 5);
+        else if (strncasecmp(line.c_str(), "last-modified:", 14) == 0 && d->validator.empty())
+            d->validator = value(line, 14);
+        return n;
+    }
+    static std::string value(const std::string& line, size_t from)
+    {
+        size_t b = line.find_first_not_of(" \t", from);
+        return b == std::string::npos ? std::string() : line.substr(b);
+    }
+
+    static size_t on_header(char* buffer, size_t size, size_t nitems, segment* sg)
+    {
+        size_t n = size*nitems;
+        if (n > 5 && strncmp(buffer, "HTTP/", 5) == 0)
+        {
+            // a new response (after a redirect or a 100), forget the previous one's range
+            sg->got_from = sg->got_to = sg->got_total = -1;
+        }
+        else if (n > 14 && strncasecmp(buffer, "content-range:", 14) == 0)
+        {
+            std::string line(buffer + 14, n - 14);
+            long long a, b;
+            char total[32];
+            if (sscanf(line.c_str(), " bytes %lld-%lld/%31s", &a, &b, total) == 3)
+            {
+                sg->got_from = a;
+                sg->got_to = b;
+                sg->got_total = (total[0] == '*') ? -1 : strtoll(total, nullptr, 10);
+            }
+        }
+        return n;
+    }
+
+    static size_t on_write(char* buffer, size_t size, size_t nmemb, segment* sg)
+    {
+        size_t n = size*nmemb;
+        curl_off_t pos = sg->start + sg->done;
+        if (!sg->checked)
+        {
+            // a 200 means the range was ignored and the whole body is coming, a 206 has to
+            // start where it was asked to and stay within the segment and the probed size
+            long code = 0;
+            curl_easy_getinfo(sg->hdl, CURLINFO_RESPONSE_CODE, &code);
+            if (code != 206 || sg->got_from != pos || sg->got_to < sg->got_from || sg->got_to > sg->end ||
+                (sg->got_total >= 0 && sg->got_total != sg->owner->size))
+            {
+                sg->no_range = true;
+                return 0;
+            }
+            sg->checked = true;
+        }
+        if (pos + (curl_off_t)n > sg->end + 1)
+            return 0;
+        size_t off = 0;
+        while (off < n)
+        {
+            ssize_t w = pwrite(sg->owner->fd, buffer + off, n - off, pos + off);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return 0;
+            }
+            off += w;
+        }
+        sg->done += n;
+        return n;
+    }
+
+    int probe();
+    bool resume();
+    void checkpoint();
+    CURL* start(segment& sg);
+
+public:
+    segmented_download(std::string u, std::string file, const header_map& headers, int segments = 4, int max_retries = 3)
+    : url(std::move(u)), filename(std::move(file)), nseg(segments < 1 ? 1 : segments), retries(max_retries)
+    {
+        state_file = filename + ".segs";
+        for (const auto& h : headers)
+        {
+            std::string header = h.first + ":" + h.second;
+            hds = curl_slist_append(hds, header.c_str());
+        }
+    }
+    segmented_download(const segmented_download&) = delete;
+    segmented_download& operator=(const segmented_download&) = delete;
+    ~segmented_download()
+    {
+        curl_slist_free_all(hds);
+        curl_slist_free_all(range_hds);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // handles come from p, which has to outlive run()
+    inline void set_pool(http_pool& p) { pool = &p; }
+    inline void set_observer(std::function<void(const char*, CURL*, CURLcode)> fn) { observer = std::move(fn); }
+
+    int run();
+};
+
+inline int segmented_download::probe()
+{
+    CURL* hdl = pool->acquire(url);
+    if (!hdl)
+        return CURLE_FAILED_INIT;
+    curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(hdl, CURLOPT_NOBODY, 1L);
+    // sizes and offsets are those of the bytes on the server, not of an encoded body
+    curl_easy_setopt(hdl, CURLOPT_ACCEPT_ENCODING, nullptr);
+    curl_easy_setopt(hdl, CURLOPT_HEADERFUNCTION, probe_header);
+    curl_easy_setopt(hdl, CURLOPT_HEADERDATA, this);
+    if (hds)
+        curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, hds);
+
+    CURLcode res = curl_easy_perform(hdl);
+    long code = 0;
+    curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(hdl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+    if (observer)
+        observer("HEAD", hdl, res);
+    pool->release(hdl, url);
+
+    if (res != CURLE_OK || code != 200 || size <= 0 || !ranges)
+        return CURL_NO_RANGES;
+    return CURLE_OK;
+}
+
+// picks up a previous run's progress, false when there is nothing usable
+inline bool segmented_download::resume()
+{
+    std::ifstream in(state_file);
+    if (!in)
+        return false;
+    curl_off_t sz = 0;
+    int n = 0;
+    std::string val;
+    in >> sz >> n;
+    in.ignore(1);
+    std::getline(in, val);
+    if (!in || sz != size || n != (int)segs.size() || val != validator)
+        return false;
+    for (auto& sg : segs)
+    {
+        curl_off_t d = 0;
+        if (!(in >> d) || d < 0 || sg.start + d > sg.end + 1)
+            return false;
+        sg.done = d;
+    }
+    return true;
+}
+
+inline void segmented_download::checkpoint()
+{
+    std::ofstream out(state_file, std::ios::trunc);
+    out << size << " " << segs.size() << "\n" << validator << "\n";
+    for (const auto& sg : segs)
+        out << sg.done << "\n";
+}
+
+inline CURL* segmented_download::start(segment& sg)
+{
+    // a fresh handle for every attempt, so the pool's defaults are set again
+    if (sg.hdl)
+        pool->release(sg.hdl, url);
+    if (!(sg.hdl = pool->acquire(url)))
+        return nullptr;
+    sg.checked = false;
+    snprintf(sg.range, sizeof(sg.range), "%lld-%lld", (long long)(sg.start + sg.done), (long long)sg.end);
+    curl_easy_setopt(sg.hdl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(sg.hdl, CURLOPT_RANGE, sg.range);
+    curl_easy_setopt(sg.hdl, CURLOPT_ACCEPT_ENCODING, nullptr);
+    curl_easy_setopt(sg.hdl, CURLOPT_WRITEFUNCTION, on_write);
+    curl_easy_setopt(sg.hdl, CURLOPT_WRITEDATA, &sg);
+    curl_easy_setopt(sg.hdl, CURLOPT_HEADERFUNCTION, on_header);
+    curl_easy_setopt(sg.hdl, CURLOPT_HEADERDATA, &sg);
+    curl_easy_setopt(sg.hdl, CURLOPT_PRIVATE, &sg);
+    if (range_hds)
+        curl_easy_setopt(sg.hdl, CURLOPT_HTTPHEADER, range_hds);
+    return sg.hdl;
+}
+
+inline int segmented_download::run()
+{
+    int res = probe();
+    if (res != CURLE_OK)
+        return res;
+
+    curl_off_t chunk = (size + nseg - 1) / nseg;
+    for (curl_off_t off = 0; off < size; off += chunk)
+    {
+        segment sg;
+        sg.owner = this;
+        sg.start = off;
+        sg.end = std::min(off + chunk, size) - 1;
+        segs.push_back(sg);
+    }
+
+    // a range is only served from the version probed; a weak ETag cannot say so
+    for (curl_slist* h = hds; h; h = h->next)
+        range_hds = curl_slist_append(range_hds, h->data);
+    if (!validator.empty() && validator.compare(0, 2, "W/") != 0)
+        range_hds = curl_slist_append(range_hds, ("If-Range: " + validator).c_str());
+
+    bool resumed = resume();
+    fd = open(filename.c_str(), O_RDWR | O_CREAT | (resumed ? 0 : O_TRUNC), 0644);
+    if (fd < 0)
+        return CURL_FILE_ERR;
+    struct stat st;
+    if (resumed && (fstat(fd, &st) != 0 || st.st_size != size))
+    {
+        // deleted or cut short since the checkpoint, what it claims is not in the file
+        resumed = false;
+        for (auto& sg : segs)
+            sg.done = 0;
+        if (ftruncate(fd, 0) != 0)
+            return CURL_FILE_ERR;
+    }
+    if (!resumed)
+    {
+        // reserve the blocks up front, fall back to a sparse file where fallocate is unsupported
+        if (fallocate(fd, 0, 0, size) != 0 && ftruncate(fd, size) != 0)
+            return CURL_FILE_ERR;
+        checkpoint();
+    }
+
+    CURLM* mh = curl_multi_init();
+    int running = 0;
+    for (auto& sg : segs)
+    {
+        if (sg.complete())
+            continue;
+        if (!start(sg))
+        {
+            res = CURLE_FAILED_INIT;
+            break;
+        }
+        curl_multi_add_handle(mh, sg.hdl);
+        running++;
+    }
+
+    auto last = std::chrono::steady_clock::now();
+    while (running > 0 && res == CURLE_OK)
+    {
+        int active;
+        curl_multi_perform(mh, &active);
+        int left;
+        bool changed = false;
+        while (CURLMsg* msg = curl_multi_info_read(mh, &left))
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            segment* sg = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&sg);
+            CURLcode rc = msg->data.result;
+            curl_multi_remove_handle(mh, sg->hdl);
+            running--;
+            changed = true;
+            if (observer)
+                observer("GET", sg->hdl, rc);
+
+            if (sg->no_range)
+                res = CURL_NO_RANGES;
+            else if (rc == CURLE_OK && sg->complete())
+                continue;
+            else if (++sg->tries <= retries)
+            {
+                // resume the segment from the last byte written
+                if (!start(*sg))
+                {
+                    res = CURLE_FAILED_INIT;
+                    break;
+                }
+                curl_multi_add_handle(mh, sg->hdl);
+                running++;
+            }
+            else
+                res = (rc == CURLE_OK) ? CURLE_PARTIAL_FILE : rc;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (changed || now - last > std::chrono::seconds(1))
+        {
+            checkpoint();
+            last = now;
+        }
+        if (running > 0 && res == CURLE_OK)
+            curl_multi_poll(mh, nullptr, 0, 1000, nullptr);
+    }
+
+    for (auto& sg : segs)
+    {
+        if (sg.hdl)
+        {
+            curl_multi_remove_handle(mh, sg.hdl);
+            pool->release(sg.hdl, url);
+            sg.hdl = nullptr;
+        }
+    }
+    curl_multi_cleanup(mh);
+
+    if (res == CURLE_OK || res == CURL_NO_RANGES)
+        remove(state_file.c_str());
+    else
+        checkpoint();
+    return res;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef __HTTP_EPOLL_HPP__
+#define __HTTP_EPOLL_HPP__
+
+#include <sys/epoll.h>
+#include <chrono>
+#include <unordered_map>
+#include <functional>
+#include "http_multi.hpp"
+
+// ** reference epoll loop driving an http_multi through curl_multi_socket_action ** //
+
+// Only the sockets libcurl is actually waiting on are registered, so a wakeup
+// costs O(ready sockets) no matter how many transfers are in flight. Services
+// with their own reactor can copy the two callbacks below into it instead.
+
+class epoll_loop
+{
+    http_multi& engine;
+    int epfd;
+    std::unordered_map<curl_socket_t, uint32_t> watched;   // fd -> registered epoll events
+    bool timer_armed = false;
+    std::chrono::steady_clock::time_point deadline;
+
+    void update(curl_socket_t fd, int what)
+    {
+        auto it = watched.find(fd);
+        if (what == CURL_POLL_REMOVE)
+        {
+            if (it != watched.end())
+            {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+                watched.erase(it);
+            }
+            return;
+        }
+
+        epoll_event ev = {};
+        ev.data.fd = fd;
+        if (what & CURL_POLL_IN)
+            ev.events |= EPOLLIN;
+        if (what & CURL_POLL_OUT)
+            ev.events |= EPOLLOUT;
+
+        if (it == watched.end())
+        {
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+            watched[fd] = ev.events;
+        }
+        else if (it->second != ev.events)
+        {
+            epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+            it->second = ev.events;
+        }
+    }
+
+    void arm(long timeout_ms)
+    {
+        timer_armed = timeout_ms >= 0;
+        if (timer_armed)
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+
+public:
+    epoll_loop(http_multi& m) : engine(m)
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        engine.attach(
+            [this](curl_socket_t fd, int what) { update(fd, what); },
+            [this](long timeout_ms) { arm(timeout_ms); });
+    }
+    epoll_loop(const epoll_loop&) = delete;
+    epoll_loop& operator=(const epoll_loop&) = delete;
+    ~epoll_loop()
+    {
+        engine.detach();
+        close(epfd);
+    }
+
+    // wait at most max_wait_ms (-1 = until something happens) and dispatch,
+    // returns the number of socket events handled
+    int run_once(int max_wait_ms = -1);
+    // dispatch until done() returns true
+    void run_until(std::function<bool()> done)
+    {
+        while (!done())
+            run_once(100);
+    }
+};
+
+inline int epoll_loop::run_once(int max_wait_ms)
+{
+    int wait = max_wait_ms;
+    if (timer_armed)
+    {
+        // rounded up, a deadline less than a millisecond away must not turn into a busy poll
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        long left = us > 0 ? (long)((us + 999) / 1000) : 0;
+        if (wait < 0 || left < wait)
+            wait = (int)left;
+    }
+
+    epoll_event events[256];
+    int n = epoll_wait(epfd, events, 256, wait);
+    for (int i = 0; i < n; i++)
+    {
+        int mask = 0;
+        if (events[i].events & (EPOLLIN | EPOLLHUP))
+            mask |= CURL_CSELECT_IN;
+        if (events[i].events & EPOLLOUT)
+            mask |= CURL_CSELECT_OUT;
+        if (events[i].events & EPOLLERR)
+            mask |= CURL_CSELECT_ERR;
+        engine.socket_action(events[i].data.fd, mask);
+    }
+
+    if (timer_armed && std::chrono::steady_clock::now() >= deadline)
+    {
+        timer_armed = false;
+        engine.on_timeout();
+    }
+    return n < 0 ? 0 : n;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __HTTP_EXECUTOR_HPP__
+#define __HTTP_EXECUTOR_HPP__
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <future>
+#include <functional>
+#include <thread>
+#include "http_multi.hpp"
+
+// ** thread-per-core executor over several curl_multi engines ** //
+
+// One http_multi per core, each on its own (optionally pinned) thread with
+// its own connection cache and recycled easy handles. Requests may be
+// submitted from any thread and go to the engine their origin hashes to, so
+// one host keeps hitting the same warm connections. An engine whose queue
+// runs dry steals up to half of another engine's queue, and a submit that
+// lands behind a full engine wakes an idle one to do so; load follows the
+// work without giving up host affinity while there is none to balance.
+//
+// Completion callbacks run on whichever engine thread finished the transfer.
+// Streaming transfers are never stolen, they stay with their home engine.
+
+class http_executor
+{
+    std::vector<std::shared_ptr<http_multi>> engines;
+    size_t max_inflight;
+
+    inline size_t home(const std::string& url) const
+    {
+        return std::hash<std::string>()(http_pool::origin(url)) % engines.size();
+    }
+    void steal_for(size_t thief, size_t room, std::vector<http_transfer*>& out)
+    {
+        size_t start = out.size();
+        for (size_t k = 1; k < engines.size() && out.size() - start < room; k++)
+            engines[(thief + k) % engines.size()]->steal(room - (out.size() - start), out);
+    }
+    // a transfer just queued up behind a busy engine, get an idle one to come for it
+    void balance(size_t from)
+    {
+        if (engines.size() < 2 || engines[from]->backlog() == 0)
+            return;
+        for (size_t k = 1; k < engines.size(); k++)
+        {
+            http_multi& e = *engines[(from + k) % engines.size()];
+            if (e.load() < max_inflight && e.backlog() == 0)
+            {
+                e.wake();
+                return;
+            }
+        }
+    }
+    http_multi& route(const std::string& url) { return *engines[home(url)]; }
+
+public:
+    // threads 0 means one per core; with pin each engine thread is bound to core i
+    http_executor(size_t threads = 0, size_t max_inflight_per_thread = 64, bool pin = true);
+    http_executor(const http_executor&) = delete;
+    http_executor& operator=(const http_executor&) = delete;
+    ~http_executor();
+
+    void submit(http_transfer* t);
+    http_stream submit(http_transfer* t, stream_handler h);
+
+    std::future<http_string_response> get_async(std::string url, const header_map& headers);
+    void get_async(std::string url, http_transfer::callback cb, const header_map& headers);
+    std::future<http_string_response> put_async(std::string url, std::string data, const header_map& headers);
+    void put_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers);
+    std::future<http_string_response> simplepost_async(std::string url, std::string data, const header_map& headers);
+    void simplepost_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers);
+    std::future<http_string_response> c_async(std::string type, std::string url, std::string data, const header_map& headers);
+    void c_async(std::string type, std::string url, std::string data, http_transfer::callback cb, const header_map& headers);
+
+    // applied to every engine, call before the first request
+    void enable_http2(bool prior_knowledge = true, long streams_per_conn = 100, long conns_per_host = 0)
+    {
+        for (auto& e : engines)
+            e->enable_http2(prior_knowledge, streams_per_conn, conns_per_host);
+    }
+    void set_share(CURLSH* sh) { for (auto& e : engines) e->set_share(sh); }
+    void set_accept_encoding(const char* enc) { for (auto& e : engines) e->set_accept_encoding(enc); }
+    void set_metrics(http_metrics* m) { for (auto& e : engines) e->set_metrics(m); }
+    void set_log(http_log* l) { for (auto& e : engines) e->set_log(l); }
+
+    inline size_t size() const { return engines.size(); }
+    inline http_multi& engine(size_t i) { return *engines[i]; }
+    // queued plus running transfers over all engines
+    size_t pending()
+    {
+        size_t n = 0;
+        for (auto& e : engines)
+            n += e->backlog() + e->load();
+        return n;
+    }
+};
+
+inline http_executor::http_executor(size_t threads, size_t max_inflight_per_thread, bool pin)
+: max_inflight(max_inflight_per_thread ? max_inflight_per_thread : 1)
+{
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    if (threads == 0)
+        threads = cores;
+    for (size_t i = 0; i < threads; i++)
+    {
+        engines.push_back(std::make_shared<http_multi>(max_inflight));
+        engines.back()->set_steal([this, i](size_t room, std::vector<http_transfer*>& out) { steal_for(i, room, out); });
+        // more engines than cores would pile up on the same ones, leave those to the scheduler
+        if (pin && threads <= cores)
+            engines.back()->set_cpu((int)i);
+    }
+    for (auto& e : engines)
+        e->start();
+}
+
+inline http_executor::~http_executor()
+{
+    // all threads down before any engine goes, a running one may still steal from it
+    for (auto& e : engines)
+        e->stop();
+    for (auto& e : engines)
+        e->set_steal(nullptr);
+}
+
+inline void http_executor::submit(http_transfer* t)
+{
+    size_t h = home(t->url);
+    engines[h]->submit(t);
+    balance(h);
+}
+
+inline http_stream http_executor::submit(http_transfer* t, stream_handler h)
+{
+    return route(t->url).submit(t, std::move(h));
+}
+
+inline std::future<http_string_response> http_executor::get_async(std::string url, const header_map& headers = header_map())
+{
+    return c_async("GET", std::move(url), std::string(), headers);
+}
+
+inline void http_executor::get_async(std::string url, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    c_async("GET", std::move(url), std::string(), std::move(cb), headers);
+}
+
+inline std::future<http_string_response> http_executor::put_async(std::string url, std::string data, const header_map& headers = header_map())
+{
+    return c_async("PUT", std::move(url), std::move(data), headers);
+}
+
+inline void http_executor::put_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    c_async("PUT", std::move(url), std::move(data), std::move(cb), headers);
+}
+
+inline std::future<http_string_response> http_executor::simplepost_async(std::string url, std::string data, const header_map& headers = header_map())
+{
+    return c_async("POST", std::move(url), std::move(data), headers);
+}
+
+inline void http_executor::simplepost_async(std::string url, std::string data, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    c_async("POST", std::move(url), std::move(data), std::move(cb), headers);
+}
+
+inline std::future<http_string_response> http_executor::c_async(std::string type, std::string url, std::string data = std::string(), const header_map& headers = header_map())
+{
+    auto prom = std::make_shared<std::promise<http_string_response>>();
+    std::future<http_string_response> fut = prom->get_future();
+    c_async(std::move(type), std::move(url), std::move(data), [prom](http_string_response&& r) { prom->set_value(std::move(r)); }, headers);
+    return fut;
+}
+
+inline void http_executor::c_async(std::string type, std::string url, std::string data, http_transfer::callback cb, const header_map& headers = header_map())
+{
+    submit(new http_transfer(std::move(type), std::move(url), headers, std::move(data), std::move(cb)));
+}
+
+#endif
@@ -0,0 +1,627 @@
+#ifndef __HTTP_FILE_HPP__
+#define __HTTP_FILE_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "http_sink.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HTTP_HAVE_URING 1
+#endif
+
+// alignment of file_sink buffers, offsets and lengths, what O_DIRECT asks for
+#define FILE_SINK_ALIGN 4096
+
+// ** read-only file mapping used as an upload source ** //
+
+// Uploads read straight out of the page cache: libcurl's read callback copies
+// from the mapping into its send buffer (or the TLS layer's), there is no
+// intermediate fread() buffer. libcurl owns the socket, so sendfile()/splice()
+// are not an option for bodies going through it. Touching a mapped page the
+// file no longer reaches raises SIGBUS, so the read callbacks go through
+// read_at(), which checks the size with fstat() first and aborts the upload
+// when the file was cut short; a file cut between that check and the copy can
+// still fault.
+
+class mapped_file
+{
+    int fd = -1;
+    void* addr = nullptr;
+    size_t len = 0;
+    bool ok = false;
+
+public:
+    mapped_file(const std::string& path)
+    {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return;
+        len = (size_t)st.st_size;
+        if (len > 0)
+        {
+            addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                addr = nullptr;
+                return;
+            }
+            madvise(addr, len, MADV_SEQUENTIAL);
+        }
+        ok = true;
+    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    ~mapped_file()
+    {
+        if (addr)
+            munmap(addr, len);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    inline bool valid() const { return ok; }
+    inline const char* data() const { return (const char*)addr; }
+    inline size_t size() const { return len; }
+    inline std::string_view view() const { return std::string_view(data(), len); }
+
+    // copies up to n bytes from pos on, CURL_READFUNC_ABORT when the file no longer holds them
+    size_t read_at(char* buffer, size_t pos, size_t n) const
+    {
+        n = std::min(n, len - pos);
+        struct stat st;
+        if (n && (fstat(fd, &st) != 0 || (size_t)st.st_size < pos + n))
+            return CURL_READFUNC_ABORT;
+        memcpy(buffer, data() + pos, n);
+        return n;
+    }
+};
+
+// read position in a mapped_file, the CURLOPT_READDATA of a file upload
+struct mapped_reader
+{
+    const mapped_file* map;
+    size_t pos = 0;
+
+    static size_t read(char* buffer, size_t size, size_t nitems, void* arg)
+    {
+        mapped_reader* r = (mapped_reader*)arg;
+        size_t n = r->map->read_at(buffer, r->pos, size*nitems);
+        if (n != CURL_READFUNC_ABORT)
+            r->pos += n;
+        return n;
+    }
+};
+
+// ** mapped file as a mime part body, owned and freed by libcurl ** //
+
+struct mime_mapped_source
+{
+    mapped_file map;
+    size_t pos = 0;
+
+    mime_mapped_source(const std::string& path) : map(path) {}
+
+    static size_t read(char* buffer, size_t size, size_t nitems, void* arg)
+    {
+        mime_mapped_source* s = (mime_mapped_source*)arg;
+        size_t n = s->map.read_at(buffer, s->pos, size*nitems);
+        if (n != CURL_READFUNC_ABORT)
+            s->pos += n;
+        return n;
+    }
+    static int seek(void* arg, curl_off_t offset, int origin)
+    {
+        mime_mapped_source* s = (mime_mapped_source*)arg;
+        curl_off_t base = origin == SEEK_SET ? 0 : origin == SEEK_CUR ? (curl_off_t)s->pos : (curl_off_t)s->map.size();
+        if (base + offset < 0 || base + offset > (curl_off_t)s->map.size())
+            return CURL_SEEKFUNC_FAIL;
+        s->pos = (size_t)(base + offset);
+        return CURL_SEEKFUNC_OK;
+    }
+    static void release(void* arg) { delete (mime_mapped_source*)arg; }
+
+    // makes the part read from the mapping, false (and nothing set) when the file cannot be mapped
+    static bool attach(curl_mimepart* part, const std::string& path)
+    {
+        mime_mapped_source* s = new mime_mapped_source(path);
+        if (!s->map.valid())
+        {
+            delete s;
+            return false;
+        }
+        curl_mime_data_cb(part, (curl_off_t)s->map.size(), read, seek, release, s);
+        return true;
+    }
+};
+
+// ** asynchronous file sink for downloads ** //
+
+// Chunks from libcurl are copied into large aligned buffers, a full buffer is
+// handed to the kernel with io_uring (raw syscalls, no liburing needed) or,
+// where io_uring is unavailable, to writer threads using pwrite(). At most
+// queue_depth buffers are in flight, after that write() waits for one to come
+// back, which throttles the transfer instead of growing memory. finish()
+// flushes the tail, waits for every write, optionally fsyncs and closes.
+
+struct file_sink_options
+{
+    size_t buffer_size = 1 << 20;   // bytes per write, rounded up to FILE_SINK_ALIGN
+    int queue_depth = 4;            // buffers in flight before write() blocks
+    bool direct = false;            // O_DIRECT, dropped where the filesystem refuses it
+    bool sync = false;              // fdatasync() in finish()
+    bool uring = true;              // io_uring when the kernel allows it, else writer threads
+    int threads = 1;                // writer threads of the fallback
+};
+
+#ifdef HTTP_HAVE_URING
+// minimal single producer io_uring, only used from the thread driving the transfer
+class file_uring
+{
+    int fd = -1;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    io_uring_cqe* cqes;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+
+public:
+    file_uring() {}
+    file_uring(const file_uring&) = delete;
+    file_uring& operator=(const file_uring&) = delete;
+    ~file_uring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_len);
+        if (cq_ring != MAP_FAILED)
+            munmap(cq_ring, cq_len);
+        if (sq_ring != MAP_FAILED)
+            munmap(sq_ring, sq_len);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool init(unsigned entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0)
+            return false;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sq_ring = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+            return false;
+        char* sq = (char*)sq_ring;
+        char* cq = (char*)cq_ring;
+        sq_head = (unsigned*)(sq + p.sq_off.head);
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    // queues and submits a writev of one iovec, IORING_OP_WRITEV works on every io_uring kernel
+    bool writev(int wfd, const iovec* iov, off_t off, uint64_t tag)
+    {
+        unsigned tail = *sq_tail;
+        unsigned idx = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = wfd;
+        sqe->addr = (uint64_t)(uintptr_t)iov;
+        sqe->len = 1;
+        sqe->off = (uint64_t)off;
+        sqe->user_data = tag;
+        sq_array[idx] = idx;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        for (;;)
+        {
+            int n = (int)syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0);
+            if (n >= 0)
+                return n == 1;
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    // next completion, false when there is none and wait is not set (or on error)
+    bool reap(uint64_t& tag, int& res, bool wait)
+    {
+        for (;;)
+        {
+            unsigned head = *cq_head;
+            if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            {
+                io_uring_cqe* cqe = &cqes[head & *cq_mask];
+                tag = cqe->user_data;
+                res = cqe->res;
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (!wait)
+                return false;
+            if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                return false;
+        }
+    }
+};
+#endif
+
+class file_sink : public response_sink
+{
+    struct slot
+    {
+        char* buf;
+        size_t len;         // bytes to write, padded to FILE_SINK_ALIGN for the O_DIRECT tail
+        size_t done;
+        off_t off;
+        iovec iov;
+    };
+
+    file_sink_options opts;
+    int fd = -1;
+    int error = 0;
+    bool direct = false;
+    bool finished = false;
+    size_t bsize;
+    off_t written = 0;      // file offset of the buffer being filled
+    int cur = -1;
+    std::vector<slot> slots;
+#ifdef HTTP_HAVE_URING
+    std::unique_ptr<file_uring> ring;
+#endif
+
+    // shared with the writer threads, all of it under mtx; with io_uring there are no
+    // writer threads and only the caller's thread touches it
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<int> free_slots;
+    std::deque<int> jobs;
+    size_t inflight = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        for (;;)
+        {
+            cv.wait(lk, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            int i = jobs.front();
+            jobs.pop_front();
+            lk.unlock();
+            slot& s = slots[i];
+            int e = 0;
+            while (s.done < s.len)
+            {
+                ssize_t w = pwrite(fd, s.buf + s.done, s.len - s.done, s.off + s.done);
+                if (w < 0 && errno == EINTR)
+                    continue;
+                if (w <= 0)
+                {
+                    e = w < 0 ? errno : EIO;
+                    break;
+                }
+                s.done += w;
+            }
+            lk.lock();
+            if (e && !error)
+                error = e;
+            free_slots.push_back(i);
+            inflight--;
+            cv.notify_all();
+        }
+    }
+
+#ifdef HTTP_HAVE_URING
+    void submit_ring(int i)
+    {
+        slot& s = slots[i];
+        s.iov.iov_base = s.buf + s.done;
+        s.iov.iov_len = s.len - s.done;
+        if (!ring->writev(fd, &s.iov, s.off + s.done, (uint64_t)i))
+        {
+            if (!error)
+                error = EIO;
+            free_slots.push_back(i);
+            inflight--;
+        }
+    }
+    // one completion, resubmits the rest of a short write
+    bool reap_ring(bool wait)
+    {
+        uint64_t tag;
+        int res;
+        if (!ring->reap(tag, res, wait))
+            return false;
+        slot& s = slots[tag];
+        if (res > 0)
+            s.done += res;
+        if (res > 0 && s.done < s.len)
+        {
+            submit_ring((int)tag);
+            return true;
+        }
+        if (res <= 0 && !error)
+            error = res < 0 ? -res : EIO;
+        free_slots.push_back((int)tag);
+        inflight--;
+        return true;
+    }
+#endif
+
+    void dispatch(int i)
+    {
+        slots[i].done = 0;
+#ifdef HTTP_HAVE_URING
+        if (ring)
+        {
+            inflight++;
+            submit_ring(i);
+            while (reap_ring(false))
+                ;
+            return;
+        }
+#endif
+        std::lock_guard<std::mutex> lk(mtx);
+        inflight++;
+        jobs.push_back(i);
+        cv.notify_all();
+    }
+
+    // a free buffer, waiting for an in flight write to complete when there is none;
+    // -1 when the ring fails and none will come back
+    int acquire()
+    {
+#ifdef HTTP_HAVE_URING
+        if (ring)
+        {
+            while (free_slots.empty())
+                if (!reap_ring(true))
+                {
+                    if (!error)
+                        error = EIO;
+                    return -1;
+                }
+            int i = free_slots.back();
+            free_slots.pop_back();
+            return i;
+        }
+#endif
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [this] { return !free_slots.empty(); });
+        int i = free_slots.back();
+        free_slots.pop_back();
+        return i;
+    }
+
+    void drain()
+    {
+#ifdef HTTP_HAVE_URING
+        if (ring)
+        {
+            while (inflight > 0)
+                if (!reap_ring(true))
+                {
+                    if (!error)
+                        error = EIO;
+                    break;
+                }
+            return;
+        }
+#endif
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [this] { return inflight == 0; });
+    }
+
+    int failed()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        return error;
+    }
+
+public:
+    file_sink(const std::string& path, const file_sink_options& options = file_sink_options())
+    : opts(options)
+    {
+        bsize = (std::max<size_t>(opts.buffer_size, 1) + FILE_SINK_ALIGN - 1) / FILE_SINK_ALIGN * FILE_SINK_ALIGN;
+        int depth = std::max(opts.queue_depth, 1);
+
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+        if (opts.direct)
+        {
+            fd = open(path.c_str(), flags | O_DIRECT, 0644);
+            direct = fd >= 0;
+        }
+#endif
+        if (fd < 0)
+            fd = open(path.c_str(), flags, 0644);
+        if (fd < 0)
+        {
+            error = errno;
+            return;
+        }
+
+        for (int i = 0; i < depth; i++)
+        {
+            char* buf = (char*)aligned_alloc(FILE_SINK_ALIGN, bsize);
+            if (!buf)
+                break;
+            slots.push_back({buf, 0, 0, 0, {nullptr, 0}});
+            free_slots.push_back(i);
+        }
+        if (slots.empty())
+        {
+            error = ENOMEM;
+            return;
+        }
+
+#ifdef HTTP_HAVE_URING
+        if (opts.uring)
+        {
+            ring.reset(new file_uring());
+            if (!ring->init((unsigned)slots.size()))
+                ring.reset();
+        }
+        if (ring)
+            return;
+#endif
+        for (int i = 0; i < std::max(opts.threads, 1); i++)
+            workers.emplace_back(&file_sink::worker, this);
+    }
+    file_sink(const file_sink&) = delete;
+    file_sink& operator=(const file_sink&) = delete;
+    ~file_sink()
+    {
+        finish();
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers)
+            t.join();
+#ifdef HTTP_HAVE_URING
+        ring.reset();
+#endif
+        for (auto& s : slots)
+            free(s.buf);
+    }
+
+    inline bool valid() const { return fd >= 0 && !slots.empty(); }
+#ifdef HTTP_HAVE_URING
+    inline bool uses_uring() const { return ring != nullptr; }
+#else
+    inline bool uses_uring() const { return false; }
+#endif
+    inline bool uses_direct() const { return direct; }
+
+    // a retried transfer starts the file over
+    void begin() override
+    {
+        if (!valid() || (written == 0 && cur < 0))
+            return;
+        drain();
+        std::lock_guard<std::mutex> lk(mtx);
+        if (cur >= 0)
+        {
+            free_slots.push_back(cur);
+            cur = -1;
+        }
+        written = 0;
+        if (ftruncate(fd, 0) != 0 && !error)
+            error = errno;
+    }
+    // reserves the blocks without changing the size, fewer extents for large files
+    void expect(curl_off_t size) override
+    {
+#ifdef FALLOC_FL_KEEP_SIZE
+        if (valid() && size > 0)
+            fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+#else
+        (void)size;
+#endif
+    }
+    bool write(const char* data, size_t len) override
+    {
+        if (!valid() || finished)
+            return false;
+        while (len)
+        {
+            if (failed())
+                return false;
+            if (cur < 0)
+            {
+                cur = acquire();
+                if (cur < 0)
+                    return false;
+                slots[cur].len = 0;
+                slots[cur].off = written;
+            }
+            slot& s = slots[cur];
+            size_t n = std::min(len, bsize - s.len);
+            memcpy(s.buf + s.len, data, n);
+            s.len += n;
+            data += n;
+            len -= n;
+            if (s.len == bsize)
+            {
+                written += bsize;
+                dispatch(cur);
+                cur = -1;
+            }
+        }
+        return true;
+    }
+
+    // flushes, waits for the writes, fsyncs when asked and closes, 0 or an errno value
+    int finish()
+    {
+        if (finished || fd < 0)
+            return error;
+        finished = true;
+        off_t size = written;
+        if (cur >= 0)
+        {
+            slot& s = slots[cur];
+            size += s.len;
+            if (direct && s.len % FILE_SINK_ALIGN)
+            {
+                // O_DIRECT writes whole blocks, the padding is cut off below
+                size_t padded = (s.len + FILE_SINK_ALIGN - 1) / FILE_SINK_ALIGN * FILE_SINK_ALIGN;
+                memset(s.buf + s.len, 0, padded - s.len);
+                s.len = padded;
+            }
+            dispatch(cur);
+            cur = -1;
+        }
+        drain();
+        if (direct && ftruncate(fd, size) != 0 && !error)
+            error = errno;
+        if (opts.sync && fdatasync(fd) != 0 && !error)
+            error = errno;
+        if (close(fd) != 0 && !error)
+            error = errno;
+        fd = -1;
+        return error;
+    }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef __HTTP_FLIGHT_HPP__
+#define __HTTP_FLIGHT_HPP__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include "http_multi.hpp"
+
+// ** request coalescing (single flight) ** //
+
+// Identical idempotent requests (GET, HEAD, OPTIONS) that overlap in time go
+// out once. Requests are identical when method, url and the selected request
+// headers match (every header when none are selected). The first caller
+// starts the request on an http_multi engine, later ones join it, and all of
+// them receive the same immutable flight_result, the body is never copied
+// between them. Once the request completes the key is free again, the next
+// caller starts a new one; caching the result is http_cache's job.
+//
+// Blocking waiters stay until the result is in. Asynchronous waiters hold a
+// flight_ticket and may cancel: they stop waiting, and only when the last
+// waiter of a flight is gone is the shared request itself cancelled.
+
+struct flight_result
+{
+    CURLcode result = CURLE_OK;     // CURLE_ABORTED_BY_CALLBACK when every waiter cancelled
+    long status = 0;
+    header_block headers;
+    std::shared_ptr<const std::string> body;   // shared by every waiter, never modified
+    http_timing timing;
+};
+
+class http_singleflight;
+
+// one asynchronous waiter, see http_singleflight::run_async
+class flight_ticket
+{
+    friend class http_singleflight;
+    http_singleflight* owner = nullptr;
+    std::string key;
+    std::shared_ptr<void> f;
+    uint64_t id = 0;
+public:
+    flight_ticket() {}
+    // stop waiting, the callback will not run; true when it was still pending
+    bool cancel();
+};
+
+class http_singleflight
+{
+public:
+    typedef std::shared_ptr<const flight_result> result_ptr;
+    typedef std::function<void(result_ptr)> callback;
+
+private:
+    friend class flight_ticket;
+
+    struct flight
+    {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+        result_ptr result;
+        size_t waiters = 0;
+        std::vector<std::pair<uint64_t, callback>> callbacks;
+        uint64_t next_id = 1;
+        http_stream stream;         // cancels the shared request
+    };
+
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_ptr<flight>> inflight;
+    std::vector<std::string> key_headers;
+    std::atomic<uint64_t> flights{0}, joined{0}, cancelled{0};
+
+    // the flight for key with one more waiter, started on engine when there was none;
+    // caller holds mtx
+    std::shared_ptr<flight> join(http_multi& engine, const std::string& key, const std::string& method, const std::string& url, const header_map& headers, long connect_ms, long timeout_ms);
+    void complete(const std::string& key, const std::shared_ptr<flight>& f, http_string_response&& r);
+    bool leave(const std::string& key, const std::shared_ptr<flight>& f, uint64_t id);
+
+public:
+    // only these request headers (any case) tell requests apart, none given means all of them
+    http_singleflight(std::vector<std::string> headers = std::vector<std::string>()) : key_headers(std::move(headers)) {}
+    http_singleflight(const http_singleflight&) = delete;
+    http_singleflight& operator=(const http_singleflight&) = delete;
+
+    static inline bool idempotent(const std::string& method) { return method == "GET" || method == "HEAD" || method == "OPTIONS"; }
+    std::string key(const std::string& method, const std::string& url, const header_map& headers) const;
+
+    // waits for the shared response, starting the request on engine if none is in flight;
+    // the connect and whole transfer timeouts (ms, 0 = none) are those of the caller that starts it
+    result_ptr run(http_multi& engine, const std::string& method, const std::string& url, const header_map& headers, long connect_ms = 0, long timeout_ms = 0);
+    // cb runs on the engine thread once the shared response is in, unless the ticket is cancelled first
+    flight_ticket run_async(http_multi& engine, const std::string& method, const std::string& url, const header_map& headers, callback cb, long connect_ms = 0, long timeout_ms = 0);
+
+    inline size_t in_flight() { std::lock_guard<std::mutex> lk(mtx); return inflight.size(); }
+    // requests that went out, requests that joined one already in flight, cancelled waiters
+    inline uint64_t started() const { return flights.load(std::memory_order_relaxed); }
+    inline uint64_t coalesced() const { return joined.load(std::memory_order_relaxed); }
+    inline uint64_t cancellations() const { return cancelled.load(std::memory_order_relaxed); }
+};
+
+inline std::string http_singleflight::key(const std::string& method, const std::string& url, const header_map& headers) const
+{
+    std::string k = method;
+    k += ' ';
+    k += url;
+    for (const auto& h : headers)
+    {
+        bool use = key_headers.empty();
+        for (size_t i = 0; !use && i < key_headers.size(); i++)
+            use = header_block::iequals(h.first, key_headers[i]);
+        if (!use)
+            continue;
+        k += '\n';
+        for (char c : h.first)
+            k += (c >= 'A' && c <= 'Z') ? c + 32 : c;
+        k += ':';
+        k += h.second;
+    }
+    return k;
+}
+
+inline std::shared_ptr<http_singleflight::flight> http_singleflight::join(http_multi& engine, const std::string& key, const std::string& method, const std::string& url, const header_map& headers, long connect_ms, long timeout_ms)
+{
+    auto it = inflight.find(key);
+    if (it != inflight.end())
+    {
+        std::lock_guard<std::mutex> lk(it->second->mtx);
+        it->second->waiters++;
+        joined.fetch_add(1, std::memory_order_relaxed);
+        return it->second;
+    }
+
+    auto f = std::make_shared<flight>();
+    f->waiters = 1;
+    inflight[key] = f;
+    flights.fetch_add(1, std::memory_order_relaxed);
+    http_transfer* t = new http_transfer(method, url, headers, std::string(), [this, key, f](http_string_response&& r) { complete(key, f, std::move(r)); });
+    t->connect_ms = connect_ms;
+    t->timeout_ms = timeout_ms;
+    // completion waits for f->mtx, the stream is in place before anyone may use it
+    std::lock_guard<std::mutex> lk(f->mtx);
+    f->stream = engine.submit(t, stream_handler());
+    return f;
+}
+
+inline void http_singleflight::complete(const std::string& key, const std::shared_ptr<flight>& f, http_string_response&& r)
+{
+    auto res = std::make_shared<flight_result>();
+    res->result = r.get_result();
+    res->status = r.get_code();
+    res->headers = r.header_fields();
+    // every waiter reads the same block, its lazy index is built here before it is shared
+    res->headers.size();
+    res->timing = r.get_timing();
+    res->body = std::make_shared<const std::string>(r.take_body());
+
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        auto it = inflight.find(key);
+        if (it != inflight.end() && it->second == f)
+            inflight.erase(it);
+    }
+    std::vector<std::pair<uint64_t, callback>> cbs;
+    {
+        std::lock_guard<std::mutex> lk(f->mtx);
+        f->done = true;
+        f->result = res;
+        cbs.swap(f->callbacks);
+    }
+    f->cv.notify_all();
+    for (auto& cb : cbs)
+        cb.second(res);
+}
+
+inline bool http_singleflight::leave(const std::string& key, const std::shared_ptr<flight>& f, uint64_t id)
+{
+    http_stream abort;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        std::lock_guard<std::mutex> fl(f->mtx);
+        auto cb = std::find_if(f->callbacks.begin(), f->callbacks.end(), [id](const std::pair<uint64_t, callback>& c) { return c.first == id; });
+        if (f->done || cb == f->callbacks.end())
+            return false;
+        f->callbacks.erase(cb);
+        cancelled.fetch_add(1, std::memory_order_relaxed);
+        if (--f->waiters == 0)
+        {
+            // nobody left to want it, later callers start afresh instead of joining an abort
+            auto it = inflight.find(key);
+            if (it != inflight.end() && it->second == f)
+                inflight.erase(it);
+            abort = f->stream;
+        }
+    }
+    abort.cancel();
+    return true;
+}
+
+inline http_singleflight::result_ptr http_singleflight::run(http_multi& engine, const std::string& method, const std::string& url, const header_map& headers, long connect_ms, long timeout_ms)
+{
+    std::string k = key(method, url, headers);
+    std::shared_ptr<flight> f;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        f = join(engine, k, method, url, headers, connect_ms, timeout_ms);
+    }
+    std::unique_lock<std::mutex> lk(f->mtx);
+    f->cv.wait(lk, [&f] { return f->done; });
+    return f->result;
+}
+
+inline flight_ticket http_singleflight::run_async(http_multi& engine, const std::string& method, const std::string& url, const header_map& headers, callback cb, long connect_ms, long timeout_ms)
+{
+    flight_ticket ticket;
+    ticket.owner = this;
+    ticket.key = key(method, url, headers);
+    std::shared_ptr<flight> f;
+    result_ptr ready;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        f = join(engine, ticket.key, method, url, headers, connect_ms, timeout_ms);
+        std::lock_guard<std::mutex> fl(f->mtx);
+        if (f->done)
+            ready = f->result;
+        else
+        {
+            ticket.id = f->next_id++;
+            f->callbacks.push_back({ticket.id, std::move(cb)});
+        }
+    }
+    ticket.f = f;
+    if (ready)
+        cb(ready);
+    return ticket;
+}
+
+inline bool flight_ticket::cancel()
+{
+    if (!owner || !f)
+        return false;
+    bool pending = owner->leave(key, std::static_pointer_cast<http_singleflight::flight>(f), id);
+    f.reset();
+    return pending;
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef __HTTP_HEDGE_HPP__
+#define __HTTP_HEDGE_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "http_pool.hpp"
+#include "http_metrics.hpp"
+
+// ** hedged requests and retries ** //
+
+// For idempotent calls whose tail latency matters more than the odd extra
+// request. When an attempt has not answered within the hedge delay (the
+// chosen percentile of recent latencies) a duplicate goes out, to the same
+// url or to the next of a list of alternate origins; the first usable answer
+// wins and the others are cancelled. An attempt that fails in a way worth
+// retrying (connection trouble, timeouts, 429, 502, 503, 504) is retried
+// after an exponential backoff with full jitter, all within one overall
+// deadline.
+//
+// Every hedge and retry is paid from a budget: each call adds budget_ratio
+// to it, up to budget_reserve, and each extra attempt takes one. Over any
+// stretch of time the extra load stays below budget_ratio of the calls made
+// plus the reserve, a slow or failing backend cannot get hammered by its own
+// clients. One policy may be shared by clients on different threads, which
+// then share the latency estimate and the budget.
+
+struct hedge_options
+{
+    double percentile = 0.95;       // hedge after this share of recent calls would have answered
+    long initial_delay_ms = 50;     // hedge delay until min_samples latencies are known
+    long min_delay_ms = 1;
+    long max_delay_ms = 2000;
+    size_t min_samples = 20;
+    size_t window = 1000;           // latencies the estimate is taken over, roughly
+    int max_hedges = 1;             // duplicates per attempt, 0 turns hedging off
+    std::vector<std::string> endpoints; // "scheme://host:port" hedges go to in turn, empty: the call's own
+    long deadline_ms = 0;           // whole call including retries, 0 = none
+    int max_retries = 2;
+    long backoff_ms = 10;           // first retry waits up to this, doubling after each
+    long max_backoff_ms = 1000;
+    double budget_ratio = 0.1;      // extra attempts earned per call
+    double budget_reserve = 10;     // extra attempts that may be saved up
+};
+
+// what happened during the last hedged call
+struct hedge_report
+{
+    int attempts = 0;               // requests that went out, hedges and retries included
+    int hedges = 0;
+    int retries = 0;
+    bool hedge_won = false;         // the answer came from a duplicate
+    bool denied = false;            // a hedge or retry was skipped for lack of budget
+    bool deadline = false;          // the call ran out of time
+    std::string url;                // where the answer came from
+};
+
+// the curl_multi handle a client races its attempts on, with a connection cache
+// that lasts from call to call; a copy starts without one, like http_pool
+class hedge_multi
+{
+    CURLM* m = nullptr;
+public:
+    hedge_multi() {}
+    hedge_multi(const hedge_multi&) {}
+    hedge_multi& operator=(const hedge_multi&) { return *this; }
+    ~hedge_multi() { if (m) curl_multi_cleanup(m); }
+    CURLM* get()
+    {
+        if (!m)
+            m = curl_multi_init();
+        return m;
+    }
+};
+
+class hedge_policy
+{
+    hedge_options opts;
+    std::mutex mtx;
+    // two generations of latency counts, a new one starts every window samples
+    std::vector<uint32_t> cur, prev;
+    size_t in_cur = 0, in_prev = 0;
+    double budget;
+    std::atomic<uint64_t> calls{0}, hedges{0}, retries{0}, hedge_wins{0}, denials{0};
+    std::atomic<uint64_t> turn{0};
+
+public:
+    hedge_policy(hedge_options o = hedge_options())
+    : opts(std::move(o)), cur(METRICS_BUCKETS), prev(METRICS_BUCKETS), budget(opts.budget_reserve) {}
+    hedge_policy(const hedge_policy&) = delete;
+    hedge_policy& operator=(const hedge_policy&) = delete;
+
+    inline const hedge_options& options() const { return opts; }
+
+    // methods a duplicate or a retry cannot do harm with
+    static inline bool idempotent(const std::string& method)
+    {
+        return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "PUT" || method == "DELETE";
+    }
+    static inline bool retryable(CURLcode res, long status)
+    {
+        switch (res)
+        {
+            case CURLE_OK:
+                return status == 429 || status == 502 || status == 503 || status == 504;
+            case CURLE_COULDNT_CONNECT:
+            case CURLE_OPERATION_TIMEDOUT:
+            case CURLE_SEND_ERROR:
+            case CURLE_RECV_ERROR:
+            case CURLE_GOT_NOTHING:
+            case CURLE_PARTIAL_FILE:
+            case CURLE_HTTP2:
+            case CURLE_HTTP2_STREAM:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // how long an attempt may take before it is hedged, microseconds
+    long delay_us();
+    // latency of an attempt that answered
+    void observe(long us);
+    // a call starts, it earns its share of the budget
+    void begin_call()
+    {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(mtx);
+        budget = std::min(opts.budget_reserve, budget + opts.budget_ratio);
+    }
+    // an extra attempt, false when the budget cannot pay for it
+    bool spend(bool hedge)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (budget >= 1)
+            {
+                budget -= 1;
+                (hedge ? hedges : retries).fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        denials.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // give back what spend() took for an attempt that never went out
+    void refund(bool hedge)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        budget = std::min(opts.budget_reserve, budget + 1);
+        (hedge ? hedges : retries).fetch_sub(1, std::memory_order_relaxed);
+    }
+    inline void count_hedge_win() { hedge_wins.fetch_add(1, std::memory_order_relaxed); }
+    // wait before retry n (1 based), microseconds: uniform in [0, backoff * 2^(n-1)]
+    long backoff_us(int n)
+    {
+        thread_local std::minstd_rand rng(std::random_device{}());
+        double cap = std::min((double)opts.max_backoff_ms, opts.backoff_ms * std::pow(2.0, n - 1)) * 1000;
+        return (long)(std::uniform_real_distribution<double>(0, cap)(rng));
+    }
+    // url with its origin replaced by the next alternate endpoint, url itself without any
+    std::string hedge_url(const std::string& url)
+    {
+        if (opts.endpoints.empty())
+            return url;
+        const std::string& ep = opts.endpoints[turn.fetch_add(1, std::memory_order_relaxed) % opts.endpoints.size()];
+        return ep + url.substr(http_pool::origin(url).size());
+    }
+
+    inline uint64_t call_count() const { return calls.load(std::memory_order_relaxed); }
+    inline uint64_t hedge_count() const { return hedges.load(std::memory_order_relaxed); }
+    inline uint64_t retry_count() const { return retries.load(std::memory_order_relaxed); }
+    inline uint64_t hedge_win_count() const { return hedge_wins.load(std::memory_order_relaxed); }
+    inline uint64_t denied_count() const { return denials.load(std::memory_order_relaxed); }
+};
+
+inline long hedge_policy::delay_us()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    size_t total = in_cur + in_prev;
+    long us = opts.initial_delay_ms * 1000;
+    if (total >= opts.min_samples)
+    {
+        uint64_t rank = (uint64_t)(opts.percentile * total);
+        uint64_t seen = 0;
+        for (int i = 0; i < METRICS_BUCKETS; i++)
+        {
+            seen += cur[i] + prev[i];
+            if (seen > rank)
+            {
+                us = (long)metrics_histogram::upper(i);
+                break;
+            }
+        }
+    }
+    return std::min(opts.max_delay_ms * 1000, std::max(opts.min_delay_ms * 1000, us));
+}
+
+inline void hedge_policy::observe(long us)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (in_cur >= std::max<size_t>(opts.window / 2, 1))
+    {
+        cur.swap(prev);
+        std::fill(cur.begin(), cur.end(), 0);
+        in_prev = in_cur;
+        in_cur = 0;
+    }
+    cur[metrics_histogram::bucket((uint64_t)std::max(0L, us))]++;
+    in_cur++;
+}
+
+#endif
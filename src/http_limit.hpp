@@ -0,0 +1,352 @@
+#ifndef __HTTP_LIMIT_HPP__
+#define __HTTP_LIMIT_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "http_pool.hpp"
+#include "http_log.hpp"
+
+// ** adaptive per-host concurrency limit ** //
+
+// Admission control in front of the request path. Every origin gets its own
+// concurrency limit which follows what the server can take: requests slower
+// than tolerance times the best round trip seen lately, or answered with a
+// transport error, 429 or 5xx, bring it down, fast ones let it grow again.
+// LIMIT_AIMD adds one per limit's worth of good responses and multiplies by
+// backoff on a bad one; LIMIT_GRADIENT moves towards limit * baseline / rtt
+// plus a little headroom, so it settles where latency starts to build up.
+// The round trip is time to first byte, body size does not count.
+//
+// An optional token bucket caps the request rate on top of that. A request
+// over the limit waits in a bounded per-host queue for up to max_wait_ms, or
+// is turned away at once when the queue is full (max_queue 0: no queue at
+// all); turned away means CURL_LIMITED, no request was sent. The limiter may
+// be shared by clients on different threads.
+
+enum limit_algorithm { LIMIT_AIMD, LIMIT_GRADIENT };
+
+struct limit_options
+{
+    limit_algorithm algorithm = LIMIT_GRADIENT;
+    double initial = 8;             // concurrency a new host starts with
+    double min_limit = 1;
+    double max_limit = 256;
+    double backoff = 0.9;           // applied to the limit on an error, and by AIMD on a slow response
+    double tolerance = 2.0;         // a round trip over tolerance * baseline is slow
+    double smoothing = 0.2;         // gradient: weight of each new estimate
+    double rate = 0;                // requests per second per host, 0 for no cap
+    double burst = 0;               // token bucket depth, 0 means one second's worth
+    size_t max_queue = 64;          // callers that may wait per host
+    long max_wait_ms = 1000;        // how long one of them waits before giving up
+};
+
+// per-host view for monitoring
+struct limit_stats
+{
+    std::string host;
+    double limit = 0;
+    size_t in_flight = 0;
+    size_t queued = 0;
+    double rtt_us = 0;              // smoothed time to first byte
+    double baseline_us = 0;         // best recent time to first byte
+    uint64_t admitted = 0;
+    uint64_t rejected = 0;          // queue full or waited too long
+    uint64_t errors = 0;            // responses that brought the limit down as errors
+};
+
+class http_limiter;
+
+// one admitted request, see http_limiter::acquire; gives the slot back when destroyed
+class limit_permit
+{
+    friend class http_limiter;
+    http_limiter* owner = nullptr;
+    void* host = nullptr;
+    std::chrono::steady_clock::time_point start;
+public:
+    limit_permit() {}
+    limit_permit(limit_permit&& o) : owner(o.owner), host(o.host), start(o.start) { o.owner = nullptr; }
+    limit_permit& operator=(limit_permit&& o)
+    {
+        if (this != &o)
+        {
+            done_silent();
+            owner = o.owner;
+            host = o.host;
+            start = o.start;
+            o.owner = nullptr;
+        }
+        return *this;
+    }
+    ~limit_permit() { done_silent(); }
+    explicit operator bool() const { return owner != nullptr; }
+    // the request is over; ok false for a transport error or an overloaded answer,
+    // rtt_us 0 takes the time since admission
+    void done(bool ok, long rtt_us = 0);
+    // give the slot back without a sample, for a request that never went out
+    void done_silent();
+};
+
+class http_limiter
+{
+    friend class limit_permit;
+
+    struct host_state
+    {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::string name;
+        double limit;
+        size_t inflight = 0;
+        size_t queued = 0;
+        double rtt = 0, baseline = 0;
+        double tokens = 0;
+        std::chrono::steady_clock::time_point refilled;
+        std::chrono::steady_clock::time_point cut;     // last decrease
+        uint64_t admitted = 0, rejected = 0, errors = 0;
+    };
+
+    limit_options opts;
+    std::mutex mtx;
+    std::unordered_map<std::string, std::unique_ptr<host_state>> hosts;
+
+    host_state& host(const std::string& url);
+    // caller holds h.mtx
+    void refill(host_state& h, std::chrono::steady_clock::time_point now);
+    void update(host_state& h, bool ok, double rtt);
+    limit_permit admit(host_state& h, std::chrono::steady_clock::time_point now)
+    {
+        if (opts.rate > 0)
+            h.tokens -= 1;
+        h.inflight++;
+        h.admitted++;
+        limit_permit p;
+        p.owner = this;
+        p.host = &h;
+        p.start = now;
+        return p;
+    }
+    void release(void* host, bool sample, bool ok, long rtt_us, std::chrono::steady_clock::time_point start);
+
+public:
+    http_limiter(limit_options o = limit_options());
+    http_limiter(const http_limiter&) = delete;
+    http_limiter& operator=(const http_limiter&) = delete;
+
+    // a slot for a request to url, waiting in the host's queue if need be; an
+    // empty permit when the request is turned away
+    limit_permit acquire(const std::string& url);
+    // never waits
+    limit_permit try_acquire(const std::string& url);
+
+    // whether a finished request counts as a good sample
+    static inline bool healthy(CURLcode res, long status) { return res == CURLE_OK && status != 429 && status < 500; }
+
+    inline const limit_options& options() const { return opts; }
+    limit_stats stats(const std::string& url);
+    std::vector<limit_stats> snapshot();
+};
+
+inline http_limiter::http_limiter(limit_options o) : opts(o)
+{
+    opts.min_limit = std::max(1.0, opts.min_limit);
+    opts.max_limit = std::max(opts.min_limit, opts.max_limit);
+    opts.initial = std::min(opts.max_limit, std::max(opts.min_limit, opts.initial));
+    if (opts.rate > 0 && opts.burst < 1)
+        opts.burst = std::max(1.0, opts.rate);
+}
+
+inline http_limiter::host_state& http_limiter::host(const std::string& url)
+{
+    std::string key = http_pool::origin(url);
+    std::lock_guard<std::mutex> lk(mtx);
+    std::unique_ptr<host_state>& h = hosts[key];
+    if (!h)
+    {
+        h.reset(new host_state());
+        h->name = key;
+        h->limit = opts.initial;
+        h->tokens = opts.burst;
+        h->refilled = std::chrono::steady_clock::now();
+    }
+    return *h;
+}
+
+inline void http_limiter::refill(host_state& h, std::chrono::steady_clock::time_point now)
+{
+    if (opts.rate <= 0)
+        return;
+    h.tokens = std::min(opts.burst, h.tokens + std::chrono::duration<double>(now - h.refilled).count() * opts.rate);
+    h.refilled = now;
+}
+
+inline void http_limiter::update(host_state& h, bool ok, double rtt)
+{
+    // the requests in flight when the server got slow all come back slow, one
+    // round trip's worth of bad samples cuts the limit once
+    auto now = std::chrono::steady_clock::now();
+    bool may_cut = now - h.cut >= std::chrono::microseconds((long)std::max(h.rtt, rtt));
+    if (!ok)
+    {
+        h.errors++;
+        if (may_cut)
+        {
+            h.limit = std::max(opts.min_limit, h.limit * opts.backoff);
+            h.cut = now;
+        }
+        return;
+    }
+    // the baseline creeps up a little with every sample, a lasting change in the
+    // server's latency is learned again instead of looking like overload forever
+    h.baseline = h.baseline == 0 ? rtt : std::min(rtt, h.baseline * (1 + 1.0 / 256));
+    h.rtt = h.rtt == 0 ? rtt : h.rtt * 0.9 + rtt * 0.1;
+    double limit;
+    if (opts.algorithm == LIMIT_AIMD)
+    {
+        if (rtt > opts.tolerance * h.baseline)
+        {
+            limit = may_cut ? h.limit * opts.backoff : h.limit;
+            if (may_cut)
+                h.cut = now;
+        }
+        // only a limit that is actually used may grow
+        else if (h.inflight + 1 >= (size_t)h.limit / 2)
+            limit = h.limit + 1 / h.limit;
+        else
+            limit = h.limit;
+    }
+    else
+    {
+        double gradient = std::min(1.0, std::max(0.5, opts.tolerance * h.baseline / h.rtt));
+        double estimate = h.limit * gradient + std::sqrt(h.limit);
+        if (h.inflight + 1 < (size_t)h.limit / 2)
+            estimate = std::min(estimate, h.limit);
+        limit = h.limit * (1 - opts.smoothing) + estimate * opts.smoothing;
+    }
+    h.limit = std::min(opts.max_limit, std::max(opts.min_limit, limit));
+}
+
+inline limit_permit http_limiter::acquire(const std::string& url)
+{
+    host_state& h = host(url);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(opts.max_wait_ms);
+    std::unique_lock<std::mutex> lk(h.mtx);
+    bool queued = false;
+    for (;;)
+    {
+        auto now = std::chrono::steady_clock::now();
+        refill(h, now);
+        bool slot = h.inflight < (size_t)h.limit;
+        if (slot && (opts.rate <= 0 || h.tokens >= 1))
+        {
+            if (queued)
+                h.queued--;
+            return admit(h, now);
+        }
+        if (now >= deadline || (!queued && h.queued >= opts.max_queue))
+        {
+            if (queued)
+                h.queued--;
+            h.rejected++;
+            return limit_permit();
+        }
+        // a missing token comes back at a known time, a slot when a request finishes
+        auto until = deadline;
+        if (slot)
+            until = std::min(until, now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                              std::chrono::duration<double>((1 - h.tokens) / opts.rate)));
+        if (!queued)
+            h.queued++;
+        queued = true;
+        h.cv.wait_until(lk, until);
+    }
+}
+
+inline limit_permit http_limiter::try_acquire(const std::string& url)
+{
+    host_state& h = host(url);
+    std::lock_guard<std::mutex> lk(h.mtx);
+    auto now = std::chrono::steady_clock::now();
+    refill(h, now);
+    if (h.inflight >= (size_t)h.limit || (opts.rate > 0 && h.tokens < 1))
+    {
+        h.rejected++;
+        return limit_permit();
+    }
+    return admit(h, now);
+}
+
+inline void http_limiter::release(void* host, bool sample, bool ok, long rtt_us, std::chrono::steady_clock::time_point start)
+{
+    host_state& h = *(host_state*)host;
+    if (sample && rtt_us <= 0)
+        rtt_us = (long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lk(h.mtx);
+        h.inflight--;
+        if (sample)
+            update(h, ok, (double)std::max(1L, rtt_us));
+    }
+    // a grown limit may have room for more than one
+    h.cv.notify_all();
+}
+
+inline limit_stats http_limiter::stats(const std::string& url)
+{
+    host_state& h = host(url);
+    std::lock_guard<std::mutex> lk(h.mtx);
+    limit_stats s;
+    s.host = h.name;
+    s.limit = h.limit;
+    s.in_flight = h.inflight;
+    s.queued = h.queued;
+    s.rtt_us = h.rtt;
+    s.baseline_us = h.baseline;
+    s.admitted = h.admitted;
+    s.rejected = h.rejected;
+    s.errors = h.errors;
+    return s;
+}
+
+inline std::vector<limit_stats> http_limiter::snapshot()
+{
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        for (const auto& h : hosts)
+            names.push_back(h.first);
+    }
+    std::vector<limit_stats> out;
+    for (const auto& n : names)
+        out.push_back(stats(n));
+    return out;
+}
+
+inline void limit_permit::done(bool ok, long rtt_us)
+{
+    if (!owner)
+        return;
+    http_limiter* o = owner;
+    owner = nullptr;
+    o->release(host, true, ok, rtt_us, start);
+}
+
+inline void limit_permit::done_silent()
+{
+    if (!owner)
+        return;
+    http_limiter* o = owner;
+    owner = nullptr;
+    o->release(host, false, false, 0, start);
+}
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef __HTTP_LOG_HPP__
+#define __HTTP_LOG_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <time.h>
+#include <strings.h>
+
+#ifndef CURL_BAD_HANDLE
+#define CURL_BAD_HANDLE -1
+#endif
+#ifndef CURL_FILE_ERR
+#define CURL_FILE_ERR -2
+#endif
+#ifndef CURL_NO_RANGES
+#define CURL_NO_RANGES -3
+#endif
+#ifndef CURL_LIMITED
+#define CURL_LIMITED -4
+#endif
+
+#define LOG_RING_SIZE 1024      // records per thread, a power of two
+#define LOG_TEXT 64             // bytes of url or trace text kept per record
+
+// ** structured event log ** //
+
+// Each logged event is a fixed size record written into a ring owned by the
+// logging thread: a handful of stores and one release store of the head, no
+// lock, no allocation and no formatting. A full ring drops new records (and
+// counts them) until it is drained, so memory stays bounded at LOG_RING_SIZE
+// records per thread. drain() and text() collect every ring, the only place
+// records are turned into text.
+
+enum log_kind : unsigned char
+{
+    LOG_CALL,       // a request finished (or failed before it started)
+    LOG_TRACE       // libcurl verbose output, see http_log::debug
+};
+
+struct log_record
+{
+    uint64_t time_ns;           // CLOCK_REALTIME
+    uint64_t url_hash;          // FNV-1a of the whole url
+    int64_t duration_us;
+    const char* op;             // static string naming the call, e.g. "getfile"
+    int32_t code;               // CURLcode or CURL_BAD_HANDLE / CURL_FILE_ERR / ...
+    int32_t status;             // HTTP status, or the data size of a trace
+    uint32_t thread;            // per-log thread number
+    uint16_t text_len;
+    log_kind kind;
+    unsigned char info;         // curl_infotype of a trace
+    char method[8];
+    char text[LOG_TEXT];        // start of the url without credentials and query, or of the trace line
+};
+
+class http_log
+{
+    struct ring
+    {
+        log_record slots[LOG_RING_SIZE];
+        alignas(64) std::atomic<uint64_t> head{0};  // owner thread
+        alignas(64) std::atomic<uint64_t> tail{0};  // drainer
+        std::atomic<uint64_t> dropped{0};
+        uint32_t thread;
+    };
+
+    uint64_t id;
+    std::mutex mtx;
+    std::vector<std::unique_ptr<ring>> rings;
+
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> n{1};
+        return n++;
+    }
+    static uint64_t now_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    ring* local()
+    {
+        // same scheme as http_metrics: the last log used sits in plain thread locals
+        static thread_local uint64_t last_id = 0;
+        static thread_local ring* last = nullptr;
+        if (last_id == id)
+            return last;
+        thread_local std::vector<std::pair<uint64_t, ring*>> mine;
+        ring* r = nullptr;
+        for (const auto& m : mine)
+            if (m.first == id)
+                r = m.second;
+        if (!r)
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            rings.emplace_back(new ring());
+            r = rings.back().get();
+            r->thread = (uint32_t)rings.size();
+            mine.push_back({id, r});
+        }
+        last_id = id;
+        last = r;
+        return r;
+    }
+    // next free slot of this thread's ring, null (and counted) when it is full
+    log_record* claim(ring*& r)
+    {
+        r = local();
+        uint64_t h = r->head.load(std::memory_order_relaxed);
+        if (h - r->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE)
+        {
+            r->dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        log_record* rec = &r->slots[h & (LOG_RING_SIZE - 1)];
+        rec->time_ns = now_ns();
+        rec->thread = r->thread;
+        return rec;
+    }
+    // up to cap bytes of url with "user:pass@" and everything from '?' on left out,
+    // the hash still tells urls apart
+    static size_t url_text(std::string_view url, char* out, size_t cap)
+    {
+        size_t start = url.find("://");
+        start = start == std::string_view::npos ? 0 : start + 3;
+        size_t end = url.find_first_of("?#", start);
+        if (end == std::string_view::npos)
+            end = url.size();
+        size_t auth = url.find('/', start);
+        size_t at = url.rfind('@', std::min(auth, end));
+        size_t n = 0;
+        auto put = [&](std::string_view part) {
+            size_t k = std::min(part.size(), cap - n);
+            memcpy(out + n, part.data(), k);
+            n += k;
+        };
+        size_t host = (at != std::string_view::npos && at >= start) ? at + 1 : start;
+        put(url.substr(0, start));
+        put(url.substr(host, end - host));
+        return n;
+    }
+    // up to cap bytes of header lines with the values of credential carrying fields
+    // replaced and the query cut from a request line
+    static size_t header_text(const char* data, size_t size, char* out, size_t cap)
+    {
+        static const std::string_view secret[] = {"authorization:", "proxy-authorization:", "cookie:", "set-cookie:"};
+        size_t n = 0, pos = 0;
+        auto put = [&](const char* p, size_t len) {
+            size_t k = std::min(len, cap - n);
+            memcpy(out + n, p, k);
+            n += k;
+        };
+        while (pos < size && n < cap)
+        {
+            const char* line = data + pos;
+            const char* nl = (const char*)memchr(line, '\n', size - pos);
+            size_t len = nl ? (size_t)(nl - line) + 1 : size - pos;
+            pos += len;
+            bool hidden = false;
+            for (std::string_view s : secret)
+                if (len > s.size() && strncasecmp(line, s.data(), s.size()) == 0)
+                {
+                    put(line, s.size());
+                    put(" <redacted>\r\n", 13);
+                    hidden = true;
+                    break;
+                }
+            if (hidden)
+                continue;
+            const char* q = line == data ? (const char*)memchr(line, '?', len) : nullptr;
+            const char* sp = q ? (const char*)memchr(q, ' ', len - (q - line)) : nullptr;
+            if (q && sp)
+            {
+                // "GET /path?query HTTP/1.1"
+                put(line, q - line);
+                put(sp, len - (sp - line));
+            }
+            else
+                put(line, len);
+        }
+        return n;
+    }
+    static inline void publish(ring* r)
+    {
+        r->head.store(r->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+public:
+    http_log() : id(next_id()) {}
+    http_log(const http_log&) = delete;
+    http_log& operator=(const http_log&) = delete;
+
+    // process wide log, never destroyed so logging during exit stays safe
+    static http_log& global()
+    {
+        static http_log* g = new http_log();
+        return *g;
+    }
+
+    void call(const char* op, std::string_view method, std::string_view url, int code, long status, int64_t duration_us)
+    {
+        ring* r;
+        log_record* rec = claim(r);
+        if (!rec)
+            return;
+        uint64_t h = 1469598103934665603ULL;
+        for (char c : url)
+            h = (h ^ (unsigned char)c) * 1099511628211ULL;
+        rec->kind = LOG_CALL;
+        rec->info = 0;
+        rec->op = op;
+        rec->code = code;
+        rec->status = (int32_t)status;
+        rec->duration_us = duration_us;
+        rec->url_hash = h;
+        size_t m = std::min(method.size(), sizeof(rec->method) - 1);
+        memcpy(rec->method, method.data(), m);
+        rec->method[m] = 0;
+        rec->text_len = (uint16_t)url_text(url, rec->text, LOG_TEXT);
+        publish(r);
+    }
+
+    // CURLOPT_DEBUGFUNCTION, userptr is the http_log; text and headers keep their first
+    // LOG_TEXT bytes (Authorization and cookie values and request queries redacted),
+    // payload only its size
+    static int debug(CURL*, curl_infotype type, char* data, size_t size, void* userptr)
+    {
+        if (type == CURLINFO_SSL_DATA_IN || type == CURLINFO_SSL_DATA_OUT)
+            return 0;
+        bool text = (type == CURLINFO_TEXT || type == CURLINFO_HEADER_IN || type == CURLINFO_HEADER_OUT);
+        char buf[LOG_TEXT];
+        size_t n = 0;
+        if (type == CURLINFO_TEXT)
+            n = std::min(size, (size_t)LOG_TEXT);
+        else if (text)
+            n = header_text(data, size, buf, LOG_TEXT);
+        const char* src = type == CURLINFO_TEXT ? data : buf;
+        while (n && (src[n - 1] == '\n' || src[n - 1] == '\r'))
+            n--;
+        if (text && n == 0)
+            return 0;   // blank line ending the headers
+        http_log* self = (http_log*)userptr;
+        ring* r;
+        log_record* rec = self->claim(r);
+        if (!rec)
+            return 0;
+        rec->kind = LOG_TRACE;
+        rec->info = (unsigned char)type;
+        rec->op = "trace";
+        rec->code = 0;
+        rec->status = (int32_t)size;
+        rec->duration_us = 0;
+        rec->url_hash = 0;
+        rec->method[0] = 0;
+        memcpy(rec->text, src, n);
+        rec->text_len = (uint16_t)n;
+        publish(r);
+        return 0;
+    }
+
+    // hands every pending record to fn in time order, oldest first, and frees their slots
+    void drain(const std::function<void(const log_record&)>& fn);
+    // pending records as text, one line each
+    std::string text();
+    void discard() { drain([](const log_record&) {}); }
+    // records lost to full rings so far
+    uint64_t dropped();
+
+    static std::string format(const log_record& rec);
+};
+
+inline void http_log::drain(const std::function<void(const log_record&)>& fn)
+{
+    std::vector<log_record> out;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        for (auto& r : rings)
+        {
+            uint64_t t = r->tail.load(std::memory_order_relaxed);
+            uint64_t h = r->head.load(std::memory_order_acquire);
+            for (; t < h; t++)
+                out.push_back(r->slots[t & (LOG_RING_SIZE - 1)]);
+            r->tail.store(h, std::memory_order_release);
+        }
+    }
+    std::stable_sort(out.begin(), out.end(), [](const log_record& a, const log_record& b) { return a.time_ns < b.time_ns; });
+    for (const auto& rec : out)
+        fn(rec);
+}
+
+inline std::string http_log::text()
+{
+    std::string s;
+    drain([&s](const log_record& rec) { s += format(rec); });
+    return s;
+}
+
+inline uint64_t http_log::dropped()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    uint64_t n = 0;
+    for (auto& r : rings)
+        n += r->dropped.load(std::memory_order_relaxed);
+    return n;
+}
+
+inline std::string http_log::format(const log_record& rec)
+{
+    static const char* const infos[] = {"*", "<", ">", "<", ">", "", ""};
+    char stamp[40];
+    time_t secs = (time_t)(rec.time_ns / 1000000000ULL);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(stamp + n, sizeof(stamp) - n, ".%06uZ", (unsigned)(rec.time_ns % 1000000000ULL / 1000));
+
+    // outgoing headers arrive as one block, keep each record on one line
+    std::string text(rec.text, rec.text_len);
+    for (char& c : text)
+        if (c == '\n' || c == '\r' || c == 0)
+            c = ' ';
+    char line[512];
+    if (rec.kind == LOG_TRACE)
+    {
+        const char* dir = rec.info < 7 ? infos[rec.info] : "";
+        if (rec.text_len)
+            snprintf(line, sizeof(line), "%s [%u] trace %s %s\n", stamp, rec.thread, dir, text.c_str());
+        else
+            snprintf(line, sizeof(line), "%s [%u] trace %s %d bytes\n", stamp, rec.thread, rec.info == CURLINFO_DATA_IN ? "<" : ">", rec.status);
+        return line;
+    }
+
+    const char* what;
+    switch (rec.code)
+    {
+        case CURL_BAD_HANDLE: what = "Error in handle initialization"; break;
+        case CURL_FILE_ERR: what = "Error in opening or writing file"; break;
+        case CURL_NO_RANGES: what = "Ranges not supported"; break;
+        case CURL_LIMITED: what = "Turned away by the concurrency limit"; break;
+        default: what = rec.code >= 0 ? curl_easy_strerror((CURLcode)rec.code) : "Unknown error"; break;
+    }
+    snprintf(line, sizeof(line), "%s [%u] %s %s %s%s #%016llx -> %d (%s) status %d in %lldus\n",
+             stamp, rec.thread, rec.op, rec.method, text.c_str(), rec.text_len == LOG_TEXT ? "..." : "",
+             (unsigned long long)rec.url_hash, rec.code, what, rec.status, (long long)rec.duration_us);
+    return line;
+}
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef __HTTP_METRICS_HPP__
+#define __HTTP_METRICS_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "../dev/http/http.hpp"
+
+// latency histogram: 8 linear sub-buckets per power of two of microseconds,
+// exact up to 16us, at most 12.5% wide above, up to 2^40us
+#define METRICS_SUB_BITS 3
+#define METRICS_BUCKETS 304
+// Prometheus le bounds: every power of two of microseconds from 2^MIN to 2^MAX (64us to 67s)
+#define METRICS_PROM_MIN 6
+#define METRICS_PROM_MAX 26
+// CURLcodes counted one by one, anything above lands in the last slot
+#define METRICS_CODES 128
+
+// ** lock-free client metrics ** //
+
+// Every thread records into its own shard, the hot path is a lookup in a
+// small thread local table and a few relaxed atomic loads and stores on
+// cache lines no other thread writes to. Only the first request a thread makes to a new
+// host/method pair takes the registry mutex. snapshot() and prometheus() sum
+// the shards, they may run concurrently with recording.
+
+struct metrics_histogram
+{
+    // buckets hold (upper(idx - 1), upper(idx)], so a bound counts the values equal to it
+    static inline int bucket(uint64_t us)
+    {
+        if (us)
+            us--;
+        if (us < (2u << METRICS_SUB_BITS))
+            return (int)us;
+        int e = 63 - __builtin_clzll(us);
+        int idx = (e - METRICS_SUB_BITS + 1) * (1 << METRICS_SUB_BITS) + (int)((us >> (e - METRICS_SUB_BITS)) & ((1 << METRICS_SUB_BITS) - 1));
+        return idx < METRICS_BUCKETS ? idx : METRICS_BUCKETS - 1;
+    }
+    // largest value of bucket idx, in microseconds
+    static inline uint64_t upper(int idx)
+    {
+        if (idx < (2 << METRICS_SUB_BITS))
+            return idx + 1;
+        int e = idx / (1 << METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+        uint64_t m = (idx % (1 << METRICS_SUB_BITS)) + (1 << METRICS_SUB_BITS);
+        return (m + 1) << (e - METRICS_SUB_BITS);
+    }
+};
+
+// totals for one host/method pair
+struct metrics_snapshot
+{
+    std::string host;
+    std::string method;
+    uint64_t requests = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t conn_new = 0;
+    uint64_t conn_reused = 0;
+    uint64_t latency_sum = 0;   // microseconds
+    std::vector<std::pair<int, uint64_t>> errors;   // CURLcode, count
+    std::vector<uint64_t> buckets;                  // METRICS_BUCKETS counts
+
+    uint64_t error_count() const
+    {
+        uint64_t n = 0;
+        for (const auto& e : errors)
+            n += e.second;
+        return n;
+    }
+    // latency at quantile q (0..1) in microseconds, upper edge of its bucket
+    uint64_t percentile(double q) const
+    {
+        uint64_t total = 0;
+        for (uint64_t b : buckets)
+            total += b;
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * total + 0.5), seen = 0;
+        if (rank == 0)
+            rank = 1;
+        for (int i = 0; i < (int)buckets.size(); i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+                return metrics_histogram::upper(i);
+        }
+        return metrics_histogram::upper(METRICS_BUCKETS - 1);
+    }
+};
+
+class http_metrics
+{
+    struct series
+    {
+        std::string host;
+        std::string method;
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+        std::atomic<uint64_t> conn_new{0};
+        std::atomic<uint64_t> conn_reused{0};
+        std::atomic<uint64_t> latency_sum{0};
+        std::atomic<uint64_t> errors[METRICS_CODES];
+        std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+
+        series(std::string_view h, std::string_view m) : host(h), method(m)
+        {
+            for (auto& e : errors)
+                e.store(0, std::memory_order_relaxed);
+            for (auto& b : buckets)
+                b.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    // one per recording thread, written by that thread only
+    struct shard
+    {
+        std::deque<series> all;         // stable addresses, appended under the registry mutex
+        std::vector<series*> index;     // owner thread's lookup table
+    };
+
+    uint64_t id;
+    mutable std::mutex mtx;
+    std::vector<std::unique_ptr<shard>> shards;
+
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> n{1};
+        return n++;
+    }
+    static inline void bump(std::atomic<uint64_t>& c, uint64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    shard* local()
+    {
+        // registries are told apart by id, a destroyed one never matches again; the last
+        // one used is kept in plain thread locals, which cost no TLS wrapper call
+        static thread_local uint64_t last_id = 0;
+        static thread_local shard* last = nullptr;
+        if (last_id == id)
+            return last;
+        thread_local std::vector<std::pair<uint64_t, shard*>> mine;
+        shard* sh = nullptr;
+        for (const auto& m : mine)
+            if (m.first == id)
+                sh = m.second;
+        if (!sh)
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            shards.emplace_back(new shard());
+            sh = shards.back().get();
+            mine.push_back({id, sh});
+        }
+        last_id = id;
+        last = sh;
+        return sh;
+    }
+    series* find(std::string_view host, std::string_view method)
+    {
+        shard* sh = local();
+        for (series* s : sh->index)
+            if (s->host.size() == host.size() && s->method == method && memcmp(s->host.data(), host.data(), host.size()) == 0)
+                return s;
+        std::lock_guard<std::mutex> lk(mtx);
+        sh->all.emplace_back(host, method);
+        sh->index.push_back(&sh->all.back());
+        return sh->index.back();
+    }
+
+public:
+    http_metrics() : id(next_id()) {}
+    http_metrics(const http_metrics&) = delete;
+    http_metrics& operator=(const http_metrics&) = delete;
+
+    // process wide registry, never destroyed so recording during exit stays safe
+    static http_metrics& global()
+    {
+        static http_metrics* g = new http_metrics();
+        return *g;
+    }
+
+    // "scheme://host:port" of a url, the series label; credentials in the authority
+    // ("user:pass@") are left out. Allocates only for urls that carry them, the view
+    // then points into a per-thread buffer that lasts until the next such call.
+    static std::string_view host_of(std::string_view url)
+    {
+        size_t i = 0, n = url.size(), start = 0;
+        for (; i + 2 < n; i++)
+            if (url[i] == ':' && url[i + 1] == '/' && url[i + 2] == '/')
+            {
+                start = i + 3;
+                break;
+            }
+        i = start;
+        size_t at = std::string_view::npos;
+        while (i < n && url[i] != '/' && url[i] != '?' && url[i] != '#')
+        {
+            if (url[i] == '@')
+                at = i;
+            i++;
+        }
+        if (at == std::string_view::npos)
+            return url.substr(0, i);
+        thread_local std::string label;
+        label.assign(url.data(), start);
+        label.append(url.data() + at + 1, i - at - 1);
+        return label;
+    }
+    // a label value as the exposition format wants it, backslash, quote and newline escaped
+    static std::string escape(std::string_view v)
+    {
+        std::string out;
+        out.reserve(v.size());
+        for (char c : v)
+        {
+            if (c == '\\' || c == '"')
+                out += '\\';
+            if (c == '\n')
+                out += "\\n";
+            else
+                out += c;
+        }
+        return out;
+    }
+
+    void record(std::string_view method, std::string_view url, int rc, const http_timing& t)
+    {
+        series* s = find(host_of(url), method);
+        // only this thread writes the series, a relaxed load and store is enough and
+        // avoids the locked read-modify-write; readers never see a torn value
+        bump(s->requests, 1);
+        if (rc != 0)
+            bump(s->errors[(rc > 0 && rc < METRICS_CODES) ? rc : METRICS_CODES - 1], 1);
+        bump(s->bytes_in, (uint64_t)(t.bytes_received + t.header_bytes_received));
+        bump(s->bytes_out, (uint64_t)(t.bytes_sent + t.header_bytes_sent));
+        if (rc == 0)
+            bump(t.reused ? s->conn_reused : s->conn_new, 1);
+        bump(s->latency_sum, (uint64_t)t.total);
+        bump(s->buckets[metrics_histogram::bucket((uint64_t)t.total)], 1);
+    }
+    void record(std::string_view method, std::string_view url, int rc, CURL* hdl)
+    {
+        http_timing t;
+        t.fill(hdl, (CURLcode)rc);
+        record(method, url, rc, t);
+    }
+
+    std::vector<metrics_snapshot> snapshot() const;
+    // Prometheus text exposition format, prefix is prepended to every metric name
+    std::string prometheus(const std::string& prefix = "eznet_") const;
+};
+
+inline std::vector<metrics_snapshot> http_metrics::snapshot() const
+{
+    std::vector<metrics_snapshot> out;
+    const auto rel = std::memory_order_relaxed;
+    std::lock_guard<std::mutex> lk(mtx);
+    for (const auto& sh : shards)
+    {
+        for (const auto& s : sh->all)
+        {
+            metrics_snapshot* m = nullptr;
+            for (auto& o : out)
+                if (o.host == s.host && o.method == s.method)
+                    m = &o;
+            if (!m)
+            {
+                out.emplace_back();
+                m = &out.back();
+                m->host = s.host;
+                m->method = s.method;
+                m->buckets.assign(METRICS_BUCKETS, 0);
+            }
+            m->requests += s.requests.load(rel);
+            m->bytes_in += s.bytes_in.load(rel);
+            m->bytes_out += s.bytes_out.load(rel);
+            m->conn_new += s.conn_new.load(rel);
+            m->conn_reused += s.conn_reused.load(rel);
+            m->latency_sum += s.latency_sum.load(rel);
+            for (int i = 0; i < METRICS_BUCKETS; i++)
+                m->buckets[i] += s.buckets[i].load(rel);
+            for (int c = 0; c < METRICS_CODES; c++)
+            {
+                uint64_t n = s.errors[c].load(rel);
+                if (!n)
+                    continue;
+                bool found = false;
+                for (auto& e : m->errors)
+                    if (e.first == c)
+                    {
+                        e.second += n;
+                        found = true;
+                    }
+                if (!found)
+                    m->errors.push_back({c, n});
+            }
+        }
+    }
+    return out;
+}
+
+inline std::string http_metrics::prometheus(const std::string& prefix) const
+{
+    std::vector<metrics_snapshot> snap = snapshot();
+    std::string out;
+    char buf[256];
+    auto counter = [&](const char* name, const char* help) {
+        out += "# HELP " + prefix + name + " " + help + "\n# TYPE " + prefix + name + " counter\n";
+    };
+    auto labels = [](const metrics_snapshot& m) {
+        return "host=\"" + escape(m.host) + "\",method=\"" + escape(m.method) + "\"";
+    };
+
+    counter("requests_total", "Requests completed.");
+    for (const auto& m : snap)
+        out += prefix + "requests_total{" + labels(m) + "} " + std::to_string(m.requests) + "\n";
+    counter("errors_total", "Requests failed, by CURLcode.");
+    for (const auto& m : snap)
+        for (const auto& e : m.errors)
+            out += prefix + "errors_total{" + labels(m) + ",code=\"" + std::to_string(e.first) + "\"} " + std::to_string(e.second) + "\n";
+    counter("received_bytes_total", "Header and body bytes received.");
+    for (const auto& m : snap)
+        out += prefix + "received_bytes_total{" + labels(m) + "} " + std::to_string(m.bytes_in) + "\n";
+    counter("sent_bytes_total", "Header and body bytes sent.");
+    for (const auto& m : snap)
+        out += prefix + "sent_bytes_total{" + labels(m) + "} " + std::to_string(m.bytes_out) + "\n";
+    counter("connections_total", "Successful requests by whether they opened a connection or reused one.");
+    for (const auto& m : snap)
+    {
+        out += prefix + "connections_total{" + labels(m) + ",kind=\"new\"} " + std::to_string(m.conn_new) + "\n";
+        out += prefix + "connections_total{" + labels(m) + ",kind=\"reused\"} " + std::to_string(m.conn_reused) + "\n";
+    }
+
+    // a fixed set of power of two bounds, the full resolution stays available through snapshot()
+    std::string name = prefix + "request_duration_seconds";
+    out += "# HELP " + name + " Request latency.\n# TYPE " + name + " histogram\n";
+    for (const auto& m : snap)
+    {
+        uint64_t cum = 0;
+        int i = 0;
+        for (int e = METRICS_PROM_MIN; e <= METRICS_PROM_MAX; e++)
+        {
+            for (; i < METRICS_BUCKETS && metrics_histogram::upper(i) <= (1ull << e); i++)
+                cum += m.buckets[i];
+            snprintf(buf, sizeof(buf), "%.9g", (1ull << e) / 1e6);
+            out += name + "_bucket{" + labels(m) + ",le=\"" + buf + "\"} " + std::to_string(cum) + "\n";
+        }
+        out += name + "_bucket{" + labels(m) + ",le=\"+Inf\"} " + std::to_string(m.requests) + "\n";
+        snprintf(buf, sizeof(buf), "%.6f", m.latency_sum / 1e6);
+        out += name + "_sum{" + labels(m) + "} " + buf + "\n";
+        out += name + "_count{" + labels(m) + "} " + std::to_string(m.requests) + "\n";
+    }
+    return out;
+}
+
+#endif
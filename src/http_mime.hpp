@@ -0,0 +1,230 @@
+#ifndef __HTTP_MIME_HPP__
+#define __HTTP_MIME_HPP__
+
+#include <curl/curl.h>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#ifndef header_map
+#define header_map std::map<std::string, std::string>
+#endif
+
+#define MIME_STRING 0
+#define MIME_FILE 1
+#define MIME_BUFFER 2
+#define MIME_GENERATOR 3
+#define MIME_MULTIPART 4
+
+// ** multipart form parts ** //
+
+// Parts are described here and turned into a curl_mime tree for each request
+// by http_client::formpost(), so one set of parts can be posted any number of
+// times. String, buffer and generator parts are never copied into libcurl,
+// their bytes are read on demand while the request goes out: the part (and
+// for a buffer part the memory it points at) has to stay alive until the call
+// returns. A multipart part nests further parts as multipart/mixed (or any
+// other multipart subtype).
+
+class mime_part
+{
+    int type;
+    header_map hds;
+    std::string ctype;
+public:
+    mime_part(int t, const header_map& headers) : type(t), hds(headers) {}
+    virtual ~mime_part() {}
+    int dtype() const { return type; }
+    const header_map& get_headers() const { return hds; }
+    // Content-Type of the part, empty leaves it to libcurl
+    mime_part& set_type(std::string t) { ctype = std::move(t); return *this; }
+    const std::string& get_type() const { return ctype; }
+};
+
+class mime_string_part : public mime_part
+{
+    std::string f;
+    std::string d;
+public:
+    mime_string_part(std::string field, std::string data, const header_map& headers = header_map()) : mime_part(MIME_STRING, headers), f(field), d(data) {}
+    const std::string& get_field() const { return f; }
+    const std::string& get_data() const { return d; }
+};
+
+class mime_file_part : public mime_part
+{
+    std::string f;
+    std::string pth;
+    std::string rmt;
+public:
+    mime_file_part (std::string field, std::string path, std::string remotename, const header_map& headers = header_map()) : mime_part(MIME_FILE, headers), f(field), pth(path), rmt(remotename) {}
+    const std::string& get_field() const { return f; }
+    const std::string& get_path() const { return pth; }
+    const std::string& get_remote() const { return rmt; }
+};
+
+// bytes owned by the caller, any content including NULs; filename empty sends none
+class mime_buffer_part : public mime_part
+{
+    std::string f;
+    std::string_view d;
+    std::string rmt;
+public:
+    mime_buffer_part(std::string field, const void* data, size_t size, std::string filename = std::string(), const header_map& headers = header_map())
+    : mime_part(MIME_BUFFER, headers), f(field), d((const char*)data, size), rmt(filename) {}
+    mime_buffer_part(std::string field, std::string_view data, std::string filename = std::string(), const header_map& headers = header_map())
+    : mime_part(MIME_BUFFER, headers), f(field), d(data), rmt(filename) {}
+    const std::string& get_field() const { return f; }
+    std::string_view get_data() const { return d; }
+    const std::string& get_remote() const { return rmt; }
+};
+
+// Content produced while the request goes out: gen fills at most len bytes of
+// buf with the part's bytes from offset on and returns how many, 0 at the end
+// (or CURL_READFUNC_ABORT to fail the request). It is asked for offset 0 again
+// when libcurl has to rewind. size -1 when unknown, the request is then sent
+// chunked.
+typedef std::function<size_t(char* buf, size_t len, curl_off_t offset)> mime_generator;
+
+class mime_generator_part : public mime_part
+{
+    std::string f;
+    curl_off_t sz;
+    mime_generator g;
+    std::string rmt;
+public:
+    mime_generator_part(std::string field, curl_off_t size, mime_generator gen, std::string filename = std::string(), const header_map& headers = header_map())
+    : mime_part(MIME_GENERATOR, headers), f(field), sz(size), g(std::move(gen)), rmt(filename) {}
+    const std::string& get_field() const { return f; }
+    curl_off_t get_size() const { return sz; }
+    const mime_generator& get_generator() const { return g; }
+    const std::string& get_remote() const { return rmt; }
+};
+
+// parts either borrowed from the caller or created in place with add() and owned
+class mime_list
+{
+    std::vector<mime_part*> parts;
+    std::vector<std::unique_ptr<mime_part>> owned;
+public:
+    explicit mime_list(std::vector<mime_part*> borrowed = std::vector<mime_part*>()) : parts(std::move(borrowed)) {}
+    mime_list(const mime_list&) = delete;
+    mime_list& operator=(const mime_list&) = delete;
+
+    template <class P, class... A>
+    P& add(A&&... args)
+    {
+        P* p = new P(std::forward<A>(args)...);
+        owned.emplace_back(p);
+        parts.push_back(p);
+        return *p;
+    }
+    void add(mime_part* p) { parts.push_back(p); }
+    const std::vector<mime_part*>& get_parts() const { return parts; }
+};
+
+class mime_multipart_part : public mime_part, public mime_list
+{
+    std::string f;
+    std::string sub;
+public:
+    // subtype as in multipart/<subtype>
+    mime_multipart_part(std::string field, std::vector<mime_part*> parts = std::vector<mime_part*>(), std::string subtype = "mixed", const header_map& headers = header_map())
+    : mime_part(MIME_MULTIPART, headers), mime_list(std::move(parts)), f(field), sub(subtype) {}
+    const std::string& get_field() const { return f; }
+    const std::string& get_subtype() const { return sub; }
+};
+
+// a whole form, built once and posted as often as needed
+class mime_form : public mime_list
+{
+public:
+    explicit mime_form(std::vector<mime_part*> parts = std::vector<mime_part*>()) : mime_list(std::move(parts)) {}
+};
+
+// ** caller owned bytes as a mime part body, read in place ** //
+
+// one cursor per request, owned and freed by libcurl; the bytes stay where they are
+struct mime_view_source
+{
+    std::string_view data;
+    size_t pos = 0;
+
+    mime_view_source(std::string_view d) : data(d) {}
+
+    static size_t read(char* buffer, size_t size, size_t nitems, void* arg)
+    {
+        mime_view_source* s = (mime_view_source*)arg;
+        size_t n = std::min(size*nitems, s->data.size() - s->pos);
+        memcpy(buffer, s->data.data() + s->pos, n);
+        s->pos += n;
+        return n;
+    }
+    static int seek(void* arg, curl_off_t offset, int origin)
+    {
+        mime_view_source* s = (mime_view_source*)arg;
+        curl_off_t base = origin == SEEK_SET ? 0 : origin == SEEK_CUR ? (curl_off_t)s->pos : (curl_off_t)s->data.size();
+        if (base + offset < 0 || base + offset > (curl_off_t)s->data.size())
+            return CURL_SEEKFUNC_FAIL;
+        s->pos = (size_t)(base + offset);
+        return CURL_SEEKFUNC_OK;
+    }
+    static void release(void* arg) { delete (mime_view_source*)arg; }
+
+    static void attach(curl_mimepart* part, std::string_view data)
+    {
+        curl_mime_data_cb(part, (curl_off_t)data.size(), read, seek, release, new mime_view_source(data));
+    }
+};
+
+// ** generated mime part body ** //
+
+struct mime_generator_source
+{
+    const mime_generator* gen;
+    curl_off_t size;
+    curl_off_t pos = 0;
+
+    mime_generator_source(const mime_generator* g, curl_off_t sz) : gen(g), size(sz) {}
+
+    static size_t read(char* buffer, size_t size, size_t nitems, void* arg)
+    {
+        mime_generator_source* s = (mime_generator_source*)arg;
+        size_t len = size*nitems;
+        if (s->size >= 0)
+            len = (size_t)std::min<curl_off_t>((curl_off_t)len, s->size - s->pos);
+        if (len == 0)
+            return 0;
+        size_t n = (*s->gen)(buffer, len, s->pos);
+        if (n != CURL_READFUNC_ABORT && n != CURL_READFUNC_PAUSE)
+            s->pos += (curl_off_t)std::min(n, len);
+        return n;
+    }
+    // generators are addressed by offset, any position can be produced again
+    static int seek(void* arg, curl_off_t offset, int origin)
+    {
+        mime_generator_source* s = (mime_generator_source*)arg;
+        if (origin == SEEK_END && s->size < 0)
+            return CURL_SEEKFUNC_CANTSEEK;
+        curl_off_t base = origin == SEEK_SET ? 0 : origin == SEEK_CUR ? s->pos : s->size;
+        if (base + offset < 0 || (s->size >= 0 && base + offset > s->size))
+            return CURL_SEEKFUNC_FAIL;
+        s->pos = base + offset;
+        return CURL_SEEKFUNC_OK;
+    }
+    static void release(void* arg) { delete (mime_generator_source*)arg; }
+
+    static void attach(curl_mimepart* part, const mime_generator& gen, curl_off_t size)
+    {
+        curl_mime_data_cb(part, size, read, seek, release, new mime_generator_source(&gen, size));
+    }
+};
+
+#endif
@@ -0,0 +1,845 @@
+#ifndef __HTTP_MULTI_HPP__
+#define __HTTP_MULTI_HPP__
+
+#include <curl/curl.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+#include <cstring>
+#include <chrono>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#ifndef header_map
+#define header_map std::map<std::string, std::string>
+#endif
+
+#include "../dev/http/http.hpp"
+#include "http_pool.hpp"
+#include "http_metrics.hpp"
+#include "http_log.hpp"
+
+// ** streaming responses ** //
+
+// return values of stream_handler::on_chunk
+#define STREAM_CONTINUE 0
+#define STREAM_PAUSE 1      // libcurl holds on to this chunk and delivers it again on resume
+#define STREAM_ABORT 2
+
+// body chunks are handed over as they arrive instead of being kept, headers
+// (and the status code) come first; both run on the engine thread
+struct stream_handler
+{
+    std::function<void(long code, const header_map& headers)> on_headers;
+    std::function<int(const char* data, size_t len)> on_chunk;
+};
+
+class http_multi;
+class http_transfer;
+
+// shared between a streaming transfer and the http_stream handed to the caller
+struct stream_state
+{
+    http_multi* engine = nullptr;
+    http_transfer* t = nullptr;     // engine thread only, null once completed
+    std::atomic<bool> done{false};
+};
+
+// ** single asynchronous request, owned by the engine between submit and completion ** //
+
+class http_transfer
+{
+public:
+    typedef std::function<void(http_string_response&&)> callback;
+
+    std::string method;     // "GET", "PUT", "POST" or any custom verb
+    std::string url;
+    header_map headers;
+    std::string data;       // request body, owned so the caller may return right away
+    callback done;
+    bool h2c = false;       // sent with h2c prior knowledge, set by the engine
+    stream_handler stream;  // set for streaming transfers, the body is then not kept
+    std::shared_ptr<stream_state> ctl;
+    // multipart body built on the engine thread when the transfer starts, instead of data
+    std::function<curl_mime*(CURL*)> form;
+    long timeout_ms = 0;    // whole transfer from submit(), time spent queued included; 0 = none
+    long connect_ms = 0;    // CURLOPT_CONNECTTIMEOUT_MS, 0 = libcurl's default
+
+    http_transfer(std::string m, std::string u, header_map h, std::string d, callback cb)
+    : method(std::move(m)), url(std::move(u)), headers(std::move(h)), data(std::move(d)), done(std::move(cb)) {}
+    ~http_transfer() { curl_slist_free_all(hds); curl_mime_free(mime); }
+
+    void setup(CURL* h);
+    void finish(CURLcode rc);
+    // forget everything received so the transfer can be set up again
+    void rewind()
+    {
+        curl_slist_free_all(hds);
+        hds = nullptr;
+        curl_mime_free(mime);
+        mime = nullptr;
+        sent = 0;
+        headers_sent = false;
+        res = http_string_response();
+    }
+    inline CURL* handle() { return hdl; }
+    // what is left of timeout_ms, meaningless without one
+    inline long remaining_ms() const
+    {
+        return timeout_ms - (long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - queued).count();
+    }
+
+private:
+    friend class http_multi;
+    CURL* hdl = nullptr;
+    curl_slist* hds = nullptr;
+    curl_mime* mime = nullptr;
+    std::chrono::steady_clock::time_point queued;   // set by submit() when there is a timeout
+    size_t sent = 0;
+    bool headers_sent = false;
+    bool probe = false;     // first h2c request to its origin, finds out whether it speaks HTTP/2
+    bool held = false;      // waiting for that answer, not handed to libcurl
+    http_string_response res;
+
+    void deliver_headers()
+    {
+        if (headers_sent)
+            return;
+        headers_sent = true;
+        if (stream.on_headers)
+        {
+            long code = 0;
+            curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &code);
+            stream.on_headers(code, res.headers.map());
+        }
+    }
+    static size_t on_write(char* buffer, size_t size, size_t nmemb, http_transfer* t)
+    {
+        size_t n = size*nmemb;
+        if (t->stream.on_chunk)
+        {
+            t->deliver_headers();
+            int r = t->stream.on_chunk(buffer, n);
+            if (r == STREAM_PAUSE)
+                return CURL_WRITEFUNC_PAUSE;
+            return r == STREAM_ABORT ? 0 : n;
+        }
+        t->res.body.append(buffer, n);
+        return n;
+    }
+    static size_t on_read(char* buffer, size_t size, size_t nmemb, http_transfer* t)
+    {
+        size_t n = std::min(size*nmemb, t->data.size() - t->sent);
+        memcpy(buffer, t->data.data() + t->sent, n);
+        t->sent += n;
+        return n;
+    }
+    static size_t on_header(char* buffer, size_t size, size_t nitems, http_transfer* t)
+    {
+        // kept raw, parsed only when the caller looks at the headers
+        size_t n = size*nitems;
+        t->res.headers.add(buffer, n);
+        return n;
+    }
+};
+
+inline void http_transfer::setup(CURL* h)
+{
+    hdl = h;
+    curl_easy_setopt(hdl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(hdl, CURLOPT_PRIVATE, this);
+    curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, on_write);
+    curl_easy_setopt(hdl, CURLOPT_WRITEDATA, this);
+    curl_easy_setopt(hdl, CURLOPT_HEADERFUNCTION, on_header);
+    curl_easy_setopt(hdl, CURLOPT_HEADERDATA, this);
+
+    if (timeout_ms > 0)
+        curl_easy_setopt(hdl, CURLOPT_TIMEOUT_MS, std::max(1L, remaining_ms()));
+    if (connect_ms > 0)
+        curl_easy_setopt(hdl, CURLOPT_CONNECTTIMEOUT_MS, connect_ms);
+
+    if (form)
+    {
+        mime = form(hdl);
+        curl_easy_setopt(hdl, CURLOPT_MIMEPOST, mime);
+        if (method != "POST")
+            curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, method.c_str());
+    }
+    else if (method == "PUT")
+    {
+        curl_easy_setopt(hdl, CURLOPT_READFUNCTION, on_read);
+        curl_easy_setopt(hdl, CURLOPT_READDATA, this);
+        curl_easy_setopt(hdl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)data.size());
+        curl_easy_setopt(hdl, CURLOPT_UPLOAD, 1L);
+    }
+    else if (method == "POST")
+    {
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data.data());
+        curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)data.size());
+    }
+    else if (method != "GET")
+    {
+        if (!data.empty())
+        {
+            curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, data.data());
+            curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)data.size());
+        }
+        curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, method.c_str());
+        // otherwise libcurl waits for the body Content-Length announces
+        if (method == "HEAD")
+            curl_easy_setopt(hdl, CURLOPT_NOBODY, 1L);
+    }
+
+    for (auto& h : headers)
+    {
+        std::string header = h.first + ":" + h.second;
+        hds = curl_slist_append(hds, header.c_str());
+    }
+    if (hds)
+        curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, hds);
+}
+
+inline void http_transfer::finish(CURLcode rc)
+{
+    res.noError = (rc == CURLE_OK);
+    res.result = rc;
+    res.error = curl_easy_strerror(rc);
+    if (hdl)
+    {
+        curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &res.code);
+        res.timing.fill(hdl, rc);
+    }
+    if (stream.on_chunk && hdl && rc == CURLE_OK)
+        deliver_headers();
+    if (ctl)
+    {
+        ctl->t = nullptr;
+        ctl->done = true;
+    }
+    if (done)
+        done(std::move(res));
+}
+
+// caller side of a streaming transfer, pause/resume/cancel may be called from any thread;
+// the engine must outlive it
+class http_stream
+{
+    std::shared_ptr<stream_state> st;
+    void act(int bits);
+public:
+    http_stream() {}
+    http_stream(std::shared_ptr<stream_state> s) : st(std::move(s)) {}
+    inline void pause() { act(CURLPAUSE_RECV); }
+    inline void resume() { act(CURLPAUSE_CONT); }
+    void cancel();
+    inline bool done() const { return !st || st->done; }
+};
+
+// ** curl_multi engine driving many transfers on one thread ** //
+
+// submit() may be called from any thread. Transfers beyond the in-flight cap
+// wait in a queue and are admitted as running ones complete. Completion
+// callbacks run on the engine thread, so they should be short.
+//
+// The engine either runs its own thread (start/stop) or, after attach(), is
+// driven by the caller's event loop: libcurl reports the sockets it wants
+// watched and the timeout it needs through the two callbacks, and the loop
+// calls socket_action() / on_timeout() when those fire. An eventfd is
+// reported the same way so that submit() from other threads wakes the loop.
+//
+// With enable_http2() concurrent transfers to one origin are multiplexed as
+// streams over a shared connection instead of each opening its own. Plain
+// http:// origins use h2c prior knowledge with libcurl 8.0 or later, an
+// Upgrade: h2c offer before that. The first prior knowledge request to an
+// origin goes out alone and the others wait for it. If it gets an HTTP/2
+// reply, the origin is known to speak h2c and the rest are multiplexed. If the
+// reply is not HTTP/2 at all (CURLE_HTTP2, CURLE_WEIRD_SERVER_REPLY, or the
+// connection closed on it: CURLE_SEND_ERROR, CURLE_GOT_NOTHING) twice in a row,
+// the origin is remembered as HTTP/1.1-only and the rest go out over HTTP/1.1;
+// once could be a dropped connection, which libcurl reports the same way. A
+// GET, HEAD or OPTIONS that fails like that is sent again, first as h2c then
+// over HTTP/1.1; anything else fails with that error rather than going out
+// twice. Any other failure, before or after, is an ordinary failure and
+// decides nothing.
+
+class http_multi
+{
+    CURLM* mh;
+    std::mutex mtx;
+    std::deque<http_transfer*> pending;     // submitted, not yet handed to libcurl
+    size_t max_inflight;
+    std::unordered_set<http_transfer*> live;    // handed to libcurl, engine thread only
+    std::vector<CURL*> spare;               // recycled easy handles, engine thread only
+    std::vector<std::function<void()>> posted;  // work queued for the engine thread
+    std::thread worker;
+    std::atomic<bool> running{false};
+
+public:
+    typedef std::function<void(curl_socket_t fd, int what)> socket_callback;    // what is CURL_POLL_*
+    typedef std::function<void(long timeout_ms)> timer_callback;               // -1 cancels the timer
+    // asked for up to room more transfers when the queue runs dry, appends them to out
+    typedef std::function<void(size_t room, std::vector<http_transfer*>& out)> steal_callback;
+
+private:
+    bool http2 = false;
+    bool prior_knowledge = false;
+    bool upgrade = false;       // h2c asked for but libcurl cannot do prior knowledge, Upgrade: h2c instead
+    std::unordered_set<std::string> h1_only;    // origins that failed h2c, engine thread only
+    std::unordered_set<std::string> h2c_ok;     // origins that answered h2c, engine thread only
+    std::unordered_set<std::string> h2c_doubt;  // first request failed as if not HTTP/2, once
+    // origins whose first h2c request is out, with the transfers held back for it
+    std::unordered_map<std::string, std::vector<http_transfer*>> probing;
+    CURLSH* share = nullptr;
+    std::string accept;
+    bool decode = false;
+    std::atomic<http_metrics*> metrics{nullptr};
+    std::atomic<http_log*> logs{nullptr};
+
+    steal_callback on_idle;
+    std::atomic<size_t> nlive{0};           // live.size() for other threads
+    int cpu = -1;                           // core the engine thread is pinned to, -1 = none
+
+    bool external = false;
+    int wakefd = -1;
+    socket_callback on_socket;
+    timer_callback on_timer;
+
+    static int socket_trampoline(CURL*, curl_socket_t fd, int what, http_multi* m, void*)
+    {
+        if (m->on_socket)
+            m->on_socket(fd, what);
+        return 0;
+    }
+    static int timer_trampoline(CURLM*, long timeout_ms, http_multi* m)
+    {
+        if (m->on_timer)
+            m->on_timer(timeout_ms);
+        return 0;
+    }
+
+    void admit();
+    void reap();
+    void complete(http_transfer* t, CURLcode rc);
+    void loop();
+    void fail_pending();
+    bool tune(http_transfer* t);
+    void restart(http_transfer* t);
+    void settle(http_transfer* t);
+    bool h1_fallback(http_transfer* t, CURLcode rc);
+
+public:
+    http_multi(size_t max_inflight = 64) : max_inflight(max_inflight) { mh = curl_multi_init(); }
+    http_multi(const http_multi&) = delete;
+    http_multi& operator=(const http_multi&) = delete;
+    ~http_multi();
+
+    void submit(http_transfer* t);
+    http_stream submit(http_transfer* t, stream_handler h);
+    void start();
+    void stop();
+    // run fn on the engine thread, the only place transfers may be touched once submitted
+    void post(std::function<void()> fn);
+    // make the engine thread look at its queue (and steal) now instead of at its next event
+    void wake();
+    // engine thread only: stop a submitted transfer, it completes with CURLE_ABORTED_BY_CALLBACK
+    void cancel(http_transfer* t);
+
+    // external event loop integration
+    void attach(socket_callback scb, timer_callback tcb);
+    void detach();
+    void socket_action(curl_socket_t fd, int ev_bitmask);     // ev_bitmask is CURL_CSELECT_*
+    void on_timeout();
+
+    // call before the first submit(), the options are not applied to running transfers
+    // conns_per_host 0 leaves the connection count uncapped, CURLOPT_PIPEWAIT still keeps
+    // streams on one connection while HTTP/1.1 origins get parallel connections
+    void enable_http2(bool prior_knowledge = true, long streams_per_conn = 100, long conns_per_host = 0);
+
+    // attach every transfer to shared caches (see http_share.hpp), call before the first submit()
+    inline void set_share(CURLSH* sh)
+    {
+        share = sh;
+        curl_multi_setopt(mh, CURLMOPT_MAXCONNECTS, sh ? http_pool::shared_conns : 0L);
+    }
+    // negotiate compressed responses and decode them as they arrive ("" for every encoding
+    // libcurl was built with, null for none), call before the first submit()
+    inline void set_accept_encoding(const char* enc) { decode = enc != nullptr; accept = enc ? enc : ""; }
+    // count completed transfers in a metrics registry (see http_metrics.hpp), null stops it
+    inline void set_metrics(http_metrics* m) { metrics = m; }
+    // one record per completed transfer in l (see http_log.hpp), written on the engine thread
+    inline void set_log(http_log* l) { logs = l; }
+
+    // work stealing between engines (see http_executor.hpp), set before start()
+    inline void set_steal(steal_callback cb) { on_idle = std::move(cb); }
+    // take up to max queued transfers from the back of the queue, at most half of it;
+    // streaming transfers stay, their http_stream talks to this engine
+    size_t steal(size_t max, std::vector<http_transfer*>& out);
+    // queued transfers, and transfers handed to libcurl
+    inline size_t backlog() { std::lock_guard<std::mutex> lk(mtx); return pending.size(); }
+    inline size_t load() const { return nlive.load(std::memory_order_relaxed); }
+    // pin the engine thread to a core, applied by start()
+    inline void set_cpu(int c) { cpu = c; }
+
+    inline void set_max_inflight(size_t n) { std::lock_guard<std::mutex> lk(mtx); max_inflight = n ? n : 1; }
+    inline size_t get_max_inflight() { std::lock_guard<std::mutex> lk(mtx); return max_inflight; }
+    inline bool is_running() const { return running; }
+    inline CURLM* handle() { return mh; }
+};
+
+inline http_multi::~http_multi()
+{
+    stop();
+    detach();
+    while (!live.empty())
+        cancel(*live.begin());
+    fail_pending();
+    for (auto h : spare)
+        curl_easy_cleanup(h);
+    curl_multi_cleanup(mh);
+    if (wakefd >= 0)
+        close(wakefd);
+}
+
+inline void http_multi::submit(http_transfer* t)
+{
+    if (t->timeout_ms > 0)
+        t->queued = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        pending.push_back(t);
+    }
+    wake();
+}
+
+inline http_stream http_multi::submit(http_transfer* t, stream_handler h)
+{
+    auto st = std::make_shared<stream_state>();
+    st->engine = this;
+    st->t = t;
+    t->stream = std::move(h);
+    t->ctl = st;
+    submit(t);
+    return http_stream(st);
+}
+
+inline void http_multi::post(std::function<void()> fn)
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        posted.push_back(std::move(fn));
+    }
+    wake();
+}
+
+inline void http_multi::wake()
+{
+    if (external)
+    {
+        uint64_t one = 1;
+        ssize_t n = ::write(wakefd, &one, sizeof(one));
+        (void)n;
+    }
+    else
+        curl_multi_wakeup(mh);
+}
+
+inline void http_multi::cancel(http_transfer* t)
+{
+    if (live.count(t))
+    {
+        curl_multi_remove_handle(mh, t->handle());
+        complete(t, CURLE_ABORTED_BY_CALLBACK);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        auto it = std::find(pending.begin(), pending.end(), t);
+        if (it == pending.end())
+            return;
+        pending.erase(it);
+    }
+    t->finish(CURLE_ABORTED_BY_CALLBACK);
+    delete t;
+}
+
+inline size_t http_multi::steal(size_t max, std::vector<http_transfer*>& out)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    size_t take = std::min(max, (pending.size() + 1) / 2);
+    size_t n = 0;
+    for (size_t i = pending.size(); i-- > 0 && n < take; )
+    {
+        if (pending[i]->ctl)
+            continue;
+        out.push_back(pending[i]);
+        pending.erase(pending.begin() + i);
+        n++;
+    }
+    return n;
+}
+
+inline void http_multi::start()
+{
+    if (external || running.exchange(true))
+        return;
+    worker = std::thread(&http_multi::loop, this);
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(worker.native_handle(), sizeof(set), &set);
+    }
+}
+
+inline void http_multi::stop()
+{
+    if (!running.exchange(false))
+        return;
+    curl_multi_wakeup(mh);
+    worker.join();
+}
+
+inline void http_multi::attach(socket_callback scb, timer_callback tcb)
+{
+    stop();
+    if (wakefd < 0)
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    on_socket = std::move(scb);
+    on_timer = std::move(tcb);
+    external = true;
+
+    curl_multi_setopt(mh, CURLMOPT_SOCKETFUNCTION, socket_trampoline);
+    curl_multi_setopt(mh, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(mh, CURLMOPT_TIMERFUNCTION, timer_trampoline);
+    curl_multi_setopt(mh, CURLMOPT_TIMERDATA, this);
+
+    if (on_socket)
+        on_socket(wakefd, CURL_POLL_IN);
+    // anything submitted before attaching gets picked up on the first wakeup
+    uint64_t one = 1;
+    ssize_t n = ::write(wakefd, &one, sizeof(one));
+    (void)n;
+}
+
+inline void http_multi::detach()
+{
+    if (!external)
+        return;
+    if (on_socket)
+        on_socket(wakefd, CURL_POLL_REMOVE);
+    on_socket = nullptr;
+    on_timer = nullptr;
+}
+
+inline void http_multi::enable_http2(bool prior, long streams_per_conn, long conns_per_host)
+{
+    http2 = true;
+    // before 8.0 libcurl fails every request after the first on an h2c connection, and an
+    // HTTP/1.1 reply to the preface as a send error; there h2c is only offered by Upgrade
+    bool reliable = curl_version_info(CURLVERSION_NOW)->version_num >= 0x080000;
+    prior_knowledge = prior && reliable;
+    upgrade = prior && !reliable;
+    curl_multi_setopt(mh, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (conns_per_host > 0)
+        curl_multi_setopt(mh, CURLMOPT_MAX_HOST_CONNECTIONS, conns_per_host);
+#if LIBCURL_VERSION_NUM >= 0x074300
+    curl_multi_setopt(mh, CURLMOPT_MAX_CONCURRENT_STREAMS, streams_per_conn);
+#endif
+}
+
+// false when t is held back until the first request to its origin shows whether it speaks h2c
+inline bool http_multi::tune(http_transfer* t)
+{
+    CURL* hdl = t->handle();
+    if (share)
+        curl_easy_setopt(hdl, CURLOPT_SHARE, share);
+    if (decode)
+        curl_easy_setopt(hdl, CURLOPT_ACCEPT_ENCODING, accept.c_str());
+    if (!http2)
+        return true;
+    std::string origin = http_pool::origin(t->url);
+    bool plain = t->url.compare(0, 7, "http://") == 0;
+    t->h2c = prior_knowledge && plain && !h1_only.count(origin);
+    if (upgrade && plain)
+    {
+        // the answer to the first request decides, nothing to wait for
+        curl_easy_setopt(hdl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2_0);
+        return true;
+    }
+    curl_easy_setopt(hdl, CURLOPT_HTTP_VERSION, t->h2c ? (long)CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : (long)CURL_HTTP_VERSION_2TLS);
+    if (t->h2c && !h2c_ok.count(origin) && !t->probe)
+    {
+        auto it = probing.find(origin);
+        if (it != probing.end())
+        {
+            it->second.push_back(t);
+            t->held = true;
+            return false;
+        }
+        probing.emplace(origin, std::vector<http_transfer*>());
+        t->probe = true;
+    }
+    // wait for a pending connection to confirm multiplexing rather than opening another one;
+    // the first request to an origin has nothing to wait for, and closes its connection so
+    // that one it broke on is not left for the rest to wait on
+    curl_easy_setopt(hdl, CURLOPT_PIPEWAIT, t->probe ? 0L : 1L);
+    if (t->probe)
+        curl_easy_setopt(hdl, CURLOPT_FORBID_REUSE, 1L);
+    return true;
+}
+
+// set t up again from scratch and hand it to libcurl, unless it is held back once more
+inline void http_multi::restart(http_transfer* t)
+{
+    CURL* hdl = t->handle();
+    curl_easy_reset(hdl);
+    t->rewind();
+    t->setup(hdl);
+    if (tune(t))
+        curl_multi_add_handle(mh, hdl);
+}
+
+// the first request to an origin is done, whatever was held back for it goes out
+inline void http_multi::settle(http_transfer* t)
+{
+    t->probe = false;
+    auto it = probing.find(http_pool::origin(t->url));
+    if (it == probing.end())
+        return;
+    std::vector<http_transfer*> held;
+    held.swap(it->second);
+    probing.erase(it);
+    for (auto h : held)
+    {
+        h->held = false;
+        restart(h);
+    }
+}
+
+inline bool http_multi::h1_fallback(http_transfer* t, CURLcode rc)
+{
+    if (!t->probe)
+        return false;
+    long code = 0;
+    curl_easy_getinfo(t->handle(), CURLINFO_RESPONSE_CODE, &code);
+    // only a reply that is no HTTP/2 at all, or a connection the server dropped on seeing the
+    // preface, says so; anything else settles nothing
+    if (code != 0 || (rc != CURLE_HTTP2 && rc != CURLE_WEIRD_SERVER_REPLY && rc != CURLE_SEND_ERROR && rc != CURLE_GOT_NOTHING))
+        return false;
+
+    // the server may have acted on the request, only a safe one is sent again
+    bool safe = t->method == "GET" || t->method == "HEAD" || t->method == "OPTIONS";
+    std::string origin = http_pool::origin(t->url);
+    if (h2c_doubt.insert(origin).second)
+    {
+        // a first time, the same request finds out again with the rest still held
+        if (!safe)
+            settle(t);
+        else
+            restart(t);
+        return safe;
+    }
+    h2c_doubt.erase(origin);
+    h1_only.insert(origin);
+    settle(t);
+    if (safe)
+        restart(t);
+    return safe;
+}
+
+inline void http_multi::socket_action(curl_socket_t fd, int ev_bitmask)
+{
+    int active;
+    if (fd == wakefd)
+    {
+        uint64_t cnt;
+        ssize_t n = ::read(wakefd, &cnt, sizeof(cnt));
+        (void)n;
+        admit();
+        return;
+    }
+    curl_multi_socket_action(mh, fd, ev_bitmask, &active);
+    reap();
+    admit();
+}
+
+inline void http_multi::on_timeout()
+{
+    int active;
+    curl_multi_socket_action(mh, CURL_SOCKET_TIMEOUT, 0, &active);
+    reap();
+    admit();
+}
+
+inline void http_multi::admit()
+{
+    std::vector<http_transfer*> next, expired;
+    std::vector<std::function<void()>> work;
+    size_t room = 0;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        work.swap(posted);
+        while (!pending.empty() && live.size() + next.size() < max_inflight)
+        {
+            http_transfer* t = pending.front();
+            pending.pop_front();
+            // out of time while queued, not worth a slot
+            (t->timeout_ms > 0 && t->remaining_ms() <= 0 ? expired : next).push_back(t);
+        }
+        if (pending.empty() && live.size() + next.size() < max_inflight)
+            room = max_inflight - live.size() - next.size();
+    }
+    // own queue drained with slots to spare, help a busier engine
+    if (room && on_idle && running)
+        on_idle(room, next);
+
+    for (auto& fn : work)
+        fn();
+    for (auto t : expired)
+    {
+        t->finish(CURLE_OPERATION_TIMEDOUT);
+        delete t;
+    }
+    for (auto t : next)
+    {
+        CURL* hdl;
+        if (!spare.empty())
+        {
+            hdl = spare.back();
+            spare.pop_back();
+        }
+        else if (!(hdl = curl_easy_init()))
+        {
+            t->finish(CURLE_FAILED_INIT);
+            delete t;
+            continue;
+        }
+        t->setup(hdl);
+        live.insert(t);
+        if (tune(t))
+            curl_multi_add_handle(mh, hdl);
+    }
+    nlive = live.size();
+}
+
+inline void http_multi::reap()
+{
+    int left;
+    while (CURLMsg* msg = curl_multi_info_read(mh, &left))
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        CURL* hdl = msg->easy_handle;
+        CURLcode rc = msg->data.result;
+        http_transfer* t = nullptr;
+        curl_easy_getinfo(hdl, CURLINFO_PRIVATE, (char**)&t);
+        curl_multi_remove_handle(mh, hdl);
+        if (!h1_fallback(t, rc))
+            complete(t, rc);
+    }
+}
+
+// t is already out of the multi handle
+inline void http_multi::complete(http_transfer* t, CURLcode rc)
+{
+    CURL* hdl = t->handle();
+    live.erase(t);
+    nlive = live.size();
+    if (t->probe)
+    {
+        long version = 0;
+        curl_easy_getinfo(hdl, CURLINFO_HTTP_VERSION, &version);
+        if (version == CURL_HTTP_VERSION_2_0)
+            h2c_ok.insert(http_pool::origin(t->url));
+        h2c_doubt.erase(http_pool::origin(t->url));
+        settle(t);
+    }
+    else if (t->held)
+    {
+        auto& v = probing[http_pool::origin(t->url)];
+        v.erase(std::find(v.begin(), v.end(), t));
+    }
+    if (http_metrics* m = metrics.load(std::memory_order_relaxed))
+        m->record(t->method, t->url, (int)rc, hdl);
+    if (http_log* l = logs.load(std::memory_order_relaxed))
+    {
+        long code = 0;
+        curl_off_t total = 0;
+        curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_getinfo(hdl, CURLINFO_TOTAL_TIME_T, &total);
+        l->call("async", t->method, t->url, (int)rc, code, (int64_t)total);
+    }
+    t->finish(rc);
+    delete t;
+
+    // keep as many handles around as may run at once
+    curl_easy_reset(hdl);
+    if (spare.size() < get_max_inflight())
+        spare.push_back(hdl);
+    else
+        curl_easy_cleanup(hdl);
+}
+
+inline void http_multi::loop()
+{
+    while (running)
+    {
+        admit();
+        int active;
+        curl_multi_perform(mh, &active);
+        reap();
+        // freed slots are refilled before waiting, new handles make the poll return at once
+        admit();
+        curl_multi_poll(mh, nullptr, 0, 1000, nullptr);
+    }
+}
+
+inline void http_multi::fail_pending()
+{
+    std::deque<http_transfer*> left;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        left.swap(pending);
+    }
+    for (auto t : left)
+    {
+        t->finish(CURLE_ABORTED_BY_CALLBACK);
+        delete t;
+    }
+}
+
+inline void http_stream::act(int bits)
+{
+    if (done())
+        return;
+    auto s = st;
+    s->engine->post([s, bits]() {
+        if (s->t && s->t->handle())
+            curl_easy_pause(s->t->handle(), bits);
+    });
+}
+
+inline void http_stream::cancel()
+{
+    if (done())
+        return;
+    auto s = st;
+    s->engine->post([s]() {
+        if (s->t)
+            s->engine->cancel(s->t);
+    });
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef __HTTP_POOL_HPP__
+#define __HTTP_POOL_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+// ** pool of reusable easy handles ** //
+
+// An easy handle keeps its connection cache (and DNS / TLS session caches)
+// alive across curl_easy_reset(), so handing the same handle back to the
+// same origin lets libcurl reuse the keep-alive connection instead of doing
+// a fresh TCP / TLS handshake for every call.
+
+class http_pool
+{
+    struct idle_handle
+    {
+        CURL* hdl;
+        std::string origin;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::vector<idle_handle> idle;  // oldest first
+    size_t max_idle = 8;            // handles kept around between calls
+    long idle_timeout = 60;         // seconds an idle handle / connection may sit unused
+    long max_age = 0;               // seconds a connection may live in total, 0 = no limit
+    long http_version = CURL_HTTP_VERSION_NONE;
+    long connect_ms = 0;            // CURLOPT_CONNECTTIMEOUT_MS, 0 = libcurl's default
+    long total_ms = 0;              // CURLOPT_TIMEOUT_MS for a whole transfer, 0 = none
+    CURLSH* share = nullptr;        // caches shared with other pools, see http_share.hpp
+    std::string accept;             // Accept-Encoding when decode is set, see http_compress.hpp
+    bool decode = false;
+    curl_debug_callback debug = nullptr;    // verbose trace sink, see http_log.hpp
+    void* debug_data = nullptr;
+
+    void evict_expired()
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto limit = std::chrono::seconds(idle_timeout);
+        size_t keep = 0;
+        for (size_t i = 0; i < idle.size(); i++)
+        {
+            if (now - idle[i].since > limit)
+                curl_easy_cleanup(idle[i].hdl);
+            else
+                idle[keep++] = std::move(idle[i]);
+        }
+        idle.resize(keep);
+    }
+
+    void apply_defaults(CURL* hdl)
+    {
+        curl_easy_setopt(hdl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(hdl, CURLOPT_MAXAGE_CONN, idle_timeout);
+#if LIBCURL_VERSION_NUM >= 0x075000
+        if (max_age > 0)
+            curl_easy_setopt(hdl, CURLOPT_MAXLIFETIME_CONN, max_age);
+#endif
+        if (http_version != CURL_HTTP_VERSION_NONE)
+            curl_easy_setopt(hdl, CURLOPT_HTTP_VERSION, http_version);
+        if (connect_ms > 0)
+            curl_easy_setopt(hdl, CURLOPT_CONNECTTIMEOUT_MS, connect_ms);
+        if (total_ms > 0)
+            curl_easy_setopt(hdl, CURLOPT_TIMEOUT_MS, total_ms);
+        if (share)
+        {
+            curl_easy_setopt(hdl, CURLOPT_SHARE, share);
+            curl_easy_setopt(hdl, CURLOPT_MAXCONNECTS, shared_conns);
+        }
+        if (decode)
+            curl_easy_setopt(hdl, CURLOPT_ACCEPT_ENCODING, accept.c_str());
+        if (debug)
+        {
+            curl_easy_setopt(hdl, CURLOPT_DEBUGFUNCTION, debug);
+            curl_easy_setopt(hdl, CURLOPT_DEBUGDATA, debug_data);
+            curl_easy_setopt(hdl, CURLOPT_VERBOSE, 1L);
+        }
+    }
+
+public:
+    // idle connections a shared cache keeps (CURLOPT_MAXCONNECTS); libcurl trims the cache to
+    // the limit of whichever handle returns a connection, 5 by default for an easy handle
+    static constexpr long shared_conns = 1024;
+
+    http_pool() {}
+    // handles are never shared between pools, a copy only takes the configuration
+    http_pool(const http_pool& o) : max_idle(o.max_idle), idle_timeout(o.idle_timeout), max_age(o.max_age), http_version(o.http_version), connect_ms(o.connect_ms), total_ms(o.total_ms), share(o.share), accept(o.accept), decode(o.decode), debug(o.debug), debug_data(o.debug_data) {}
+    http_pool& operator=(const http_pool& o)
+    {
+        if (this != &o)
+        {
+            clear();
+            max_idle = o.max_idle;
+            idle_timeout = o.idle_timeout;
+            max_age = o.max_age;
+            http_version = o.http_version;
+            connect_ms = o.connect_ms;
+            total_ms = o.total_ms;
+            share = o.share;
+            accept = o.accept;
+            decode = o.decode;
+            debug = o.debug;
+            debug_data = o.debug_data;
+        }
+        return *this;
+    }
+    ~http_pool() { clear(); }
+
+    // "scheme://host:port" part of a url, used as the reuse key
+    static std::string origin(const std::string& url)
+    {
+        size_t start = url.find("://");
+        start = (start == std::string::npos) ? 0 : start + 3;
+        size_t end = url.find_first_of("/?#", start);
+        return url.substr(0, end);
+    }
+
+    CURL* acquire(const std::string& url);
+    void release(CURL* hdl, const std::string& url);
+    void clear()
+    {
+        for (auto& h : idle)
+            curl_easy_cleanup(h.hdl);
+        idle.clear();
+    }
+
+    inline void set_size(size_t n) { max_idle = n; while (idle.size() > max_idle) { curl_easy_cleanup(idle.front().hdl); idle.erase(idle.begin()); } }
+    inline void set_idle_timeout(long secs) { idle_timeout = secs; }
+    inline void set_max_age(long secs) { max_age = secs; }
+    inline void set_http_version(long v) { http_version = v; }
+    // connect and whole transfer timeouts in milliseconds, 0 leaves libcurl's default
+    inline void set_timeouts(long connect, long total) { connect_ms = connect; total_ms = total; }
+    inline long timeout() const { return total_ms; }
+    inline long connect_timeout() const { return connect_ms; }
+    // idle handles still point at the old share, they are dropped
+    inline void set_share(CURLSH* sh) { if (sh != share) { clear(); share = sh; } }
+    // responses negotiated and decoded with this Accept-Encoding ("" for all libcurl knows), null for none
+    inline void set_accept_encoding(const char* enc) { decode = enc != nullptr; accept = enc ? enc : ""; }
+    // libcurl verbose output goes to fn (CURLOPT_DEBUGFUNCTION), null turns it off
+    inline void set_debug(curl_debug_callback fn, void* data) { debug = fn; debug_data = data; }
+    inline size_t size() const { return max_idle; }
+    inline size_t idle_count() const { return idle.size(); }
+};
+
+inline CURL* http_pool::acquire(const std::string& url)
+{
+    evict_expired();
+
+    CURL* hdl = nullptr;
+    if (!idle.empty())
+    {
+        // prefer the most recently used handle that already talked to this origin,
+        // otherwise take the most recently used one, its cache can hold several hosts
+        std::string org = origin(url);
+        size_t pick = idle.size() - 1;
+        for (size_t i = idle.size(); i-- > 0; )
+        {
+            if (idle[i].origin == org)
+            {
+                pick = i;
+                break;
+            }
+        }
+        hdl = idle[pick].hdl;
+        idle.erase(idle.begin() + pick);
+    }
+    else
+    {
+        hdl = curl_easy_init();
+        if (!hdl)
+            return nullptr;
+    }
+
+    apply_defaults(hdl);
+    return hdl;
+}
+
+inline void http_pool::release(CURL* hdl, const std::string& url)
+{
+    if (!hdl)
+        return;
+    if (max_idle == 0)
+    {
+        curl_easy_cleanup(hdl);
+        return;
+    }
+
+    // drop per-request options (and with them pointers into caller memory),
+    // live connections and caches survive the reset
+    curl_easy_reset(hdl);
+
+    if (idle.size() >= max_idle)
+    {
+        curl_easy_cleanup(idle.front().hdl);
+        idle.erase(idle.begin());
+    }
+    idle.push_back({hdl, origin(url), std::chrono::steady_clock::now()});
+}
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef __HTTP_PREPARED_HPP__
+#define __HTTP_PREPARED_HPP__
+
+#include <curl/curl.h>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+#ifndef header_map
+#define header_map std::map<std::string, std::string>
+#endif
+
+// ** request shape compiled once and replayed ** //
+
+// Method, header list, url and extra options are built when the request is
+// prepared, a call only sets them on a pooled handle. The url may contain
+// "{name}" placeholders that are filled with bind() between calls; a url
+// without placeholders is parsed once into a CURLU. Placeholders may not be
+// part of the scheme, host or port, the origin connections are pooled by:
+// such a request is not valid() and performing it fails with
+// CURLE_URL_MALFORMAT. Not thread safe, use one prepared_request per thread.
+
+class prepared_request
+{
+    struct segment
+    {
+        std::string text;   // literal text, or the variable name when var
+        bool var;
+        size_t slot;
+    };
+
+    std::string mthd;
+    std::string org;
+    curl_slist* hds = nullptr;
+    CURLU* parsed = nullptr;
+    std::vector<segment> segs;
+    std::vector<std::string> vals;
+    std::vector<std::pair<CURLoption, long>> opts;
+    std::string url_buf;
+    bool dirty = true;
+    bool bad = false;
+
+    static bool unreserved(unsigned char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               c == '-' || c == '.' || c == '_' || c == '~';
+    }
+
+    void compile(const std::string& tmpl);
+
+public:
+    prepared_request(std::string method, const std::string& url, const header_map& headers = header_map());
+    prepared_request(const prepared_request&) = delete;
+    prepared_request& operator=(const prepared_request&) = delete;
+    ~prepared_request()
+    {
+        curl_slist_free_all(hds);
+        curl_url_cleanup(parsed);
+    }
+
+    // fills every "{name}" placeholder, percent-encoded unless escape is false
+    bool bind(std::string_view name, std::string_view value, bool escape = true);
+    // extra long valued option set on every call, e.g. CURLOPT_TIMEOUT_MS
+    inline void set_option(CURLoption opt, long value) { opts.push_back({opt, value}); }
+
+    // false when the url has a placeholder in its origin
+    inline bool valid() const { return !bad; }
+    inline const std::string& method() const { return mthd; }
+    inline const std::string& origin() const { return org; }
+    // current url with the bound values, rebuilt only after bind()
+    const std::string& url();
+    // sets method, url, headers and options on hdl, body and sink are up to the caller
+    void apply(CURL* hdl);
+};
+
+inline prepared_request::prepared_request(std::string method, const std::string& url, const header_map& headers)
+: mthd(std::move(method))
+{
+    for (const auto& h : headers)
+    {
+        std::string header = h.first + ":" + h.second;
+        hds = curl_slist_append(hds, header.c_str());
+    }
+    compile(url);
+
+    // "scheme://host:port", the pool reuse key, placeholders are not allowed in it
+    size_t start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+    org = url.substr(0, url.find_first_of("/?#", start));
+    bad = org.find('{') != std::string::npos;
+}
+
+inline void prepared_request::compile(const std::string& tmpl)
+{
+    size_t pos = 0;
+    while (pos < tmpl.size())
+    {
+        size_t open = tmpl.find('{', pos);
+        size_t close = (open == std::string::npos) ? std::string::npos : tmpl.find('}', open);
+        if (close == std::string::npos)
+        {
+            segs.push_back({tmpl.substr(pos), false, 0});
+            break;
+        }
+        if (open > pos)
+            segs.push_back({tmpl.substr(pos, open - pos), false, 0});
+        segs.push_back({tmpl.substr(open + 1, close - open - 1), true, vals.size()});
+        vals.emplace_back();
+        pos = close + 1;
+    }
+
+    if (vals.empty())
+    {
+        parsed = curl_url();
+        if (curl_url_set(parsed, CURLUPART_URL, tmpl.c_str(), 0) != CURLUE_OK)
+        {
+            curl_url_cleanup(parsed);
+            parsed = nullptr;
+        }
+        url_buf = tmpl;
+        dirty = false;
+    }
+}
+
+inline bool prepared_request::bind(std::string_view name, std::string_view value, bool escape)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    bool found = false;
+    for (auto& sg : segs)
+    {
+        if (!sg.var || sg.text != name)
+            continue;
+        std::string& v = vals[sg.slot];
+        v.clear();
+        for (unsigned char c : value)
+        {
+            if (!escape || unreserved(c))
+                v += (char)c;
+            else
+            {
+                v += '%';
+                v += hex[c >> 4];
+                v += hex[c & 15];
+            }
+        }
+        found = true;
+    }
+    dirty |= found;
+    return found;
+}
+
+inline const std::string& prepared_request::url()
+{
+    if (dirty)
+    {
+        // url_buf keeps its capacity, a steady loop does not allocate here
+        url_buf.clear();
+        for (const auto& sg : segs)
+            url_buf += sg.var ? vals[sg.slot] : sg.text;
+        dirty = false;
+    }
+    return url_buf;
+}
+
+inline void prepared_request::apply(CURL* hdl)
+{
+    if (parsed)
+        curl_easy_setopt(hdl, CURLOPT_CURLU, parsed);
+    else
+        curl_easy_setopt(hdl, CURLOPT_URL, url().c_str());
+
+    // GET, POST and PUT follow from the body options the caller sets
+    if (mthd != "GET" && mthd != "POST" && mthd != "PUT")
+        curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, mthd.c_str());
+    // otherwise libcurl waits for the body Content-Length announces
+    if (mthd == "HEAD")
+        curl_easy_setopt(hdl, CURLOPT_NOBODY, 1L);
+
+    if (hds)
+        curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, hds);
+    for (const auto& o : opts)
+        curl_easy_setopt(hdl, o.first, o.second);
+}
+
+#endif
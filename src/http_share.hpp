@@ -0,0 +1,54 @@
+#ifndef __HTTP_SHARE_HPP__
+#define __HTTP_SHARE_HPP__
+
+#include <curl/curl.h>
+#include <mutex>
+
+// ** caches shared between clients on different threads ** //
+
+// Wraps a curl_share holding the DNS cache, the TLS session cache and the
+// connection cache. Every http_client (or http_multi) attached to the same
+// http_share resolves a host once and resumes TLS sessions / reuses
+// connections opened by the others. libcurl calls back into lock()/unlock()
+// around every access, one mutex per kind of data keeps unrelated caches
+// from contending. Attached pools and engines raise their connection limit
+// to http_pool::shared_conns, so that one client returning a connection does
+// not close the others'. The share has to outlive every handle attached to it.
+
+class http_share
+{
+    CURLSH* sh;
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, http_share* s)
+    {
+        s->locks[data].lock();
+    }
+    static void unlock(CURL*, curl_lock_data data, http_share* s)
+    {
+        s->locks[data].unlock();
+    }
+
+public:
+    http_share(bool dns = true, bool tls_sessions = true, bool connections = true)
+    {
+        sh = curl_share_init();
+        curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, lock);
+        curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, unlock);
+        curl_share_setopt(sh, CURLSHOPT_USERDATA, this);
+        if (dns)
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        if (tls_sessions)
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        if (connections)
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    http_share(const http_share&) = delete;
+    http_share& operator=(const http_share&) = delete;
+    ~http_share() { curl_share_cleanup(sh); }
+
+    inline CURLSH* handle() { return sh; }
+    inline void attach(CURL* hdl) { curl_easy_setopt(hdl, CURLOPT_SHARE, sh); }
+};
+
+#endif
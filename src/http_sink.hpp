@@ -0,0 +1,257 @@
+#ifndef __HTTP_SINK_HPP__
+#define __HTTP_SINK_HPP__
+
+#include <curl/curl.h>
+#include <string>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+
+// never reserve more than this up front, whatever Content-Length claims
+#define SINK_MAX_RESERVE (64L << 20)
+
+// ** response body sinks ** //
+
+// A sink receives the body of a response. expect() is called with the size
+// announced by Content-Length before the first write() so the sink can size
+// its storage once, write() returning false aborts the transfer with
+// CURLE_WRITE_ERROR.
+
+class response_sink
+{
+public:
+    virtual ~response_sink() {}
+    virtual bool enabled() const { return true; }
+    virtual void begin() {}
+    virtual void expect(curl_off_t size) { (void)size; }
+    virtual bool write(const char* data, size_t len) = 0;
+};
+
+// appends to a caller owned string, a string reused across requests keeps its capacity
+class string_sink : public response_sink
+{
+    std::string* s;
+public:
+    string_sink(std::string* str) : s(str) {}
+    bool enabled() const override { return s != nullptr; }
+    void expect(curl_off_t size) override
+    {
+        if (size > 0)
+            s->reserve(s->size() + (size_t)std::min<curl_off_t>(size, SINK_MAX_RESERVE));
+    }
+    bool write(const char* data, size_t len) override
+    {
+        s->append(data, len);
+        return true;
+    }
+};
+
+// writes into a caller provided buffer, a body that does not fit fails the transfer
+class buffer_sink : public response_sink
+{
+    char* buf;
+    size_t cap;
+    size_t len = 0;
+public:
+    buffer_sink(void* buffer, size_t capacity) : buf((char*)buffer), cap(capacity) {}
+    void begin() override { len = 0; }
+    bool write(const char* data, size_t n) override
+    {
+        if (n > cap - len)
+            return false;
+        memcpy(buf + len, data, n);
+        len += n;
+        return true;
+    }
+    inline const char* data() const { return buf; }
+    inline size_t size() const { return len; }
+};
+
+// ** fixed size blocks recycled across requests ** //
+
+struct sink_block
+{
+    sink_block* next;
+    size_t used;
+    char data[1];
+};
+
+// thread safe free list of blocks, once warmed up a steady workload allocates nothing
+class block_pool
+{
+    size_t bsize;
+    size_t max_free;
+    size_t nfree = 0;
+    sink_block* free_list = nullptr;
+    std::mutex mtx;
+
+public:
+    block_pool(size_t block_size = 64 << 10, size_t max_free_blocks = 1024) : bsize(block_size), max_free(max_free_blocks) {}
+    block_pool(const block_pool&) = delete;
+    block_pool& operator=(const block_pool&) = delete;
+    ~block_pool()
+    {
+        while (free_list)
+        {
+            sink_block* b = free_list;
+            free_list = b->next;
+            free(b);
+        }
+    }
+
+    inline size_t block_size() const { return bsize; }
+
+    sink_block* acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (free_list)
+            {
+                sink_block* b = free_list;
+                free_list = b->next;
+                nfree--;
+                b->next = nullptr;
+                b->used = 0;
+                return b;
+            }
+        }
+        sink_block* b = (sink_block*)malloc(offsetof(sink_block, data) + bsize);
+        if (b)
+        {
+            b->next = nullptr;
+            b->used = 0;
+        }
+        return b;
+    }
+
+    // gives back a whole chain
+    void release(sink_block* head)
+    {
+        while (head)
+        {
+            sink_block* b = head;
+            head = head->next;
+            std::unique_lock<std::mutex> lk(mtx);
+            if (nfree < max_free)
+            {
+                b->next = free_list;
+                free_list = b;
+                nfree++;
+            }
+            else
+            {
+                lk.unlock();
+                free(b);
+            }
+        }
+    }
+};
+
+// chain of filled blocks, owns them until destroyed or moved, then they go back to the pool
+class block_chain
+{
+    block_pool* pool = nullptr;
+    sink_block* head = nullptr;
+    size_t total = 0;
+
+    friend class block_sink;
+    block_chain(block_pool* p, sink_block* h, size_t n) : pool(p), head(h), total(n) {}
+
+public:
+    block_chain() {}
+    block_chain(const block_chain&) = delete;
+    block_chain& operator=(const block_chain&) = delete;
+    block_chain(block_chain&& o) : pool(o.pool), head(o.head), total(o.total) { o.head = nullptr; o.total = 0; }
+    block_chain& operator=(block_chain&& o)
+    {
+        if (this != &o)
+        {
+            clear();
+            pool = o.pool;
+            head = o.head;
+            total = o.total;
+            o.head = nullptr;
+            o.total = 0;
+        }
+        return *this;
+    }
+    ~block_chain() { clear(); }
+
+    void clear()
+    {
+        if (pool)
+            pool->release(head);
+        head = nullptr;
+        total = 0;
+    }
+    inline const sink_block* first() const { return head; }
+    inline size_t size() const { return total; }
+    // copies the chain out, for callers that do need one contiguous buffer
+    std::string str() const
+    {
+        std::string s;
+        s.reserve(total);
+        for (const sink_block* b = head; b; b = b->next)
+            s.append(b->data, b->used);
+        return s;
+    }
+};
+
+// fills pooled blocks, take() hands the body off without copying it
+class block_sink : public response_sink
+{
+    block_pool& pool;
+    sink_block* head = nullptr;
+    sink_block* tail = nullptr;
+    size_t total = 0;
+
+public:
+    block_sink(block_pool& p) : pool(p) {}
+    block_sink(const block_sink&) = delete;
+    block_sink& operator=(const block_sink&) = delete;
+    ~block_sink() { pool.release(head); }
+
+    void begin() override
+    {
+        pool.release(head);
+        head = tail = nullptr;
+        total = 0;
+    }
+    bool write(const char* data, size_t len) override
+    {
+        size_t bsize = pool.block_size();
+        while (len)
+        {
+            if (!tail || tail->used == bsize)
+            {
+                sink_block* b = pool.acquire();
+                if (!b)
+                    return false;
+                if (tail)
+                    tail->next = b;
+                else
+                    head = b;
+                tail = b;
+            }
+            size_t n = std::min(len, bsize - tail->used);
+            memcpy(tail->data + tail->used, data, n);
+            tail->used += n;
+            data += n;
+            len -= n;
+            total += n;
+        }
+        return true;
+    }
+    inline size_t size() const { return total; }
+    block_chain take()
+    {
+        block_chain c(&pool, head, total);
+        head = tail = nullptr;
+        total = 0;
+        return c;
+    }
+};
+
+#endif